@@ -0,0 +1,279 @@
+/*
+ Bench.h - harness of the benchmarks in bench/
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LITTLEFS_BENCH_H
+#define __LITTLEFS_BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/*
+ * Options of every benchmark
+ *   --json <file>       results as JSON, "-" for stdout (the table goes to stderr)
+ *   --filter <text>     only the cases whose name contains text
+ *   --samples <n>       timed batches per case (default 10)
+ *   --min-time <ms>     least time of a batch (default 20)
+ * The other options go to LittleFS.begin(), the test dir defaults to .bench/
+ *
+ * JSON: { "suite", "schema": 1, "timestamp", "compiler", "results": [ {
+ *   "name", "iterations", "samples", "ns_per_op" (median of the batches),
+ *   "min_ns", "mean_ns", "stddev_ns", "bytes_per_op", "bytes_per_second",
+ *   "samples_ns": [ ns per op of each batch ], "counters": { ... } } ] }
+ * bench/compare.py compares the results of two builds.
+ */
+class Bench
+{
+public:
+    struct Result {
+        std::string name;
+        uint64_t    iterations = 0;     // Per batch
+        size_t      samples = 0;
+        double      nsPerOp = 0;        // Median batch
+        double      minNs = 0;
+        double      meanNs = 0;
+        double      stddevNs = 0;
+        uint64_t    bytesPerOp = 0;
+        std::vector<double> samplesNs;  // Per op, in the order they ran
+        std::vector<std::pair<std::string, double>> counters;
+    };
+
+    Bench(const char* suite, int argc, char** argv) : _suite(suite) {
+        _args.push_back(argv[0]);
+        _args.push_back((char*) "--test-dir");
+        _args.push_back((char*) ".bench/");
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+                _json = argv[++i];
+            } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+                _filter = argv[++i];
+            } else if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+                _samples = std::max(1, atoi(argv[++i]));
+            } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+                _minBatchNs = std::max(1, atoi(argv[++i])) * 1000000ull;
+            } else {
+                _args.push_back(argv[i]);
+            }
+        }
+        // the test dir of the file system, the last --test-dir wins
+        for (size_t i = 1; i + 1 < _args.size(); i++) {
+            if (strcmp(_args[i], "--test-dir") == 0) {
+                _dir = _args[i + 1];
+            }
+        }
+        _log = _json == "-" ? stderr : stdout;
+    }
+
+    // Arguments for LittleFS.begin(), makes the test dir
+    int argc() const { return (int) _args.size(); }
+    char** argv() {
+#if defined(_WIN32)
+        mkdir(_dir.c_str());
+#else
+        mkdir(_dir.c_str(), 0777);
+#endif
+        return _args.data();
+    }
+    // Where the table goes
+    FILE* log() const { return _log; }
+    const std::string& dir() const { return _dir; }
+
+    bool selected(const std::string& name) const {
+        return _filter.empty() || name.find(_filter) != std::string::npos;
+    }
+
+    // Times body(i) for i = 0 .. n-1 in batches of n calls. prepare(n) runs
+    // untimed before each batch, done() after it.
+    template <typename Prepare, typename Body, typename Done>
+    Result* run(const std::string& name, uint64_t bytesPerOp, Prepare prepare, Body body, Done done) {
+        if (!selected(name)) {
+            return nullptr;
+        }
+        // calibrate: grow the batch until it takes the least time
+        uint64_t n = 1;
+        for (;;) {
+            uint64_t ns = _batch(n, prepare, body, done);
+            if (ns >= _minBatchNs || n >= (1ull << 30)) {
+                break;
+            }
+            uint64_t grow = ns ? _minBatchNs * 12 / 10 * n / ns : n * 10;
+            n = std::min(std::max(grow, n + 1), n * 10);
+        }
+        Result r;
+        for (int s = 0; s < _samples; s++) {
+            r.samplesNs.push_back((double) _batch(n, prepare, body, done) / n);
+        }
+        std::vector<double> perOp = r.samplesNs;
+        std::sort(perOp.begin(), perOp.end());
+
+        r.name = name;
+        r.iterations = n;
+        r.samples = perOp.size();
+        r.nsPerOp = perOp[perOp.size() / 2];
+        r.minNs = perOp.front();
+        double sum = 0;
+        for (double v : perOp) {
+            sum += v;
+        }
+        r.meanNs = sum / perOp.size();
+        double squares = 0;
+        for (double v : perOp) {
+            squares += (v - r.meanNs) * (v - r.meanNs);
+        }
+        r.stddevNs = sqrt(squares / perOp.size());
+        r.bytesPerOp = bytesPerOp;
+        _results.push_back(r);
+        fprintf(_log, "%-40s %12.1f ns/op  %6.1f%%  %10llu ops", name.c_str(), r.nsPerOp,
+               r.nsPerOp > 0 ? 100.0 * r.stddevNs / r.nsPerOp : 0.0, (unsigned long long) n);
+        if (bytesPerOp) {
+            fprintf(_log, "  %10.2f MB/s", bytesPerOp * 1e3 / r.nsPerOp);
+        }
+        fprintf(_log, "\n");
+        fflush(_log);
+        return &_results.back();
+    }
+
+    template <typename Body>
+    Result* run(const std::string& name, uint64_t bytesPerOp, Body body) {
+        return run(name, bytesPerOp, [](uint64_t) { }, body, [] { });
+    }
+
+    // A measurement taken once, like the setup of a case
+    Result* add(const std::string& name, uint64_t iterations, uint64_t ns, uint64_t bytesPerOp = 0) {
+        if (!selected(name) || !iterations) {
+            return nullptr;
+        }
+        Result r;
+        r.name = name;
+        r.iterations = iterations;
+        r.samples = 1;
+        r.nsPerOp = r.minNs = r.meanNs = (double) ns / iterations;
+        r.samplesNs.push_back(r.nsPerOp);
+        r.bytesPerOp = bytesPerOp;
+        _results.push_back(r);
+        fprintf(_log, "%-40s %12.1f ns/op  (once)  %10llu ops\n", name.c_str(), r.nsPerOp,
+                (unsigned long long) iterations);
+        fflush(_log);
+        return &_results.back();
+    }
+
+    // Writes the JSON, the exit code of main()
+    int finish() {
+        if (_json.empty()) {
+            return 0;
+        }
+        FILE* out = _json == "-" ? stdout : fopen(_json.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "cannot write `%s`\n", _json.c_str());
+            return 1;
+        }
+        fprintf(out, "{\n  \"suite\": \"%s\",\n  \"schema\": 1,\n  \"timestamp\": %lld,\n"
+                     "  \"compiler\": \"%s\",\n  \"results\": [", _suite.c_str(), (long long) time(nullptr),
+                _escape(_compiler()).c_str());
+        for (size_t i = 0; i < _results.size(); i++) {
+            const Result& r = _results[i];
+            fprintf(out, "%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"samples\": %zu, "
+                         "\"ns_per_op\": %.3f, \"min_ns\": %.3f, \"mean_ns\": %.3f, \"stddev_ns\": %.3f, "
+                         "\"bytes_per_op\": %llu, \"bytes_per_second\": %.1f, \"samples_ns\": [",
+                    i ? "," : "", _escape(r.name).c_str(), (unsigned long long) r.iterations, r.samples,
+                    r.nsPerOp, r.minNs, r.meanNs, r.stddevNs, (unsigned long long) r.bytesPerOp,
+                    r.nsPerOp > 0 ? r.bytesPerOp * 1e9 / r.nsPerOp : 0.0);
+            for (size_t s = 0; s < r.samplesNs.size(); s++) {
+                fprintf(out, "%s%.3f", s ? ", " : "", r.samplesNs[s]);
+            }
+            fprintf(out, "], \"counters\": {");
+            for (size_t c = 0; c < r.counters.size(); c++) {
+                fprintf(out, "%s\"%s\": %.3f", c ? ", " : "", _escape(r.counters[c].first).c_str(),
+                        r.counters[c].second);
+            }
+            fprintf(out, "}}");
+        }
+        fprintf(out, "\n  ]\n}\n");
+        bool ok = !ferror(out);
+        if (out != stdout) {
+            ok = fclose(out) == 0 && ok;
+        }
+        return ok ? 0 : 1;
+    }
+
+    // Keeps the compiler from dropping the computation of value
+    template <typename T>
+    static void keep(T const& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    static uint64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+protected:
+    template <typename Prepare, typename Body, typename Done>
+    uint64_t _batch(uint64_t n, Prepare& prepare, Body& body, Done& done) {
+        prepare(n);
+        uint64_t start = nowNs();
+        for (uint64_t i = 0; i < n; i++) {
+            body(i);
+        }
+        uint64_t ns = nowNs() - start;
+        done();
+        return ns;
+    }
+
+    static std::string _compiler() {
+#if defined(__clang__)
+        return std::string("clang ") + __clang_version__;
+#elif defined(__GNUC__)
+        return std::string("gcc ") + __VERSION__;
+#elif defined(_MSC_VER)
+        return "msvc " + std::to_string(_MSC_VER);
+#else
+        return "unknown";
+#endif
+    }
+
+    static std::string _escape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += (unsigned char) c < 0x20 ? ' ' : c;
+        }
+        return escaped;
+    }
+
+    FILE*                _log = stdout;
+    std::string          _suite;
+    std::string          _json;
+    std::string          _filter;
+    std::string          _dir = ".bench/";
+    int                  _samples = 10;
+    uint64_t             _minBatchNs = 20000000;
+    std::vector<char*>   _args;
+    std::vector<Result>  _results;
+};
+
+#endif // __LITTLEFS_BENCH_H
@@ -0,0 +1,64 @@
+/*
+ BenchFS.h - file helpers of the benchmarks in bench/ that use LittleFS
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LITTLEFS_BENCH_FS_H
+#define __LITTLEFS_BENCH_FS_H
+
+#include <algorithm>
+#include <vector>
+#include "FS.h"
+
+// Writes size bytes of filler, false when the file system is full
+inline bool benchWriteFile(fs::FS& fs, const String& path, size_t size) {
+    File f = fs.open(path, "w");
+    if (!f) {
+        return false;
+    }
+    std::vector<uint8_t> data(4096, 0x5a);
+    for (size_t done = 0; done < size; done += data.size()) {
+        size_t n = std::min(data.size(), size - done);
+        if (f.write(data.data(), n) != n) {
+            return false;
+        }
+    }
+    f.close();
+    return true;
+}
+
+// Removes what is below path, like what a previous run left
+inline void benchClean(fs::FS& fs, const String& path) {
+    Dir dir = fs.openDir(path);
+    std::vector<String> files, dirs;
+    while (dir.next()) {
+        String child = (path.endsWith("/") ? path : path + "/") + dir.fileName();
+        if (dir.isDirectory()) {
+            dirs.push_back(child);
+        } else {
+            files.push_back(child);
+        }
+    }
+    for (const String& f : files) {
+        fs.remove(f);
+    }
+    for (const String& d : dirs) {
+        benchClean(fs, d);
+        fs.rmdir(d);
+    }
+}
+
+#endif // __LITTLEFS_BENCH_FS_H
@@ -0,0 +1,171 @@
+#!/usr/bin/env python3
+"""
+compare.py - compares the JSON results of the benchmarks in bench/ of two builds
+
+Usage: compare.py [options] baseline.json candidate.json
+       compare.py [options] --baseline a1.json a2.json ... --candidate b1.json b2.json ...
+
+Each benchmark writes the ns per op of each timed batch ("samples_ns"), the
+samples of several runs of the same build are pooled. For each case in both
+the ratio of the medians, candidate over baseline, gets a bootstrap
+confidence interval. The spread of each side is its median absolute
+deviation (MAD) over its median, their noise is the root of the sum of
+their squares. A case regressed when the whole interval is above
+1 + threshold and the slowdown is more than twice the noise: the interval
+misses shifts between runs, like the host flushing its disk cache, the MAD
+catches them. It improved in the same way below 1 - threshold. Cases over
+the threshold within the noise are "noisy", run them more often.
+
+Exit code 0 without regressions, 1 with, 2 on bad input.
+
+  --threshold <fraction>    smallest slowdown that fails (default 0.10)
+  --confidence <level>      of the interval (default 0.95)
+  --filter <text>           only the cases whose name contains text
+  --strict                  cases missing from the candidate fail too
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+"""
+
+import argparse
+import json
+import random
+import statistics
+import sys
+
+RESAMPLES = 2000
+NOISE_FACTOR = 2.0
+MIN_SAMPLES = 3     # Fewer, like the cases timed once, are shown but not gated
+
+
+def load(paths):
+    """{(suite, name): [samples]} of the runs in paths, pooled"""
+    cases = {}
+    for path in paths:
+        try:
+            with open(path) as f:
+                data = json.load(f)
+        except (OSError, ValueError) as e:
+            raise SystemExit("compare.py: cannot read `%s`: %s" % (path, e)) from None
+        if not isinstance(data, dict) or data.get("schema") != 1:
+            raise SystemExit("compare.py: `%s` is not a benchmark result" % path)
+        try:
+            for result in data["results"]:
+                samples = result.get("samples_ns") or [result["ns_per_op"]]
+                if not all(isinstance(s, (int, float)) for s in samples):
+                    raise TypeError("samples of %r are not numbers" % result["name"])
+                cases.setdefault((data["suite"], result["name"]), []).extend(samples)
+        except (AttributeError, KeyError, TypeError) as e:
+            raise SystemExit("compare.py: `%s` is malformed: %s %s" % (path, type(e).__name__, e)) from None
+    return cases
+
+
+def mad(samples):
+    """Median absolute deviation, scaled to estimate the standard deviation"""
+    median = statistics.median(samples)
+    return 1.4826 * statistics.median(abs(s - median) for s in samples)
+
+
+def interval(base, cand, confidence, rng):
+    """Bootstrap interval of median(cand) / median(base)"""
+    ratios = []
+    for _ in range(RESAMPLES):
+        b = statistics.median(rng.choices(base, k=len(base)))
+        c = statistics.median(rng.choices(cand, k=len(cand)))
+        ratios.append(c / b if b > 0 else float("inf"))
+    ratios.sort()
+    tail = (1 - confidence) / 2
+    return ratios[int(tail * (RESAMPLES - 1))], ratios[int((1 - tail) * (RESAMPLES - 1))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compares the results of two benchmark runs")
+    parser.add_argument("files", nargs="*", help="baseline.json candidate.json")
+    parser.add_argument("--baseline", nargs="+", default=[], metavar="JSON")
+    parser.add_argument("--candidate", nargs="+", default=[], metavar="JSON")
+    parser.add_argument("--threshold", type=float, default=0.10)
+    parser.add_argument("--confidence", type=float, default=0.95)
+    parser.add_argument("--filter", default="")
+    parser.add_argument("--strict", action="store_true")
+    try:
+        args = parser.parse_args()
+    except SystemExit:
+        return 2
+    baseline, candidate = list(args.baseline), list(args.candidate)
+    if args.files:
+        if len(args.files) != 2 or baseline or candidate:
+            parser.print_usage(sys.stderr)
+            return 2
+        baseline, candidate = [args.files[0]], [args.files[1]]
+    if not baseline or not candidate or not 0 < args.confidence < 1 or args.threshold < 0:
+        parser.print_usage(sys.stderr)
+        return 2
+    try:
+        base, cand = load(baseline), load(candidate)
+    except SystemExit as e:
+        print(e, file=sys.stderr)
+        return 2
+
+    # the same resamples every run
+    rng = random.Random(1)
+    regressions, missing = [], []
+    print("%-36s %12s %12s %8s %17s %7s %7s  %s" % ("case", "base ns", "new ns", "ratio", "interval",
+                                                 "base +-", "new +-", ""))
+    for key in sorted(set(base) | set(cand)):
+        suite, name = key
+        label = "%s/%s" % (suite, name)
+        if args.filter not in label:
+            continue
+        if key not in cand:
+            missing.append(label)
+            print("%-36s %12.1f %12s" % (label, statistics.median(base[key]), "missing"))
+            continue
+        if key not in base:
+            print("%-36s %12s %12.1f" % (label, "new", statistics.median(cand[key])))
+            continue
+        b, c = base[key], cand[key]
+        mb, mc = statistics.median(b), statistics.median(c)
+        ratio = mc / mb if mb > 0 else float("inf")
+        spread_base, spread_cand = mad(b) / mb if mb else 0, mad(c) / mc if mc else 0
+        noise = NOISE_FACTOR * (spread_base ** 2 + spread_cand ** 2) ** 0.5
+        spread = "%6.1f%% %6.1f%%" % (100 * spread_base, 100 * spread_cand)
+        if len(b) < MIN_SAMPLES or len(c) < MIN_SAMPLES:
+            print("%-36s %12.1f %12.1f %7.3fx %17s %s  (too few samples)" % (label, mb, mc, ratio, "", spread))
+            continue
+        low, high = interval(b, c, args.confidence, rng)
+        if low > 1 + args.threshold:
+            if ratio - 1 > noise:
+                verdict = "REGRESSION"
+                regressions.append((label, ratio))
+            else:
+                verdict = "noisy"
+        elif high < 1 - args.threshold:
+            verdict = "faster" if 1 - ratio > noise else "noisy"
+        else:
+            verdict = ""
+        print("%-36s %12.1f %12.1f %7.3fx  [%6.3f, %6.3f] %s  %s" % (label, mb, mc, ratio, low, high, spread,
+                                                                    verdict))
+
+    if missing:
+        print("\n%d case(s) missing from the candidate" % len(missing))
+    if regressions:
+        print("\n%d regression(s) beyond %.0f%% at %.0f%% confidence:" % (len(regressions), 100 * args.threshold,
+                                                                         100 * args.confidence))
+        for label, ratio in regressions:
+            print("  %s %.1f%% slower" % (label, 100 * (ratio - 1)))
+    return 1 if regressions or (args.strict and missing) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
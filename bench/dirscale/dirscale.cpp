@@ -0,0 +1,188 @@
+/*
+ dirscale - how the directory calls of the LittleFS mock scale with the tree
+
+ Usage: dirscale [--max-entries <n>] [--check] [--json <file>] [--filter <text>]
+                 [--samples <n>] [--min-time <ms>] [--test-dir <dir>]
+
+ For 1k, 10k and 100k entries (at most --max-entries), in one flat folder and
+ nested in folders of 100, times creating the tree, listing it, exists() of
+ its entries, openDir() of a file (a folder of that one entry) and
+ info(). The listing cases report ns_per_entry and "scale", their cost per
+ entry over the one of the smallest tree. --check fails (exit code 3) when
+ a result misses its target:
+   openDir() + next()    O(n log n) per folder, scale at most 4
+   exists()              O(1) in the folder size, scale at most 4
+   openDir() of a file   O(1) in the folder size, scale at most 4
+   info()                O(entries of the file system), scale at most 4
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "LittleFS.h"
+#include "Bench.h"
+#include "BenchFS.h"
+
+static const size_t ENTRIES[] = { 1000, 10000, 100000 };
+static const size_t PER_FOLDER = 100;   // Of the nested trees
+static const double MAX_SCALE = 4.0;
+
+// ns per entry of the smallest tree, per case
+static std::map<std::string, double> baseline;
+static bool missed = false;
+
+static void fail(const char* what) {
+    fprintf(stderr, "dirscale: %s failed\n", what);
+    exit(1);
+}
+
+static String child(const String& folder, const char* prefix, size_t i) {
+    return folder + "/" + prefix + String((unsigned)i);
+}
+
+// Adds ns_per_entry and scale to r
+static void perEntry(Bench::Result* r, const std::string& kind, size_t entries, double ns) {
+    if (!r) {
+        return;
+    }
+    double perEntry = ns / entries;
+    if (!baseline.count(kind)) {
+        baseline[kind] = perEntry;
+    }
+    double scale = perEntry / baseline[kind];
+    r->counters.emplace_back("ns_per_entry", perEntry);
+    r->counters.emplace_back("scale", scale);
+    if (scale > MAX_SCALE) {
+        fprintf(stderr, "dirscale: %s costs %.1fx per entry of the smallest tree\n", r->name.c_str(), scale);
+        missed = true;
+    }
+}
+
+// Counts the files below path
+static size_t walk(const String& path) {
+    size_t files = 0;
+    Dir dir = LittleFS.openDir(path);
+    while (dir.next()) {
+        if (dir.isDirectory()) {
+            files += walk(path + "/" + dir.fileName());
+        } else {
+            files++;
+        }
+    }
+    return files;
+}
+
+static void benchTree(Bench& bench, size_t entries, bool nested) {
+    std::string kind = nested ? "nested" : "flat";
+    std::string suffix = "/" + std::to_string(entries);
+    String root = nested ? "/nested" : "/flat";
+    std::vector<String> folders;
+    if (nested) {
+        for (size_t i = 0; i < (entries + PER_FOLDER - 1) / PER_FOLDER; i++) {
+            folders.push_back(child(root, "d", i));
+        }
+    } else {
+        folders.push_back(root);
+    }
+    size_t perFolder = nested ? PER_FOLDER : entries;
+
+    uint64_t start = Bench::nowNs();
+    for (const String& folder : folders) {
+        LittleFS.mkdir(folder);
+        for (size_t i = 0; i < perFolder; i++) {
+            File f = LittleFS.open(child(folder, "f", i), "w");
+            if (!f) {
+                fail("creating the tree");
+            }
+            f.close();
+        }
+    }
+    bench.add(kind + "/create" + suffix, entries, Bench::nowNs() - start);
+
+    Bench::Result* r = bench.run(kind + "/list" + suffix, 0, [&](uint64_t) {
+        if (walk(root) != entries) {
+            fail("listing");
+        }
+    });
+    perEntry(r, kind + "/list", entries, r ? r->nsPerOp : 0);
+
+    r = bench.run(kind + "/exists" + suffix, 0, [&](uint64_t i) {
+        i = i * 2654435761u % entries;
+        if (!LittleFS.exists(child(folders[i / perFolder], "f", i % perFolder))) {
+            fail("exists");
+        }
+    });
+    // one lookup per call, the scale is the one of a call
+    perEntry(r, kind + "/exists", 1, r ? r->nsPerOp : 0);
+
+    String file = child(folders.back(), "f", perFolder - 1);
+    r = bench.run(kind + "/open_file" + suffix, 0, [&](uint64_t) {
+        Dir dir = LittleFS.openDir(file);
+        if (!dir.next()) {
+            fail("openDir of a file");
+        }
+    });
+    // one entry whatever the folder, the scale is the one of a call
+    perEntry(r, kind + "/open_file", 1, r ? r->nsPerOp : 0);
+
+    r = bench.run(kind + "/info" + suffix, 0, [](uint64_t) {
+        FSInfo info;
+        if (!LittleFS.info(info)) {
+            fail("info");
+        }
+    });
+    perEntry(r, kind + "/info", entries, r ? r->nsPerOp : 0);
+
+    start = Bench::nowNs();
+    benchClean(LittleFS, root);
+    LittleFS.rmdir(root);
+    bench.add(kind + "/remove" + suffix, entries, Bench::nowNs() - start);
+}
+
+int main(int argc, char **argv) {
+    size_t maxEntries = ENTRIES[2];
+    bool check = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-entries") == 0 && i + 1 < argc) {
+            maxEntries = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--check") == 0) {
+            check = true;
+        }
+    }
+    Bench bench("dirscale", argc, argv);
+    if (!LittleFS.begin(bench.argc(), bench.argv())) {
+        fprintf(stderr, "dirscale: cannot mount `%s`\n", bench.dir().c_str());
+        return 1;
+    }
+    benchClean(LittleFS, "/");
+
+    for (bool nested : { false, true }) {
+        for (size_t entries : ENTRIES) {
+            if (entries <= maxEntries) {
+                benchTree(bench, entries, nested);
+            }
+        }
+    }
+
+    LittleFS.end();
+    int rc = bench.finish();
+    return rc ? rc : check && missed ? 3 : 0;
+}
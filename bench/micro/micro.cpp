@@ -0,0 +1,204 @@
+/*
+ micro - microbenchmarks of the FS, File and Dir calls of the LittleFS mock
+
+ Usage: micro [--json <file>] [--filter <text>] [--samples <n>] [--min-time <ms>]
+              [--test-dir <dir>] [--durability <level>]
+
+ Each case is timed in batches, the JSON has the median, the spread and the
+ bytes per second of each, see Bench.h. The test dir defaults to .bench/ and
+ is emptied first.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "LittleFS.h"
+#include "Bench.h"
+#include "BenchFS.h"
+
+static const size_t FILE_SIZES[] = { 16, 256, 4096, 65536 };
+static const size_t DIR_SIZES[] = { 10, 100, 1000 };
+static const size_t BIG_FILE = 1 << 20;
+
+static void fail(const char* what) {
+    fprintf(stderr, "micro: %s failed\n", what);
+    exit(1);
+}
+
+static void benchFiles(Bench& bench) {
+    if (!benchWriteFile(LittleFS, "/small", 16)) {
+        fail("writing the files");
+    }
+    bench.run("open_close", 0, [](uint64_t) {
+        File f = LittleFS.open("/small", "r");
+        f.close();
+    });
+    bench.run("exists_hit", 0, [](uint64_t) {
+        if (!LittleFS.exists("/small")) {
+            fail("exists");
+        }
+    });
+    bench.run("exists_miss", 0, [](uint64_t) {
+        if (LittleFS.exists("/missing")) {
+            fail("exists");
+        }
+    });
+    bench.run("create", 0, [](uint64_t) {
+        File f = LittleFS.open("/created", "w");
+        f.close();
+    });
+
+    // reads and writes wrap around a file of BIG_FILE bytes
+    if (!benchWriteFile(LittleFS, "/big", BIG_FILE)) {
+        fail("writing the files");
+    }
+    std::vector<uint8_t> buffer(FILE_SIZES[3], 0x33);
+    for (size_t size : FILE_SIZES) {
+        File f = LittleFS.open("/big", "r");
+        bench.run("read/" + std::to_string(size), size, [&](uint64_t) {
+            if (f.position() + size > BIG_FILE) {
+                f.seek(0);
+            }
+            if (f.read(buffer.data(), size) != size) {
+                fail("read");
+            }
+        });
+        f.close();
+    }
+    for (size_t size : FILE_SIZES) {
+        File f = LittleFS.open("/big", "r+");
+        bench.run("write/" + std::to_string(size), size, [&](uint64_t) {
+            if (f.position() + size > BIG_FILE) {
+                f.seek(0);
+            }
+            if (f.write(buffer.data(), size) != size) {
+                fail("write");
+            }
+        });
+        f.close();
+    }
+    for (size_t size : FILE_SIZES) {
+        // open, write the whole file and close
+        bench.run("write_file/" + std::to_string(size), size, [&](uint64_t) {
+            File f = LittleFS.open("/whole", "w");
+            if (f.write(buffer.data(), size) != size) {
+                fail("write");
+            }
+            f.close();
+        });
+        if (!benchWriteFile(LittleFS, "/whole", size)) {
+            fail("writing the files");
+        }
+        bench.run("read_file/" + std::to_string(size), size, [&](uint64_t) {
+            File f = LittleFS.open("/whole", "r");
+            if (f.read(buffer.data(), size) != size) {
+                fail("read");
+            }
+            f.close();
+        });
+    }
+
+    File f = LittleFS.open("/big", "r");
+    uint32_t offset = 1;
+    bench.run("seek", 0, [&](uint64_t) {
+        // a cheap pseudo-random walk over the file
+        offset = offset * 1103515245 + 12345;
+        if (!f.seek(offset % BIG_FILE)) {
+            fail("seek");
+        }
+    });
+    f.close();
+
+    bench.run("rename", 0, [](uint64_t) { }, [](uint64_t i) {
+        if (!LittleFS.rename(i & 1 ? "/renamed" : "/small", i & 1 ? "/small" : "/renamed")) {
+            fail("rename");
+        }
+    }, [] {
+        if (LittleFS.exists("/renamed")) {
+            LittleFS.rename("/renamed", "/small");
+        }
+    });
+    // bench.run() with prepare and done, so that only remove() is timed
+    bench.run("remove", 0, [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            File f = LittleFS.open("/rm/" + String((unsigned)i), "w");
+            f.close();
+        }
+    }, [](uint64_t i) {
+        if (!LittleFS.remove("/rm/" + String((unsigned)i))) {
+            fail("remove");
+        }
+    }, [] { });
+}
+
+static void benchDirs(Bench& bench) {
+    for (size_t entries : DIR_SIZES) {
+        String path = "/dir" + String((unsigned)entries);
+        LittleFS.mkdir(path);
+        for (size_t i = 0; i < entries; i++) {
+            File f = LittleFS.open(path + "/file" + String((unsigned)i), "w");
+            f.write((const uint8_t*) "x", 1);
+            f.close();
+        }
+        Bench::Result* r = bench.run("dir_list/" + std::to_string(entries), 0, [&](uint64_t) {
+            Dir dir = LittleFS.openDir(path);
+            size_t found = 0;
+            while (dir.next()) {
+                found++;
+            }
+            if (found != entries) {
+                fail("openDir");
+            }
+        });
+        if (r) {
+            r->counters.emplace_back("ns_per_entry", r->nsPerOp / entries);
+        }
+        bench.run("exists_in_dir/" + std::to_string(entries), 0, [&](uint64_t i) {
+            if (!LittleFS.exists(path + "/file" + String((unsigned)(i % entries)))) {
+                fail("exists");
+            }
+        });
+    }
+}
+
+static void benchInfo(Bench& bench) {
+    bench.run("info", 0, [](uint64_t) {
+        FSInfo info;
+        if (!LittleFS.info(info)) {
+            fail("info");
+        }
+    });
+}
+
+int main(int argc, char **argv) {
+    Bench bench("micro", argc, argv);
+    if (!LittleFS.begin(bench.argc(), bench.argv())) {
+        fprintf(stderr, "micro: cannot mount `%s`\n", bench.dir().c_str());
+        return 1;
+    }
+    benchClean(LittleFS, "/");
+    LittleFS.mkdir("/rm");
+
+    benchFiles(bench);
+    benchDirs(bench);
+    benchInfo(bench);
+
+    benchClean(LittleFS, "/");
+    LittleFS.end();
+    return bench.finish();
+}
@@ -0,0 +1,194 @@
+/*
+ webserver - macro-benchmark of a static web server over the LittleFS mock
+
+ Usage: webserver [--json <file>] [--filter <text>] [--samples <n>] [--min-time <ms>]
+                  [--test-dir <dir>] [--durability <level>]
+
+ Serves a generated web UI the way serveStatic() of ESP8266WebServer does:
+ exists() of the .gz variant, open(), size(), reads of one TCP segment until
+ the end, close(). "serve/mix" runs a request mix, the other cases one kind
+ of request each. Each case reports the requests per second, the lfs calls
+ per request (counters "lfs_<op>") and the latency percentiles of a request.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "LittleFS.h"
+#include "Bench.h"
+#include "BenchFS.h"
+
+static const size_t SEGMENT = 1460;     // The payload of a TCP segment of lwIP
+static const size_t LATENCY_REQUESTS = 20000;
+
+struct Asset {
+    const char* path;
+    size_t      size;
+    bool        gzip;       // Only the .gz variant is stored
+    unsigned    weight;     // In the request mix
+};
+
+// A typical single page UI, "/" is index.htm
+static const Asset ASSETS[] = {
+    { "/index.htm",                 6 * 1024,   true,  10 },
+    { "/css/app.css",               24 * 1024,  true,  8 },
+    { "/js/app.js",                 48 * 1024,  true,  8 },
+    { "/js/vendor.js",              180 * 1024, true,  4 },
+    { "/favicon.ico",               1150,       false, 6 },
+    { "/manifest.json",             400,        false, 2 },
+    { "/img/logo.svg",              3 * 1024,   true,  6 },
+    { "/fonts/roboto.woff2",        64 * 1024,  false, 2 },
+};
+static const unsigned IMAGES = 24;      // /img/photo<n>.jpg, 8 to 40 KiB
+static const unsigned IMAGE_WEIGHT = 1;
+static const unsigned MISSING_WEIGHT = 4;
+
+static uint8_t buffer[SEGMENT];
+
+static void fail(const char* what) {
+    fprintf(stderr, "webserver: %s failed\n", what);
+    exit(1);
+}
+
+static void generate(std::vector<String>& mix) {
+    for (const Asset& asset : ASSETS) {
+        // about a third left after gzip
+        if (!benchWriteFile(LittleFS, String("/www") + asset.path + (asset.gzip ? ".gz" : ""),
+                            asset.gzip ? asset.size / 3 : asset.size)) {
+            fail("writing the assets");
+        }
+        for (unsigned i = 0; i < asset.weight; i++) {
+            mix.push_back(strcmp(asset.path, "/index.htm") == 0 && i % 2 ? "/" : asset.path);
+        }
+    }
+    for (unsigned i = 0; i < IMAGES; i++) {
+        String path = "/img/photo" + String(i) + ".jpg";
+        if (!benchWriteFile(LittleFS, "/www" + path, (8 + (i * 7) % 33) * 1024)) {
+            fail("writing the assets");
+        }
+        for (unsigned w = 0; w < IMAGE_WEIGHT; w++) {
+            mix.push_back(path);
+        }
+    }
+    for (unsigned i = 0; i < MISSING_WEIGHT; i++) {
+        mix.push_back("/apple-touch-icon" + String(i) + ".png");
+    }
+    // the same shuffled order every run
+    uint32_t seed = 42;
+    for (size_t i = mix.size() - 1; i > 0; i--) {
+        seed = seed * 1103515245 + 12345;
+        std::swap(mix[i], mix[(seed >> 8) % (i + 1)]);
+    }
+}
+
+// StaticRequestHandler::handle() of ESP8266WebServer, without the network,
+// the bytes sent or 0 for a 404
+static size_t serve(const String& uri) {
+    String path = "/www" + uri;
+    if (path.endsWith("/")) {
+        path += "index.htm";
+    }
+    String pathWithGz = path + ".gz";
+    if (LittleFS.exists(pathWithGz)) {
+        path = pathWithGz;
+    }
+    File f = LittleFS.open(path, "r");
+    if (!f) {
+        return 0;
+    }
+    // streamFile(): the Content-Length, then the file a segment at a time
+    size_t size = f.size();
+    size_t sent = 0;
+    while (sent < size) {
+        size_t n = f.read(buffer, std::min(SEGMENT, size - sent));
+        if (!n) {
+            break;
+        }
+        sent += n;
+    }
+    f.close();
+    return sent;
+}
+
+// Times the requests and counts their lfs calls
+static void benchRequests(Bench& bench, const std::string& name, const std::vector<String>& requests) {
+    if (!bench.selected(name)) {
+        return;
+    }
+    uint64_t bytes = 0;
+    for (const String& uri : requests) {
+        bytes += serve(uri);
+    }
+    uint64_t batch = 0;
+    FSStats stats;
+    Bench::Result* r = bench.run(name, bytes / requests.size(), [&](uint64_t n) {
+        batch = n;
+        LittleFS.resetStats();
+    }, [&](uint64_t i) {
+        Bench::keep(serve(requests[i % requests.size()]));
+    }, [&] {
+        LittleFS.stats(stats);
+    });
+    if (!r) {
+        return;
+    }
+    r->counters.emplace_back("requests_per_second", 1e9 / r->nsPerOp);
+    for (int op = 0; op < FSOpCount; op++) {
+        if (stats[(FSOp)op].count) {
+            r->counters.emplace_back(std::string("lfs_") + FSStats::opName((FSOp)op),
+                                     (double)stats[(FSOp)op].count / batch);
+        }
+    }
+
+    // the latency of single requests
+    FSOpStats latency = {};
+    for (size_t i = 0; i < LATENCY_REQUESTS; i++) {
+        uint64_t start = Bench::nowNs();
+        size_t sent = serve(requests[i % requests.size()]);
+        latency.add(Bench::nowNs() - start, sent, !sent);
+    }
+    r->counters.emplace_back("p50_ns", latency.percentileNs(50));
+    r->counters.emplace_back("p99_ns", latency.percentileNs(99));
+    r->counters.emplace_back("max_ns", latency.maxNs);
+    fprintf(bench.log(), "%-40s %12.0f req/s  p50 %.1f us  p99 %.1f us\n", "", 1e9 / r->nsPerOp,
+            latency.percentileNs(50) / 1e3, latency.percentileNs(99) / 1e3);
+}
+
+int main(int argc, char **argv) {
+    Bench bench("webserver", argc, argv);
+    if (!LittleFS.begin(bench.argc(), bench.argv())) {
+        fprintf(stderr, "webserver: cannot mount `%s`\n", bench.dir().c_str());
+        return 1;
+    }
+    benchClean(LittleFS, "/");
+    std::vector<String> mix;
+    generate(mix);
+
+    benchRequests(bench, "serve/mix", mix);
+    benchRequests(bench, "serve/index", { "/" });
+    benchRequests(bench, "serve/gzip_js", { "/js/app.js" });
+    benchRequests(bench, "serve/large_js", { "/js/vendor.js" });
+    benchRequests(bench, "serve/image", { "/img/photo3.jpg" });
+    benchRequests(bench, "serve/small", { "/favicon.ico" });
+    benchRequests(bench, "serve/404", { "/missing.png" });
+
+    benchClean(LittleFS, "/");
+    LittleFS.end();
+    return bench.finish();
+}
@@ -0,0 +1,272 @@
+/*
+ wstring - benchmarks of the Arduino String of WString.h, against std::string
+
+ Usage: wstring [--json <file>] [--filter <text>] [--samples <n>] [--min-time <ms>]
+
+ Each case runs as "String/<case>" and "std/<case>" doing the same work, the
+ String result has the counter "vs_std", its time over the time of std::string.
+ The "copy/<length>" and "append_to/<length>" cases straddle the inline
+ buffers of both.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "WString.h"
+#include "Bench.h"
+
+// The longest String kept inline
+struct StringSSO : String {
+    static constexpr unsigned int length = SSOSIZE - 1;
+};
+
+static const char PATH[] = "/www/static/images/thumbnails/2024/holiday/beach-0042.jpg";
+static const char TEXT[] = "GET /index.html HTTP/1.1\r\nHost: esp8266.local\r\nAccept: text/html\r\n"
+                           "Connection: keep-alive\r\nUser-Agent: bench\r\n\r\n";
+
+// Runs std then String, the String result gets vs_std
+template <typename ArduinoBody, typename StdBody>
+static void compare(Bench& bench, const std::string& name, uint64_t bytesPerOp, ArduinoBody arduino, StdBody std) {
+    Bench::Result* base = bench.run("std/" + name, bytesPerOp, std);
+    double baseNs = base ? base->nsPerOp : 0;
+    Bench::Result* r = bench.run("String/" + name, bytesPerOp, arduino);
+    if (r && baseNs > 0) {
+        r->counters.emplace_back("vs_std", r->nsPerOp / baseNs);
+    }
+}
+
+static void benchConcat(Bench& bench) {
+    compare(bench, "concat_chars/64", 64, [](uint64_t) {
+        String s;
+        for (int i = 0; i < 64; i++) {
+            s += (char)('a' + (i & 15));
+        }
+        Bench::keep(s);
+    }, [](uint64_t) {
+        std::string s;
+        for (int i = 0; i < 64; i++) {
+            s += (char)('a' + (i & 15));
+        }
+        Bench::keep(s);
+    });
+    compare(bench, "concat_cstr", 0, [](uint64_t) {
+        String s("/www");
+        s += "/static";
+        s += "/images/";
+        s += "thumbnail";
+        s += ".jpg";
+        Bench::keep(s);
+    }, [](uint64_t) {
+        std::string s("/www");
+        s += "/static";
+        s += "/images/";
+        s += "thumbnail";
+        s += ".jpg";
+        Bench::keep(s);
+    });
+    compare(bench, "concat_numbers", 0, [](uint64_t i) {
+        String s("t=");
+        s += (unsigned long)i;
+        s += " v=";
+        s += (int)-42;
+        s += " f=";
+        s += 3.25f;
+        Bench::keep(s);
+    }, [](uint64_t i) {
+        // String(float) prints 2 decimals
+        char f[16];
+        snprintf(f, sizeof(f), "%.2f", 3.25f);
+        std::string s("t=");
+        s += std::to_string((unsigned long)i);
+        s += " v=";
+        s += std::to_string(-42);
+        s += " f=";
+        s += f;
+        Bench::keep(s);
+    });
+    String arduinoParts[] = { String("/www"), String("/static"), String("/images/"), String("thumbnail.jpg") };
+    std::string stdParts[] = { "/www", "/static", "/images/", "thumbnail.jpg" };
+    compare(bench, "concat_strings", 0, [&](uint64_t) {
+        String s;
+        for (const String& part : arduinoParts) {
+            s += part;
+        }
+        Bench::keep(s);
+    }, [&](uint64_t) {
+        std::string s;
+        for (const std::string& part : stdParts) {
+            s += part;
+        }
+        Bench::keep(s);
+    });
+    String dir("/www/static"), name("thumbnail"), ext("jpg");
+    std::string stdDir("/www/static"), stdName("thumbnail"), stdExt("jpg");
+    compare(bench, "plus_chain", 0, [&](uint64_t) {
+        String s = dir + "/" + name + '.' + ext;
+        Bench::keep(s);
+    }, [&](uint64_t) {
+        std::string s = stdDir + "/" + stdName + '.' + stdExt;
+        Bench::keep(s);
+    });
+}
+
+static void benchGrowth(Bench& bench) {
+    static const char CHUNK[] = "0123456789abcdef";
+    for (int reserve = 0; reserve <= 1; reserve++) {
+        const char* name = reserve ? "reserve_append/1024" : "grow_append/1024";
+        compare(bench, name, 1024, [reserve](uint64_t) {
+            String s;
+            if (reserve) {
+                s.reserve(1024);
+            }
+            for (int i = 0; i < 64; i++) {
+                s.concat(CHUNK, 16);
+            }
+            Bench::keep(s);
+        }, [reserve](uint64_t) {
+            std::string s;
+            if (reserve) {
+                s.reserve(1024);
+            }
+            for (int i = 0; i < 64; i++) {
+                s.append(CHUNK, 16);
+            }
+            Bench::keep(s);
+        });
+    }
+}
+
+static void benchSearch(Bench& bench) {
+    String path(PATH);
+    std::string stdPath(PATH);
+    compare(bench, "indexOf_char", 0, [&](uint64_t) {
+        Bench::keep(path.indexOf('-'));
+    }, [&](uint64_t) {
+        Bench::keep(stdPath.find('-'));
+    });
+    compare(bench, "indexOf_str", 0, [&](uint64_t) {
+        Bench::keep(path.indexOf("holiday"));
+    }, [&](uint64_t) {
+        Bench::keep(stdPath.find("holiday"));
+    });
+    compare(bench, "lastIndexOf_char", 0, [&](uint64_t) {
+        Bench::keep(path.lastIndexOf('/'));
+    }, [&](uint64_t) {
+        Bench::keep(stdPath.rfind('/'));
+    });
+    compare(bench, "substring", 0, [&](uint64_t) {
+        String s = path.substring(path.lastIndexOf('/') + 1);
+        Bench::keep(s);
+    }, [&](uint64_t) {
+        std::string s = stdPath.substr(stdPath.rfind('/') + 1);
+        Bench::keep(s);
+    });
+    compare(bench, "startsWith_endsWith", 0, [&](uint64_t) {
+        Bench::keep(path.startsWith("/www/") && path.endsWith(".jpg"));
+    }, [&](uint64_t) {
+        Bench::keep(stdPath.compare(0, 5, "/www/") == 0 && stdPath.size() >= 4
+                    && stdPath.compare(stdPath.size() - 4, 4, ".jpg") == 0);
+    });
+}
+
+static void benchReplace(Bench& bench) {
+    // "\r\n" by a longer, an as long and a shorter text
+    static const char* const WITH[] = { "\n\t\t", "\r\n", "\n" };
+    static const char* const NAMES[] = { "replace/grow", "replace/same", "replace/shrink" };
+    for (size_t i = 0; i < 3; i++) {
+        const char* with = WITH[i];
+        compare(bench, NAMES[i], sizeof(TEXT) - 1, [with](uint64_t) {
+            String s(TEXT);
+            s.replace("\r\n", with);
+            Bench::keep(s);
+        }, [with](uint64_t) {
+            std::string s(TEXT);
+            size_t length = strlen(with);
+            for (size_t at = s.find("\r\n"); at != std::string::npos; at = s.find("\r\n", at + length)) {
+                s.replace(at, 2, with);
+            }
+            Bench::keep(s);
+        });
+    }
+}
+
+static void benchParse(Bench& bench) {
+    String number("-1234567"), real("3.14159");
+    std::string stdNumber("-1234567"), stdReal("3.14159");
+    compare(bench, "toInt", 0, [&](uint64_t) {
+        Bench::keep(number.toInt());
+    }, [&](uint64_t) {
+        Bench::keep(std::stol(stdNumber));
+    });
+    compare(bench, "toFloat", 0, [&](uint64_t) {
+        Bench::keep(real.toFloat());
+    }, [&](uint64_t) {
+        Bench::keep(std::stof(stdReal));
+    });
+    compare(bench, "from_int", 0, [](uint64_t i) {
+        String s((int)i);
+        Bench::keep(s);
+    }, [](uint64_t i) {
+        std::string s = std::to_string((int)i);
+        Bench::keep(s);
+    });
+}
+
+static void benchSSO(Bench& bench) {
+    size_t stdSSO = std::string().capacity();
+    std::vector<size_t> lengths = { stdSSO, stdSSO + 1, StringSSO::length, StringSSO::length + 1 };
+    std::sort(lengths.begin(), lengths.end());
+    lengths.erase(std::unique(lengths.begin(), lengths.end()), lengths.end());
+    for (size_t length : lengths) {
+        std::string text(length, 'x');
+        String source(text.c_str());
+        compare(bench, "copy/" + std::to_string(length), length, [&](uint64_t) {
+            String s(source);
+            Bench::keep(s);
+        }, [&](uint64_t) {
+            std::string s(text);
+            Bench::keep(s);
+        });
+        compare(bench, "append_to/" + std::to_string(length), length, [&](uint64_t) {
+            // grows across the inline buffer
+            String s("a");
+            s += source;
+            Bench::keep(s);
+        }, [&](uint64_t) {
+            std::string s("a");
+            s += text;
+            Bench::keep(s);
+        });
+    }
+}
+
+int main(int argc, char **argv) {
+    Bench bench("wstring", argc, argv);
+    fprintf(bench.log(), "String keeps %u chars inline, std::string %zu\n", StringSSO::length, std::string().capacity());
+
+    benchConcat(bench);
+    benchGrowth(bench);
+    benchSearch(bench);
+    benchReplace(bench);
+    benchParse(bench);
+    benchSSO(bench);
+
+    return bench.finish();
+}
@@ -25,6 +25,14 @@
 #define FS_H
 
 #include <memory>
+#include <functional>
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 #include <../include/time.h> // See issue #6714
 
 #include "WString.h"
@@ -34,6 +42,8 @@ namespace fs {
 class File;
 class Dir;
 class FS;
+class FSIoPool;
+class FSLoop;
 
 class FileImpl;
 typedef std::shared_ptr<FileImpl> FileImplPtr;
@@ -83,6 +93,20 @@ public:
     const char* name() const;
     const char* fullName() const; // Includes path
     bool truncate(uint32_t size);
+    //Mock
+    bool reserve(uint64_t size);
+
+    //Mock - read() and write() on the I/O threads of the FS, see FS::openAsync().
+    // buf must stay valid until the future is ready, and like the blocking
+    // calls one call of a file at a time
+    std::future<size_t> readAsync(uint8_t* buf, size_t size);
+    std::future<size_t> writeAsync(const uint8_t* buf, size_t size);
+
+    //Mock - large files (> 2 GB), offsets behave like seek() / truncate()
+    bool seek64(int64_t pos, SeekMode mode = SeekSet);
+    uint64_t position64() const;
+    uint64_t size64() const;
+    bool truncate64(uint64_t size);
 
     bool isFile() const;
     bool isDirectory() const;
@@ -174,6 +198,303 @@ struct FSInfo64 {
     size_t maxPathLength;
 };
 
+// Mock - costs of the emulated flash accesses, see FS::mockSetTimingModel()
+struct FSTimingModel {
+    uint32_t readNs;    // Read of read_size (64) bytes
+    uint32_t progNs;    // Program of prog_size (64) bytes
+    uint32_t eraseNs;   // Erase of one block
+
+    // Typical SPI NOR flash of an ESP8266 module with 8 KB LittleFS blocks
+    static FSTimingModel esp8266() {
+        return FSTimingModel{ 15000, 200000, 90000000 };
+    }
+};
+
+// Mock - virtual flash clock, see FS::mockTiming()
+struct FSTiming {
+    uint64_t clockNs;   // Estimated device time since the last reset
+    uint64_t lastOpNs;  // Device time of the last lfs_* call accessing the flash
+    uint64_t reads;
+    uint64_t progs;
+    uint64_t erases;
+};
+
+// Mock - wear of the emulated flash, see FS::mockWearReport()
+struct FSWearReport {
+    uint32_t blocks;
+    uint64_t erases;            // All blocks, since tracking started
+    uint64_t progs;
+    uint32_t minErases;         // Per block
+    uint32_t maxErases;
+    double   meanErases;
+    double   stddevErases;
+    // Repetitions of the tracked workload until a block reaches the endurance,
+    // as distributed by the tracked workload, and with ideal leveling
+    double   lifetime;
+    double   lifetimeLeveled;
+};
+
+// Mock - result of FS::mockPowerLoss()
+struct FSPowerLossReport {
+    uint64_t ops;               // Programs and erases of the workload
+    uint64_t cuts;              // Cut points checked
+    uint64_t failures;          // Cut points the check failed after
+    uint64_t firstFailure;      // Programs and erases before the first failed cut
+};
+
+// Mock - a file of FS::readFiles() and FS::writeFiles()
+struct FSBatchFile {
+    String               path;
+    std::vector<uint8_t> data;      // Read: the content, write: what to write
+    bool                 ok = false;
+};
+
+// Mock - operations of the file system, see FS::stats()
+enum FSOp {
+    FSOpOpen,
+    FSOpClose,
+    FSOpRead,
+    FSOpWrite,
+    FSOpSeek,
+    FSOpSync,
+    FSOpTruncate,
+    FSOpStat,
+    FSOpDirOpen,
+    FSOpDirRead,
+    FSOpMkdir,
+    FSOpRemove,
+    FSOpRename,
+    FSOpTell,
+    FSOpSize,
+    FSOpReserve,
+    FSOpDirClose,
+    FSOpDirRewind,
+    FSOpGetAttr,
+    FSOpSetAttr,
+    FSOpFsSize,
+    FSOpMount,
+    FSOpFormat,
+    FSOpUnmount,
+    FSOpCount
+};
+
+// Mock - statistics of one operation, the latency is the time on the host
+struct FSOpStats {
+    static constexpr size_t BUCKETS = 320;  // 8 per power of 2 of the latency in ns
+
+    uint64_t count;
+    uint64_t errors;
+    uint64_t bytes;             // Read or written
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t histogram[BUCKETS];
+
+    uint64_t meanNs() const;
+    // Lower bound of the bucket holding the percentile, at most 12.5% off
+    uint64_t percentileNs(double percentile) const;
+    void add(uint64_t ns, uint64_t bytes, bool failed);
+    static uint64_t bucketNs(size_t bucket);
+    static size_t bucket(uint64_t ns);
+};
+
+struct FSStats {
+    FSOpStats ops[FSOpCount];
+
+    const FSOpStats& operator[](FSOp op) const { return ops[op]; }
+    static const char* opName(FSOp op);
+};
+
+// Mock - options of FS::mockReplay()
+struct FSReplayOptions {
+    bool   paced = false;       // Keep the recorded time between the calls
+    double speed = 1.0;         // Paced: faster (> 1) or slower than recorded
+};
+
+// Mock - result of FS::mockReplay()
+struct FSReplayReport {
+    uint64_t events;            // Calls replayed
+    uint64_t mismatches;        // Calls that failed or moved other bytes than recorded
+    uint64_t bytes;             // Read and written
+    uint64_t elapsedNs;
+    uint64_t maxLagNs;          // Paced: furthest behind the recorded time
+    FSStats  stats;             // Latency of the replayed calls
+
+    double opsPerSecond() const;
+    double bytesPerSecond() const;
+};
+
+// Mock - deterministic time, install with FS::setTimeCallback(VirtualClock::now)
+//
+// Stands still until the test sets or advances it, and never goes back.
+// With a step, each call of now() moves it on, so that every timestamp is
+// unique.
+class VirtualClock
+{
+public:
+    static constexpr time_t START = 946684800; // 2000-01-01 00:00:00 UTC
+
+    static time_t now();
+    static bool set(time_t t);
+    static void advance(time_t seconds);
+    static void setStep(time_t seconds);
+    static void reset();
+
+private:
+    static std::atomic<time_t> _now;
+    static std::atomic<time_t> _step;
+};
+
+// Mock - trace-event JSON of the calls for chrome://tracing or Perfetto, one
+// file per process, also "--chrome-trace <file>" of begin()
+//
+// The calls of File, FileImpl and lfs_* are complete events on the track
+// of their thread, so that they nest. Each has the path, the size asked
+// for and the result as arguments.
+class ChromeTrace
+{
+public:
+    static bool start(const char* path);
+    static bool stop();
+    static bool active() { return _active.load(std::memory_order_relaxed); }
+    static uint64_t nowNs();
+    static void complete(const char* category, const char* name, const char* path,
+                         uint64_t startNs, uint64_t durationNs, int64_t size, int64_t result);
+
+    // Times its scope, nothing but a flag test while no trace is written
+    class Span
+    {
+    public:
+        Span(const char* category, const char* name, const char* path, int64_t size = 0)
+            : _category(category), _name(name), _size(size), _startNs(active() ? nowNs() : 0) {
+            if (_startNs && path) {
+                _path = path;
+            }
+        }
+        ~Span() {
+            if (_startNs) {
+                complete(_category, _name, _path.c_str(), _startNs, nowNs() - _startNs, _size, _result);
+            }
+        }
+        void result(int64_t result) { _result = result; }
+
+    private:
+        const char* _category;
+        const char* _name;
+        std::string _path;
+        int64_t     _size;
+        int64_t     _result = 0;
+        uint64_t    _startNs;
+    };
+
+private:
+    static std::atomic<bool> _active;
+};
+
+// Mock - heap use of one public call, see FSAlloc
+struct FSAllocStats {
+    const char* call;           // "File::read"
+    uint64_t calls;
+    uint64_t allocations;       // malloc, calloc, realloc and new inside the call
+    uint64_t bytes;             // Asked for
+    uint64_t maxAllocations;    // In one call
+    uint64_t maxBytes;
+};
+
+// Mock - counts the heap allocations inside the public FS, File and Dir calls
+//
+// Needs FS_TRACK_ALLOC and glibc: malloc() and friends of the process are
+// replaced, forwarding to glibc. A call made inside another counts for the
+// outer one. The live heap is that of the whole process, peakBytes() is its
+// largest growth since reset(), which a test can call in setUp().
+class FSAlloc
+{
+public:
+    static constexpr size_t CALLS = 96;
+
+    static bool supported();
+    static bool start();        // Clears the counters
+    static void stop();
+    static bool active() { return _active.load(std::memory_order_relaxed); }
+    static void reset();
+    static int64_t peakBytes();
+    // The calls with allocations, most bytes first
+    static size_t report(FSAllocStats* stats, size_t count);
+
+    // Attributes the allocations of its scope, a flag test while not active
+    class Scope
+    {
+    public:
+        Scope(const char* call) : _outer(active() && _enter(call)) { }
+        ~Scope() {
+            if (_outer) {
+                _leave();
+            }
+        }
+
+    private:
+        bool _outer;
+    };
+
+private:
+    static bool _enter(const char* call);
+    static void _leave();
+    static std::atomic<bool> _active;
+};
+
+// Mock - the I/O threads of an FS, for FS::openAsync() and File::readAsync()
+//
+// Tasks go through a bounded lock-free ring, like the one of TraceRecorder,
+// to a fixed number of threads. Idle threads sleep, a submitter only takes
+// the lock to wake one when some do. When the ring is full the task runs
+// on the caller instead, which bounds the work in flight. So does a stopped
+// pool.
+class FSIoPool
+{
+public:
+    static constexpr size_t SLOTS = 256;
+
+    // threads 0 picks the cores of the host, at most 8
+    explicit FSIoPool(unsigned threads = 0);
+    // Runs the tasks still queued, see stop()
+    ~FSIoPool();
+
+    unsigned threads() const { return (unsigned) _threads.size(); }
+    void submit(std::function<void()> task);
+    // Runs the tasks submitted so far and joins the threads, not from one of
+    // them. Returns once stopped, also when another thread stopped it.
+    void stop();
+
+    template <typename T>
+    std::future<T> async(std::function<T()> fn) {
+        // std::function needs a copyable task
+        auto task = std::make_shared<std::packaged_task<T()>>(std::move(fn));
+        std::future<T> result = task->get_future();
+        submit([task] { (*task)(); });
+        return result;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t>   sequence;
+        std::function<void()> task;
+    };
+
+    bool _push(std::function<void()>& task);
+    bool _pop(std::function<void()>& task);
+    bool _empty() const;
+    void _run();
+
+    std::vector<Slot>        _slots;
+    std::atomic<size_t>      _enqueue;
+    std::atomic<size_t>      _dequeue;
+    std::atomic<bool>        _stopping;
+    std::atomic<unsigned>    _submitting;
+    std::atomic<unsigned>    _sleeping;
+    std::once_flag           _stopped;
+    std::mutex               _mutex;
+    std::condition_variable  _wake;
+    std::vector<std::thread> _threads;
+};
 
 class FSConfig
 {
@@ -216,9 +537,54 @@ public:
     bool format();
     //Mock
     bool mockSetInfo(FSInfo& info);
+    bool mockSetInfo64(FSInfo64& info);
+    //Mock - writes fail when the files exceed the totalBytes of mockSetInfo()
+    bool mockLimitCapacity(bool enable = true);
     bool info(FSInfo& info);
     bool info64(FSInfo64& info);
 
+    //Mock - virtual flash timing, charged on a virtual clock instead of sleeping
+    bool mockSetTimingModel(const FSTimingModel& model);
+    bool mockTiming(FSTiming& timing);
+    void mockResetTiming();
+
+    //Mock - erases and programs per block of the emulated flash
+    bool mockTrackWear(bool enable = true);
+    bool mockWearReport(FSWearReport& report, uint32_t endurance = 100000);
+
+    //Mock - counters and latency histograms of the operations, always recorded
+    bool stats(FSStats& stats);
+    void resetStats();
+
+    //Mock - binary trace of the operations, also "--trace <file>" of begin()
+    bool mockStartTrace(const char* path);
+    bool mockStopTrace();
+
+    //Mock - run the calls of a trace again, on this file system
+    bool mockReplay(const char* trace, const FSReplayOptions& options, FSReplayReport& report);
+
+    //Mock - cut the power after every stride programs and erases of the workload,
+    // remount and check what survived, the files are rolled back after each cut
+    bool mockPowerLoss(const std::function<void()>& workload, const std::function<bool()>& check,
+                       FSPowerLossReport& report, uint64_t stride = 1);
+
+    //Mock - overlapped I/O for host programs, open() on a pool of I/O threads
+    // owned by this FS and started by the first async call. setAsyncThreads()
+    // before that call sizes it, 0 picks the cores of the host, at most 8.
+    // end() waits for the calls submitted before it.
+    std::future<File> openAsync(const char* path, const char* mode);
+    std::future<File> openAsync(const String& path, const char* mode);
+    bool setAsyncThreads(unsigned threads);
+
+    //Mock - whole files in one batch, for loading fixtures and readers of many
+    // files. On Linux io_uring opens, reads or writes and closes all files with
+    // one system call each, elsewhere they take the plain calls. writeFiles()
+    // creates or replaces the files. True when all files are ok.
+    bool readFiles(std::vector<FSBatchFile>& files);
+    bool writeFiles(std::vector<FSBatchFile>& files);
+    // false runs the batches as plain calls, returns whether they use io_uring
+    bool mockBatchUring(bool enable = true);
+
     File open(const char* path, const char* mode);
     File open(const String& path, const char* mode);
 
@@ -253,6 +619,13 @@ protected:
     FSImplPtr getImpl() { return _impl; }
     time_t (*_timeCallback)(void) = nullptr;
     static time_t _defaultTimeCB(void) { return time(NULL); }
+
+    //Mock - see openAsync()
+    friend class File;
+    friend class FSLoop;
+    std::shared_ptr<FSIoPool> _asyncPool();
+    std::shared_ptr<FSIoPool> _pool;
+    unsigned                  _asyncThreads = 0;
 };
 
 } // namespace fs
@@ -273,6 +646,22 @@ using fs::SeekSet;
 using fs::SeekCur;
 using fs::SeekEnd;
 using fs::FSInfo;
+using fs::FSInfo64;
+using fs::FSTimingModel;
+using fs::FSTiming;
+using fs::FSWearReport;
+using fs::FSPowerLossReport;
+using fs::FSBatchFile;
+using fs::VirtualClock;
+using fs::ChromeTrace;
+using fs::FSAllocStats;
+using fs::FSAlloc;
+using fs::FSIoPool;
+using fs::FSOp;
+using fs::FSOpStats;
+using fs::FSStats;
+using fs::FSReplayOptions;
+using fs::FSReplayReport;
 using fs::FSConfig;
 using fs::SPIFFSConfig;
 #endif //FS_NO_GLOBALS
@@ -0,0 +1,274 @@
+/*
+ FSCoro.h - C++20 coroutines over the async calls of FS, File and Dir
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef FS_CORO_H
+#define FS_CORO_H
+
+// Needs -std=c++20, an empty header before
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include "FS.h"
+
+namespace fs {
+
+class FSLoop;
+
+// Mock - a session on an FSLoop, the return type of its coroutines
+//
+// FSLoop::spawn() starts one, inside a session co_await runs another
+// to its end.
+class FSTask
+{
+public:
+    struct promise_type {
+        // resumes the awaiting session, or ends the spawned one
+        struct Final {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+            void await_resume() noexcept { }
+        };
+
+        FSLoop*                 loop = nullptr;
+        std::coroutine_handle<> continuation;
+
+        FSTask get_return_object() {
+            return FSTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        Final final_suspend() noexcept { return Final(); }
+        void return_void() { }
+        // like the device, no exceptions
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    FSTask(FSTask&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) { }
+    FSTask(const FSTask&) = delete;
+    ~FSTask() {
+        if (_handle) {
+            _handle.destroy();
+        }
+    }
+
+    // co_await of a task from a session, runs it right away
+    struct Awaiter {
+        std::coroutine_handle<promise_type> child;
+        bool await_ready() noexcept { return !child || child.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> parent) noexcept {
+            child.promise().loop = parent.promise().loop;
+            child.promise().continuation = parent;
+            return child;
+        }
+        void await_resume() noexcept { }
+    };
+    Awaiter operator co_await() && noexcept { return Awaiter{ _handle }; }
+
+private:
+    friend class FSLoop;
+    explicit FSTask(std::coroutine_handle<promise_type> handle) : _handle(handle) { }
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+// Mock - a call made on the I/O threads of the FS, see FS::openAsync(),
+// co_await gives its result back on the thread of the loop
+template <typename T>
+class FSAwait
+{
+public:
+    FSAwait(FSLoop* loop, std::function<T()> call) : _loop(loop), _call(std::move(call)) { }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<FSTask::promise_type> h);
+    T await_resume() { return std::move(*_result); }
+
+private:
+    FSLoop*            _loop;
+    std::function<T()> _call;
+    std::optional<T>   _result;
+};
+
+class FSAsyncDir;
+
+// Mock - runs many file sessions on one thread
+//
+// The calls of a session run on the I/O threads of the FS, meanwhile the
+// loop resumes the sessions whose calls are done. So the sessions, though
+// in flight at the same time, only ever run on the thread of run() and need
+// no locks between them.
+//
+//   FSLoop loop(LittleFS);
+//   loop.spawn([](FSLoop& loop) -> FSTask {
+//       File f = co_await loop.open("/log.txt", "a");
+//       co_await loop.write(f, data, size);
+//       co_await loop.close(f);
+//   }(loop));
+//   loop.run();
+class FSLoop
+{
+public:
+    explicit FSLoop(FS& fs) : _fs(fs) { }
+    FSLoop(const FSLoop&) = delete;
+
+    // Starts the session with the next run()
+    void spawn(FSTask task) {
+        std::coroutine_handle<FSTask::promise_type> h = std::exchange(task._handle, nullptr);
+        h.promise().loop = this;
+        _sessions++;
+        _post(h);
+    }
+
+    // Resumes the sessions until all have ended, returns how many ended
+    size_t run() {
+        size_t ended = 0;
+        std::vector<std::coroutine_handle<>> ready;
+        while (_sessions > 0) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [this] { return !_ready.empty(); });
+                ready.swap(_ready);
+            }
+            for (std::coroutine_handle<> h : ready) {
+                h.resume();
+            }
+            ready.clear();
+            ended += _ended;
+            _sessions -= _ended;
+            _ended = 0;
+        }
+        return ended;
+    }
+
+    FSAwait<File> open(const String& path, const char* mode) {
+        std::string modeStr = mode;
+        return FSAwait<File>(this, [this, path, modeStr] { return _fs.open(path, modeStr.c_str()); });
+    }
+    FSAwait<size_t> read(File& file, uint8_t* buf, size_t size) {
+        File f = file;
+        return FSAwait<size_t>(this, [f, buf, size]() mutable { return f.read(buf, size); });
+    }
+    FSAwait<size_t> write(File& file, const uint8_t* buf, size_t size) {
+        File f = file;
+        return FSAwait<size_t>(this, [f, buf, size]() mutable { return f.write(buf, size); });
+    }
+    // flushes and closes, false if the file was not open
+    FSAwait<bool> close(File& file) {
+        File f = file;
+        return FSAwait<bool>(this, [f]() mutable {
+            bool open = f;
+            f.close();
+            return open;
+        });
+    }
+    FSAwait<FSAsyncDir> openDir(const String& path);
+
+private:
+    template <typename T> friend class FSAwait;
+    friend class FSTask;
+    friend class FSAsyncDir;
+
+    // On the I/O threads of the FS
+    void _submit(std::function<void()> call) {
+        _fs._asyncPool()->submit(std::move(call));
+    }
+
+    // From any thread, resumed by run()
+    void _post(std::coroutine_handle<> h) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _ready.push_back(h);
+        _wake.notify_one();
+    }
+
+    // The session of h has ended, on the thread of run()
+    void _end(std::coroutine_handle<FSTask::promise_type> h) {
+        h.destroy();
+        _ended++;
+    }
+
+    FS&                                  _fs;
+    std::mutex                           _mutex;
+    std::condition_variable              _wake;
+    std::vector<std::coroutine_handle<>> _ready;
+    size_t                               _sessions = 0;
+    size_t                               _ended = 0;
+};
+
+// Mock - a Dir read with co_await dir.next()
+class FSAsyncDir
+{
+public:
+    FSAsyncDir() = default;
+    FSAsyncDir(FSLoop* loop, Dir dir) : _loop(loop), _dir(std::move(dir)) { }
+
+    FSAwait<bool> next() {
+        Dir* dir = &_dir;
+        return FSAwait<bool>(_loop, [dir] { return dir->next(); });
+    }
+
+    // Of the entry of the last next(), see Dir
+    String fileName() { return _dir.fileName(); }
+    size_t fileSize() { return _dir.fileSize(); }
+    time_t fileTime() { return _dir.fileTime(); }
+    bool isFile() const { return _dir.isFile(); }
+    bool isDirectory() const { return _dir.isDirectory(); }
+    Dir& dir() { return _dir; }
+
+private:
+    FSLoop* _loop = nullptr;
+    Dir     _dir;
+};
+
+inline FSAwait<FSAsyncDir> FSLoop::openDir(const String& path) {
+    return FSAwait<FSAsyncDir>(this, [this, path] { return FSAsyncDir(this, _fs.openDir(path)); });
+}
+
+template <typename T>
+void FSAwait<T>::await_suspend(std::coroutine_handle<FSTask::promise_type> h) {
+    FSLoop* loop = _loop;
+    // the frame, and with it this, lives until the loop resumes h
+    loop->_submit([this, loop, h] {
+        _result.emplace(_call());
+        loop->_post(h);
+    });
+}
+
+inline std::coroutine_handle<> FSTask::promise_type::Final::await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+    promise_type& p = h.promise();
+    if (p.continuation) {
+        // the FSTask of the awaiting session destroys the frame
+        return p.continuation;
+    }
+    p.loop->_end(h);
+    return std::noop_coroutine();
+}
+
+} // namespace fs
+
+#ifndef FS_NO_GLOBALS
+using fs::FSTask;
+using fs::FSAwait;
+using fs::FSLoop;
+using fs::FSAsyncDir;
+#endif //FS_NO_GLOBALS
+
+#endif // __cpp_impl_coroutine
+
+#endif //FS_CORO_H
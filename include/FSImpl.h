@@ -35,11 +35,17 @@ public:
     virtual size_t write(const uint8_t *buf, size_t size) = 0;
     virtual size_t read(uint8_t* buf, size_t size) = 0;
     virtual void flush() = 0;
-    virtual bool seek(uint32_t pos, SeekMode mode) = 0;
+    virtual bool seek(int64_t pos, SeekMode mode) = 0;
     virtual size_t position() const = 0;
     virtual size_t size() const = 0;
+    // Position and size of files beyond the range of size_t on 32-bit hosts
+    virtual uint64_t position64() const { return position(); }
+    virtual uint64_t size64() const { return size(); }
     virtual int availableForWrite() { return 0; }
-    virtual bool truncate(uint32_t size) = 0;
+    virtual bool truncate(uint64_t size) = 0;
+    // Preallocate storage for size bytes without changing the file size.
+    // Filesystems without preallocation treat it as a hint.
+    virtual bool reserve(uint64_t size) { (void)size; return true; }
     virtual void close() = 0;
     virtual const char* name() const = 0;
     virtual const char* fullName() const = 0;
@@ -111,8 +117,30 @@ public:
     virtual bool format() = 0;
     //Mock
     virtual void mockSetInfo(FSInfo& info) = 0;
+    virtual void mockSetInfo64(FSInfo64& info) = 0;
     virtual bool info(FSInfo& info) = 0;
     virtual bool info64(FSInfo64& info) = 0;
+    //Mock
+    virtual bool mockLimitCapacity(bool enable) { (void)enable; return false; }
+    virtual bool mockSetTimingModel(const FSTimingModel& model) { (void)model; return false; }
+    virtual bool mockTiming(FSTiming& timing) { (void)timing; return false; }
+    virtual void mockResetTiming() { }
+    virtual bool mockTrackWear(bool enable) { (void)enable; return false; }
+    virtual bool mockWearReport(FSWearReport& report, uint32_t endurance) { (void)report; (void)endurance; return false; }
+    virtual bool stats(FSStats& stats) { (void)stats; return false; }
+    virtual void resetStats() { }
+    virtual bool mockStartTrace(const char* path) { (void)path; return false; }
+    virtual bool mockStopTrace() { return false; }
+    virtual bool mockReplay(const char* trace, const FSReplayOptions& options, FSReplayReport& report) {
+        (void)trace; (void)options; (void)report; return false;
+    }
+    virtual bool mockPowerLoss(const std::function<void()>& workload, const std::function<bool()>& check,
+                               FSPowerLossReport& report, uint64_t stride) {
+        (void)workload; (void)check; (void)report; (void)stride; return false;
+    }
+    virtual bool readFiles(std::vector<FSBatchFile>& files) { (void)files; return false; }
+    virtual bool writeFiles(std::vector<FSBatchFile>& files) { (void)files; return false; }
+    virtual bool mockBatchUring(bool enable) { (void)enable; return false; }
     virtual FileImplPtr open(const char* path, OpenMode openMode, AccessMode accessMode) = 0;
     virtual bool exists(const char* path) = 0;
     virtual DirImplPtr openDir(const char* path) = 0;
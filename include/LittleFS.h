@@ -30,7 +30,9 @@
 #ifndef __LITTLEFS_H
 #define __LITTLEFS_H
 
+#include <algorithm>
 #include <limits>
+#include <math.h>
 #include <stdio.h>
 #include <FS.h>
 #include <FSImpl.h>
@@ -46,25 +48,181 @@
 // #define LFS_NAME_MAX 32
 // #include "../lib/littlefs/lfs.h"
 #include "lfs.h"
+#include "LittleFSTrace.h"
 
 using namespace fs;
 
 namespace littlefs_impl {
 
-class LittleFSFileImpl;
-class LittleFSDirImpl;
+//Mock - compile-time instrumentation of LittleFSImplT<Hooks>
+//
+// Hooks::begin() and Hooks::end() are called around each lfs_* call of an
+// lfs_op, with the path (the host path for open files) and the result.
+// NullHooks compiles to nothing.
+struct NullHooks {
+    static void begin(lfs_op op, const char* path) { (void)op; (void)path; }
+    static void end(lfs_op op, int64_t result) { (void)op; (void)result; }
+};
+
+// The lfs_* calls of LittleFSImplT, each between Hooks::begin() and Hooks::end()
+template <typename Hooks>
+struct HookedLfs {
+    static int file_open(lfs_t *lfs, lfs_file_t *file, const char *path, int flags) {
+        return _call(LFS_OP_OPEN, path, [&] { return lfs_file_open(lfs, file, path, flags); });
+    }
+    static int file_close(lfs_t *lfs, lfs_file_t *file) {
+        return _call(LFS_OP_CLOSE, file->path, [&] { return lfs_file_close(lfs, file); });
+    }
+    static lfs_ssize_t file_read(lfs_t *lfs, lfs_file_t *file, void *buffer, lfs_size_t size) {
+        return _call(LFS_OP_READ, file->path, [&] { return lfs_file_read(lfs, file, buffer, size); });
+    }
+    static lfs_ssize_t file_write(lfs_t *lfs, lfs_file_t *file, const void *buffer, lfs_size_t size) {
+        return _call(LFS_OP_WRITE, file->path, [&] { return lfs_file_write(lfs, file, buffer, size); });
+    }
+    static lfs_soff_t file_seek(lfs_t *lfs, lfs_file_t *file, lfs_soff_t off, int whence) {
+        return _call(LFS_OP_SEEK, file->path, [&] { return lfs_file_seek(lfs, file, off, whence); });
+    }
+    static int file_sync(lfs_t *lfs, lfs_file_t *file) {
+        return _call(LFS_OP_SYNC, file->path, [&] { return lfs_file_sync(lfs, file); });
+    }
+    static int file_truncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
+        return _call(LFS_OP_TRUNCATE, file->path, [&] { return lfs_file_truncate(lfs, file, size); });
+    }
+    static int stat(lfs_t *lfs, const char *path, struct lfs_info *info) {
+        return _call(LFS_OP_STAT, path, [&] { return lfs_stat(lfs, path, info); });
+    }
+    static int dir_open(lfs_t *lfs, lfs_dir_t *dir, const char *path) {
+        return _call(LFS_OP_DIR_OPEN, path, [&] { return lfs_dir_open(lfs, dir, path); });
+    }
+    static int dir_open_file(lfs_t *lfs, lfs_dir_t *dir, const char *path) {
+        return _call(LFS_OP_DIR_OPEN, path, [&] { return lfs_dir_open_file(lfs, dir, path); });
+    }
+    static int dir_read(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info) {
+        return _call(LFS_OP_DIR_READ, dir->path, [&] { return lfs_dir_read(lfs, dir, info); });
+    }
+    static int mkdir(lfs_t *lfs, const char *path) {
+        return _call(LFS_OP_MKDIR, path, [&] { return lfs_mkdir(lfs, path); });
+    }
+    static int remove(lfs_t *lfs, const char *path) {
+        return _call(LFS_OP_REMOVE, path, [&] { return lfs_remove(lfs, path); });
+    }
+    static int rename(lfs_t *lfs, const char *oldpath, const char *newpath) {
+        return _call(LFS_OP_RENAME, oldpath, [&] { return lfs_rename(lfs, oldpath, newpath); });
+    }
+    static lfs_soff_t file_tell(lfs_t *lfs, lfs_file_t *file) {
+        return _call(LFS_OP_TELL, file->path, [&] { return lfs_file_tell(lfs, file); });
+    }
+    static lfs_soff_t file_size(lfs_t *lfs, lfs_file_t *file) {
+        return _call(LFS_OP_SIZE, file->path, [&] { return lfs_file_size(lfs, file); });
+    }
+    static int file_reserve(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
+        return _call(LFS_OP_RESERVE, file->path, [&] { return lfs_file_reserve(lfs, file, size); });
+    }
+    static int dir_close(lfs_t *lfs, lfs_dir_t *dir) {
+        return _call(LFS_OP_DIR_CLOSE, dir->path, [&] { return lfs_dir_close(lfs, dir); });
+    }
+    static int dir_rewind(lfs_t *lfs, lfs_dir_t *dir) {
+        return _call(LFS_OP_DIR_REWIND, dir->path, [&] { return lfs_dir_rewind(lfs, dir); });
+    }
+    static lfs_ssize_t getattr(lfs_t *lfs, const char *path, uint8_t type, void *buffer, lfs_size_t size) {
+        return _call(LFS_OP_GETATTR, path, [&] { return lfs_getattr(lfs, path, type, buffer, size); });
+    }
+    static int setattr(lfs_t *lfs, const char *path, uint8_t type, const void *buffer, lfs_size_t size) {
+        return _call(LFS_OP_SETATTR, path, [&] { return lfs_setattr(lfs, path, type, buffer, size); });
+    }
+    //Mock - the calls on the whole file system have the path ""
+    static lfs_soff_t fs_size(lfs_t *lfs) {
+        return _call(LFS_OP_FS_SIZE, "", [&] { return lfs_fs_size(lfs); });
+    }
+    static int mount(lfs_t *lfs, const struct lfs_config *config) {
+        return _call(LFS_OP_MOUNT, "", [&] { return lfs_mount(lfs, config); });
+    }
+    static int format(lfs_t *lfs, const struct lfs_config *config) {
+        return _call(LFS_OP_FORMAT, "", [&] { return lfs_format(lfs, config); });
+    }
+    static int unmount(lfs_t *lfs) {
+        return _call(LFS_OP_UNMOUNT, "", [&] { return lfs_unmount(lfs); });
+    }
+    //Mock - a batch is one call, with the op and the path of its first file
+    static int files_read(lfs_t *lfs, lfs_batch_file *files, size_t count, lfs_batch_alloc_t alloc, void *context) {
+        return _call(LFS_OP_READ, count ? files[0].path : "", [&] {
+            return lfs_files_read(lfs, files, count, alloc, context);
+        });
+    }
+    static int files_write(lfs_t *lfs, lfs_batch_file *files, size_t count) {
+        return _call(LFS_OP_WRITE, count ? files[0].path : "", [&] { return lfs_files_write(lfs, files, count); });
+    }
+
+private:
+    template <typename Call>
+    static auto _call(lfs_op op, const char *path, Call call) -> decltype(call()) {
+        Hooks::begin(op, path);
+        auto result = call();
+        Hooks::end(op, result);
+        return result;
+    }
+};
+
+template <typename Hooks> class LittleFSFileImplT;
+template <typename Hooks> class LittleFSDirImplT;
 
 class LittleFSConfig : public FSConfig
 {
 public:
     static constexpr uint32_t FSId = 0x4c495454;
     LittleFSConfig(bool autoFormat = true) : FSConfig(FSId, autoFormat) { }
+
+    //Mock - what File::flush() and File::close() guarantee on the host,
+    // can be overridden by "--durability none|flush|fdatasync|fsync"
+    LittleFSConfig setDurability(lfs_durability durability = LFS_DURABILITY_FLUSH) {
+        _durability = durability;
+        return *this;
+    }
+
+    //Mock - erases of a metadata pair before littlefs moves it to other blocks,
+    // lower values level the wear better at the cost of more relocations
+    LittleFSConfig setBlockCycles(int32_t blockCycles = 16) {
+        _blockCycles = blockCycles;
+        return *this;
+    }
+
+    //Mock - the host folder of the files instead of ".unittest/", a file system
+    // each lets tests run in parallel, "--test-dir <dir>" still takes precedence
+    LittleFSConfig setRoot(const String& root) {
+        _root = root;
+        return *this;
+    }
+
+    //Mock - a root in RAM created by begin() and removed by end(), on
+    // /dev/shm where available, also "--ram-root". Of "--ram-root" and
+    // "--test-dir" the last one given wins.
+    LittleFSConfig setRamRoot(bool enable = true) {
+        _ramRoot = enable;
+        return *this;
+    }
+
+    //Mock - creates a host folder no other thread or process uses,
+    // "<base>-<pid>-<n>/", or returns "" on failure. The caller removes it.
+    static String uniqueRoot(const char* base = ".unittest");
+    //Mock - a unique root in RAM: on /dev/shm, else $XDG_RUNTIME_DIR, else
+    // the temporary folder of the host, which need not be in RAM
+    static String uniqueRamRoot();
+    //Mock - removes a root and everything below it
+    static bool removeRoot(const String& root);
+
+    lfs_durability _durability = LFS_DURABILITY_FLUSH;
+    int32_t        _blockCycles = 16;
+    String         _root;
+    bool           _ramRoot = false;
 };
 
-class LittleFSImpl : public FSImpl
+template <typename Hooks = NullHooks>
+class LittleFSImplT : public FSImpl
 {
 public:
-    LittleFSImpl(uint32_t start, uint32_t size, uint32_t pageSize, uint32_t blockSize, uint32_t maxOpenFds)
+    using Lfs = HookedLfs<Hooks>;
+
+    LittleFSImplT(uint32_t start, uint64_t size, uint32_t pageSize, uint32_t blockSize, uint32_t maxOpenFds)
         : _start(start),
         _size(size),
         _pageSize(pageSize),
@@ -74,34 +232,19 @@ public:
     {
         memset(&_lfs, 0, sizeof(_lfs));
         memset(&_lfs_cfg, 0, sizeof(_lfs_cfg));
-        if (_size && _blockSize) {
-        _lfs_cfg.context = (void*) this;
-            // _lfs_cfg.read = lfs_flash_read;
-            // _lfs_cfg.prog = lfs_flash_prog;
-            // _lfs_cfg.erase = lfs_flash_erase;
-            // _lfs_cfg.sync = lfs_flash_sync;
-            _lfs_cfg.read_size = 64;
-            _lfs_cfg.prog_size = 64;
-            _lfs_cfg.block_size =  _blockSize;
-            _lfs_cfg.block_count = _size / _blockSize;
-            _lfs_cfg.block_cycles = 16; // TODO - need better explanation
-            _lfs_cfg.cache_size = 64;
-            _lfs_cfg.lookahead_size = 64;
-            _lfs_cfg.read_buffer = nullptr;
-            _lfs_cfg.prog_buffer = nullptr;
-            _lfs_cfg.lookahead_buffer = nullptr;
-            _lfs_cfg.name_max = 0;
-            _lfs_cfg.file_max = 0;
-            _lfs_cfg.attr_max = 0;
-        }
+        _setGeometry();
 
         strcpy(_lfs.test_dir, ".unittest/");
+        lfs_trace(&_lfs, &LittleFSImplT::_traceEvent, this); //Mock
     }
 
-    ~LittleFSImpl() {
+    ~LittleFSImplT() {
+        mockStopTrace();
         if (_mounted) {
-            lfs_unmount(&_lfs);
+            Lfs::unmount(&_lfs);
         }
+        _removeRamRoot(); //Mock
+        lfs_wear_track(&_lfs, false);
     }
 
     FileImplPtr open(const char* path, OpenMode openMode, AccessMode accessMode) override;
@@ -112,7 +255,7 @@ public:
             return false;
         }
         lfs_info info;
-        int rc = lfs_stat(&_lfs, path, &info);
+        int rc = Lfs::stat(&_lfs, path, &info);
         return rc == 0;
     }
 
@@ -120,7 +263,7 @@ public:
         if (!_mounted || !pathFrom || !pathFrom[0] || !pathTo || !pathTo[0]) {
             return false;
         }
-        int rc = lfs_rename(&_lfs, pathFrom, pathTo);
+        int rc = Lfs::rename(&_lfs, pathFrom, pathTo);
         if (rc != 0) {
             //DEBUGV("lfs_rename: rc=%d, from=`%s`, to=`%s`\n", rc, pathFrom, pathTo);
             return false;
@@ -129,11 +272,236 @@ public:
     }
 
     //Mock
-    void mockSetInfo(FSInfo& info) {
-        _maxOpenFds = info.maxOpenFiles;
-        _blockSize = info.blockSize;
-        _pageSize = info.pageSize;
-        _size = info.totalBytes;
+    void mockSetInfo(FSInfo& info) override {
+        _setInfo(info.maxOpenFiles, info.blockSize, info.pageSize, info.totalBytes);
+    }
+
+    //Mock
+    void mockSetInfo64(FSInfo64& info) override {
+        _setInfo(info.maxOpenFiles, info.blockSize, info.pageSize, info.totalBytes);
+    }
+
+    //Mock - the files are limited to the totalBytes of mockSetInfo() while enabled
+    bool mockLimitCapacity(bool enable) override {
+        _limited = enable;
+        if (_mounted) {
+            return lfs_fs_limit(&_lfs, enable) == 0;
+        }
+        return true;
+    }
+
+    //Mock
+    bool mockSetTimingModel(const FSTimingModel& model) override {
+        _lfs.timing.read_ns = model.readNs;
+        _lfs.timing.prog_ns = model.progNs;
+        _lfs.timing.erase_ns = model.eraseNs;
+        return true;
+    }
+
+    //Mock
+    bool mockTiming(FSTiming& timing) override {
+        timing.clockNs = _lfs.timing.clock_ns;
+        timing.lastOpNs = _lfs.timing.last_ns;
+        timing.reads = _lfs.timing.reads;
+        timing.progs = _lfs.timing.progs;
+        timing.erases = _lfs.timing.erases;
+        return true;
+    }
+
+    //Mock
+    void mockResetTiming() override {
+        _lfs.timing.clock_ns = 0;
+        _lfs.timing.last_ns = 0;
+        _lfs.timing.reads = 0;
+        _lfs.timing.progs = 0;
+        _lfs.timing.erases = 0;
+    }
+
+    //Mock - (re)starting clears the counters
+    bool mockTrackWear(bool enable) override {
+        if (!_mounted) {
+            return false;
+        }
+        return lfs_wear_track(&_lfs, enable) == 0;
+    }
+
+    //Mock
+    bool mockWearReport(FSWearReport& report, uint32_t endurance) override {
+        const lfs_wear& wear = _lfs.wear;
+        if (!wear.erases || !wear.count) {
+            return false;
+        }
+        report.blocks = wear.count;
+        report.erases = 0;
+        report.progs = 0;
+        report.minErases = std::numeric_limits<uint32_t>::max();
+        report.maxErases = 0;
+        for (lfs_block_t i = 0; i < wear.count; i++) {
+            report.erases += wear.erases[i];
+            report.progs += wear.progs[i];
+            report.minErases = std::min(report.minErases, wear.erases[i]);
+            report.maxErases = std::max(report.maxErases, wear.erases[i]);
+        }
+        report.meanErases = (double)report.erases / wear.count;
+        double variance = 0;
+        for (lfs_block_t i = 0; i < wear.count; i++) {
+            double d = wear.erases[i] - report.meanErases;
+            variance += d * d;
+        }
+        report.stddevErases = sqrt(variance / wear.count);
+        const double inf = std::numeric_limits<double>::infinity();
+        report.lifetime = report.maxErases ? (double)endurance / report.maxErases : inf;
+        report.lifetimeLeveled = report.erases ? (double)endurance * wear.count / report.erases : inf;
+        return true;
+    }
+
+    //Mock
+    bool stats(FSStats& stats) override {
+        static_assert((int)FSOpCount == (int)LFS_OP_COUNT, "FSOp follows lfs_op");
+        static_assert(FSOpStats::BUCKETS == LFS_STATS_BUCKETS, "FSOpStats follows lfs_op_stats");
+        for (int op = 0; op < FSOpCount; op++) {
+            const lfs_op_stats& from = _lfs.stats[op];
+            FSOpStats& to = stats.ops[op];
+            to.count = from.count;
+            to.errors = from.errors;
+            to.bytes = from.bytes;
+            to.totalNs = from.total_ns;
+            to.maxNs = from.max_ns;
+            memcpy(to.histogram, from.histogram, sizeof(to.histogram));
+        }
+        return true;
+    }
+
+    //Mock
+    void resetStats() override {
+        memset(_lfs.stats, 0, sizeof(_lfs.stats));
+    }
+
+    //Mock - see TraceRecorder
+    bool mockStartTrace(const char* path) override {
+        if (_trace) {
+            return false;
+        }
+        std::unique_ptr<TraceRecorder> trace(new TraceRecorder());
+        if (!trace->start(path)) {
+            return false;
+        }
+        _trace = std::move(trace);
+        return true;
+    }
+
+    //Mock
+    bool mockStopTrace() override {
+        if (!_trace) {
+            return false;
+        }
+        // no more events first
+        std::unique_ptr<TraceRecorder> trace = std::move(_trace);
+        return trace->stop();
+    }
+
+    //Mock - see TraceReplay
+    bool mockReplay(const char* trace, const FSReplayOptions& options, FSReplayReport& report) override {
+        if (!_mounted) {
+            return false;
+        }
+        TraceReplay replay;
+        return replay.run(&_lfs, trace, options, report);
+    }
+
+    //Mock - a recording run counts the programs and erases, then every cut runs the
+    // workload again from the snapshot, see lfs_powerloss_begin()
+    bool mockPowerLoss(const std::function<void()>& workload, const std::function<bool()>& check,
+                       FSPowerLossReport& report, uint64_t stride) override {
+        if (!_mounted || !workload || !check || !stride) {
+            return false;
+        }
+        report = FSPowerLossReport();
+        report.firstFailure = LFS_POWERLOSS_NEVER;
+        if (lfs_powerloss_begin(&_lfs, LFS_POWERLOSS_NEVER) != 0) {
+            return false;
+        }
+        workload();
+        report.ops = _lfs.powerloss.ops;
+        if (lfs_powerloss_end(&_lfs) != 0) {
+            return false;
+        }
+        // the last cut leaves the workload complete
+        for (uint64_t cut = 0; cut <= report.ops; cut += stride) {
+            if (lfs_powerloss_begin(&_lfs, cut) != 0) {
+                return false;
+            }
+            workload();
+            lfs_powerloss_resume(&_lfs);
+            bool ok = _tryMount() && check();
+            if (lfs_powerloss_end(&_lfs) != 0) {
+                return false;
+            }
+            report.cuts++;
+            if (!ok) {
+                if (!report.failures) {
+                    report.firstFailure = cut;
+                }
+                report.failures++;
+            }
+        }
+        return _tryMount();
+    }
+
+    //Mock - see lfs_files_read(), the content goes right into FSBatchFile::data
+    bool readFiles(std::vector<FSBatchFile>& files) override {
+        if (!_mounted) {
+            return false;
+        }
+        _BatchRead read;
+        read.files = &files;
+        for (size_t i = 0; i < files.size(); i++) {
+            files[i].ok = false;
+            files[i].data.clear();
+            if (pathValid(files[i].path.c_str())) {
+                read.batch.push_back(lfs_batch_file{ files[i].path.c_str(), nullptr, 0, 0 });
+                read.index.push_back(i);
+            }
+        }
+        int rc = Lfs::files_read(&_lfs, read.batch.data(), read.batch.size(), &_batchAlloc, &read);
+        for (size_t i = 0; i < read.batch.size(); i++) {
+            FSBatchFile& file = files[read.index[i]];
+            file.ok = read.batch[i].result == 0;
+            // shorter when the file shrank meanwhile
+            file.data.resize(file.ok ? read.batch[i].size : 0);
+        }
+        return rc == 0 && read.batch.size() == files.size();
+    }
+
+    //Mock - see lfs_files_write(), makes the parent dirs like open()
+    bool writeFiles(std::vector<FSBatchFile>& files) override {
+        if (!_mounted) {
+            return false;
+        }
+        std::vector<lfs_batch_file> batch;
+        std::vector<size_t> index;
+        for (size_t i = 0; i < files.size(); i++) {
+            files[i].ok = false;
+            if (pathValid(files[i].path.c_str())) {
+                _makeParents(files[i].path.c_str());
+                batch.push_back(lfs_batch_file{ files[i].path.c_str(), files[i].data.data(),
+                                                (lfs_size_t)files[i].data.size(), 0 });
+                index.push_back(i);
+            }
+        }
+        int rc = Lfs::files_write(&_lfs, batch.data(), batch.size());
+        for (size_t i = 0; i < batch.size(); i++) {
+            files[index[i]].ok = batch[i].result == 0;
+        }
+        return rc == 0 && batch.size() == files.size();
+    }
+
+    //Mock
+    bool mockBatchUring(bool enable) override {
+        if (!_mounted) {
+            return false;
+        }
+        return lfs_batch_uring(&_lfs, enable);
     }
 
     bool info(FSInfo& info) override {
@@ -149,17 +517,16 @@ public:
         return true;
     }
 
-    virtual bool info64(FSInfo64& info64) {
-        FSInfo i;
-        if (!info(i)) {
+    bool info64(FSInfo64& info64) override {
+        if (!_mounted) {
             return false;
         }
-        info64.blockSize     = i.blockSize;
-        info64.pageSize      = i.pageSize;
-        info64.maxOpenFiles  = i.maxOpenFiles;
-        info64.maxPathLength = i.maxPathLength;
-        info64.totalBytes    = i.totalBytes;
-        info64.usedBytes     = i.usedBytes;
+        info64.maxOpenFiles  = _maxOpenFds;
+        info64.blockSize     = _blockSize;
+        info64.pageSize      = _pageSize;
+        info64.maxPathLength = LFS_NAME_MAX;
+        info64.totalBytes    = _size;
+        info64.usedBytes     = _getUsedBlocks() * _blockSize;
         return true;
     }
 
@@ -167,7 +534,7 @@ public:
         if (!_mounted || !path || !path[0]) {
             return false;
         }
-        int rc = lfs_remove(&_lfs, path);
+        int rc = Lfs::remove(&_lfs, path);
         if (rc != 0) {
             //DEBUGV("lfs_remove: rc=%d path=`%s`\n", rc, path);
             return false;
@@ -178,7 +545,7 @@ public:
             char *ptr = strrchr(pathStr, '/');
             while (ptr) {
                 *ptr = 0;
-                lfs_remove(&_lfs, pathStr); // Don't care if fails if there are files left
+                Lfs::remove(&_lfs, pathStr); // Don't care if fails if there are files left
                 ptr = strrchr(pathStr, '/');
             }
             free(pathStr);
@@ -190,7 +557,7 @@ public:
         if (!_mounted || !path || !path[0]) {
             return false;
         }
-        int rc = lfs_mkdir(&_lfs, path);
+        int rc = Lfs::mkdir(&_lfs, path);
         return (rc==0);
     }
 
@@ -209,24 +576,34 @@ public:
     //Mock
     //bool begin() override {
     bool begin(int argc, char **argv) override {
-        if (argc >= 2 ) {
-            for (int i = 0; i < argc; i++) {
-                if ( strcmp(argv[i], "--test-dir") == 0 && argc > i+1) {
-                    strcpy(_lfs.test_dir, argv[i+1] );
-                    if (_lfs.test_dir[strlen(_lfs.test_dir)-1] != '/')
-                        strcat(_lfs.test_dir, "/");
-                    break;
-                }
+        _lfs.durability = _cfg._durability;
+        _lfs_cfg.block_cycles = _cfg._blockCycles;
+        if (_cfg._root.length()) {
+            if (_cfg._root.length() + 2 > sizeof(_lfs.test_dir)) {
+                //DEBUGV("root `%s` too long\n", _cfg._root.c_str());
+                return false;
             }
+            strcpy(_lfs.test_dir, _cfg._root.c_str());
+            if (_lfs.test_dir[strlen(_lfs.test_dir)-1] != '/')
+                strcat(_lfs.test_dir, "/");
+        }
+        bool ramRoot = _cfg._ramRoot;
+        if (!_parseArgs(argc, argv, ramRoot)) {
+            return false;
         }
         if ((_blockSize <= 0) || (_size <= 0)) {
             //DEBUGV("LittleFS size is <= zero");
             return false;
         }
+        //Mock
+        if (ramRoot && !_makeRamRoot()) {
+            return false;
+        }
         if (_tryMount()) {
             return true;
         }
         if (!_cfg._autoFormat || !format()) {
+            _removeRamRoot(); //Mock
             return false;
         }
         return _tryMount();
@@ -236,8 +613,9 @@ public:
         if (!_mounted) {
             return;
         }
-        lfs_unmount(&_lfs);
+        Lfs::unmount(&_lfs);
         _mounted = false;
+        _removeRamRoot(); //Mock
     }
 
     bool format() override {
@@ -248,12 +626,13 @@ public:
 
         bool wasMounted = _mounted;
         if (_mounted) {
-            lfs_unmount(&_lfs);
+            Lfs::unmount(&_lfs);
             _mounted = false;
         }
 
-        memset(&_lfs, 0, sizeof(_lfs));
-        int rc = lfs_format(&_lfs, &_lfs_cfg);
+        //Mock - _lfs carries the test dir and settings, don't clear it
+        //memset(&_lfs, 0, sizeof(_lfs));
+        int rc = Lfs::format(&_lfs, &_lfs_cfg);
         if (rc != 0) {
             //DEBUGV("lfs_format: rc=%d\n", rc);
             return false;
@@ -263,19 +642,19 @@ public:
             // Mounting is required to set attributes
 
             time_t t = _timeCallback();
-            rc = lfs_setattr(&_lfs, "/", 'c', &t, 8);
+            rc = Lfs::setattr(&_lfs, "/", 'c', &t, 8);
             if (rc != 0) {
                 //DEBUGV("lfs_format, lfs_setattr 'c': rc=%d\n", rc);
                 return false;
             }
 
-            rc = lfs_setattr(&_lfs, "/", 't', &t, 8);
+            rc = Lfs::setattr(&_lfs, "/", 't', &t, 8);
             if (rc != 0) {
                 //DEBUGV("lfs_format, lfs_setattr 't': rc=%d\n", rc);
             return false;
             }
             
-            lfs_unmount(&_lfs);
+            Lfs::unmount(&_lfs);
             _mounted = false;
         }
 
@@ -290,9 +669,9 @@ public:
         time_t t;
         uint32_t t32b;
 
-        if (lfs_getattr(&_lfs, "/", 'c', &t, 8) == 8) {
+        if (Lfs::getattr(&_lfs, "/", 'c', &t, 8) == 8) {
             return t;
-        } else if (lfs_getattr(&_lfs, "/", 'c', &t32b, 4) == 4) {
+        } else if (Lfs::getattr(&_lfs, "/", 'c', &t32b, 4) == 4) {
             return (time_t)t32b;
         } else {
             return 0;
@@ -301,31 +680,164 @@ public:
 
 
 protected:
-    friend class LittleFSFileImpl;
-    friend class LittleFSDirImpl;
+    friend class LittleFSFileImplT<Hooks>;
+    friend class LittleFSDirImplT<Hooks>;
 
     lfs_t* getFS() {
         return &_lfs;
     }
 
+    //Mock - see mockSetInfo()
+    void _setInfo(size_t maxOpenFiles, size_t blockSize, size_t pageSize, uint64_t totalBytes) {
+        _maxOpenFds = maxOpenFiles;
+        _blockSize = blockSize;
+        _pageSize = pageSize;
+        _size = totalBytes;
+        _setGeometry();
+        if (_limited && _mounted) {
+            // the blocks used are counted in the new block size
+            lfs_fs_limit(&_lfs, true);
+        }
+    }
+
+    //Mock - the flash geometry follows mockSetInfo(), the virtual flash depends on it
+    void _setGeometry() {
+        if (_size && _blockSize) {
+            _lfs_cfg.context = (void*) this;
+            // _lfs_cfg.read = lfs_flash_read;
+            // _lfs_cfg.prog = lfs_flash_prog;
+            // _lfs_cfg.erase = lfs_flash_erase;
+            // _lfs_cfg.sync = lfs_flash_sync;
+            _lfs_cfg.read_size = std::min<uint32_t>(64, _blockSize);
+            _lfs_cfg.prog_size = std::min<uint32_t>(64, _blockSize);
+            _lfs_cfg.block_size =  _blockSize;
+            _lfs_cfg.block_count = _size / _blockSize;
+            _lfs_cfg.block_cycles = _cfg._blockCycles; // see LittleFSConfig::setBlockCycles()
+            _lfs_cfg.cache_size = std::min<uint32_t>(64, _blockSize);
+            _lfs_cfg.lookahead_size = 64;
+            _lfs_cfg.read_buffer = nullptr;
+            _lfs_cfg.prog_buffer = nullptr;
+            _lfs_cfg.lookahead_buffer = nullptr;
+            _lfs_cfg.name_max = 0;
+            _lfs_cfg.file_max = 0;
+            _lfs_cfg.attr_max = 0;
+        }
+    }
+
+    //Mock - the lfs_* calls go to the binary trace and the JSON trace
+    static void _traceEvent(void* context, const lfs_trace_event* event) {
+        LittleFSImplT* fs = static_cast<LittleFSImplT*>(context);
+        if (fs->_trace) {
+            fs->_trace->record(event);
+        }
+        if (ChromeTrace::active()) {
+            ChromeTrace::complete("lfs", FSStats::opName((FSOp)event->op), event->path,
+                                  ChromeTrace::nowNs() - event->duration_ns, event->duration_ns,
+                                  event->length, event->result);
+        }
+    }
+
+    //Mock - the options of the test executable, see begin()
+    bool _parseArgs(int argc, char **argv, bool& ramRoot) {
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "--test-dir") == 0 && i + 1 < argc) {
+                const char *dir = argv[++i];
+                if (!dir[0] || strlen(dir) + 2 > sizeof(_lfs.test_dir)) {
+                    //DEBUGV("test dir `%s` empty or too long\n", dir);
+                    return false;
+                }
+                strcpy(_lfs.test_dir, dir);
+                if (_lfs.test_dir[strlen(_lfs.test_dir)-1] != '/')
+                    strcat(_lfs.test_dir, "/");
+                ramRoot = false;
+            } else if (strcmp(argv[i], "--ram-root") == 0) {
+                ramRoot = true;
+            } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+                mockStopTrace();
+                if (!mockStartTrace(argv[++i])) {
+                    //DEBUGV("cannot trace to `%s`\n", argv[i]);
+                    return false;
+                }
+            } else if (strcmp(argv[i], "--chrome-trace") == 0 && i + 1 < argc) {
+                ChromeTrace::stop();
+                if (!ChromeTrace::start(argv[++i])) {
+                    //DEBUGV("cannot trace to `%s`\n", argv[i]);
+                    return false;
+                }
+            } else if (strcmp(argv[i], "--track-alloc") == 0) {
+                if (!FSAlloc::active() && !FSAlloc::start()) {
+                    //DEBUGV("cannot track the heap without FS_TRACK_ALLOC\n");
+                    return false;
+                }
+            } else if (strcmp(argv[i], "--durability") == 0 && i + 1 < argc) {
+                const char *level = argv[++i];
+                if (strcmp(level, "none") == 0) {
+                    _lfs.durability = LFS_DURABILITY_NONE;
+                } else if (strcmp(level, "flush") == 0) {
+                    _lfs.durability = LFS_DURABILITY_FLUSH;
+                } else if (strcmp(level, "fdatasync") == 0) {
+                    _lfs.durability = LFS_DURABILITY_FDATASYNC;
+                } else if (strcmp(level, "fsync") == 0) {
+                    _lfs.durability = LFS_DURABILITY_FSYNC;
+                } else {
+                    //DEBUGV("unknown durability `%s`\n", level);
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    //Mock - swaps the root for one in RAM until _removeRamRoot()
+    bool _makeRamRoot() {
+        if (_ramRootDir.length()) {
+            // begin() again without end()
+            return true;
+        }
+        String root = LittleFSConfig::uniqueRamRoot();
+        if (!root.length() || root.length() + 1 > sizeof(_lfs.test_dir)) {
+            //DEBUGV("cannot create a root in RAM\n");
+            LittleFSConfig::removeRoot(root);
+            return false;
+        }
+        _diskRoot = _lfs.test_dir;
+        _ramRootDir = root;
+        strcpy(_lfs.test_dir, root.c_str());
+        return true;
+    }
+
+    //Mock
+    void _removeRamRoot() {
+        if (!_ramRootDir.length()) {
+            return;
+        }
+        LittleFSConfig::removeRoot(_ramRootDir);
+        strcpy(_lfs.test_dir, _diskRoot.c_str());
+        _ramRootDir = String();
+    }
+
     bool _tryMount() {
         if (_mounted) {
-            lfs_unmount(&_lfs);
+            Lfs::unmount(&_lfs);
             _mounted = false;
         }
         //memset(&_lfs, 0, sizeof(_lfs));
-        int rc = lfs_mount(&_lfs, &_lfs_cfg);
+        int rc = Lfs::mount(&_lfs, &_lfs_cfg);
         if (rc==0) {
             _mounted = true;
+            if (_limited) {
+                lfs_fs_limit(&_lfs, true);
+            }
         }
         return _mounted;
     }
 
-    int _getUsedBlocks() {
+    uint64_t _getUsedBlocks() {
         if (!_mounted) {
             return 0;
         }
-        return lfs_fs_size(&_lfs);
+        lfs_soff_t rc = Lfs::fs_size(&_lfs);
+        return rc < 0 ? 0 : rc;
     }
 
     static int _getFlags(OpenMode openMode, AccessMode accessMode) {
@@ -348,6 +860,41 @@ protected:
         return mode;
     }
 
+    //Mock - the files of a readFiles() and their buffers
+    struct _BatchRead {
+        std::vector<FSBatchFile>*   files;
+        std::vector<lfs_batch_file> batch;
+        std::vector<size_t>         index;
+    };
+
+    static void* _batchAlloc(void* context, lfs_batch_file* file, lfs_size_t size) {
+        static uint8_t empty;
+        _BatchRead* read = static_cast<_BatchRead*>(context);
+        std::vector<uint8_t>& data = (*read->files)[read->index[file - read->batch.data()]].data;
+        data.resize(size);
+        return size ? data.data() : &empty;
+    }
+
+    // For file creation, silently make subdirs as needed.  If any fail,
+    // it will be caught by the real file open later on
+    void _makeParents(const char* path) {
+        if (!strchr(path, '/')) {
+            return;
+        }
+        char *pathStr = strdup(path);
+        if (pathStr) {
+            // Make dirs up to the final fnamepart
+            char *ptr = strchr(pathStr, '/');
+            while (ptr) {
+                *ptr = 0;
+                Lfs::mkdir(&_lfs, pathStr);
+                *ptr = '/';
+                ptr = strchr(ptr+1, '/');
+            }
+        }
+        free(pathStr);
+    }
+
     // Check that no components of path beyond max len
     static bool pathValid(const char *path) {
         while (*path) {
@@ -382,24 +929,31 @@ protected:
     LittleFSConfig _cfg;
 
     uint32_t _start;
-    uint32_t _size;
+    uint64_t _size;
     uint32_t _pageSize;
     uint32_t _blockSize;
     uint32_t _maxOpenFds;
 
     bool     _mounted;
+    bool     _limited = false; //Mock - see mockLimitCapacity()
+    std::unique_ptr<TraceRecorder> _trace; //Mock - see mockStartTrace()
+    String   _ramRootDir;   //Mock - see _makeRamRoot()
+    String   _diskRoot;
 };
 
 
-class LittleFSFileImpl : public FileImpl
+template <typename Hooks>
+class LittleFSFileImplT : public FileImpl
 {
 public:
-    LittleFSFileImpl(LittleFSImpl* fs, const char *name, std::shared_ptr<lfs_file_t> fd, int flags, time_t creation) : _fs(fs), _fd(fd), _opened(true), _flags(flags), _creation(creation) {
+    using Lfs = HookedLfs<Hooks>;
+
+    LittleFSFileImplT(LittleFSImplT<Hooks>* fs, const char *name, std::shared_ptr<lfs_file_t> fd, int flags, time_t creation) : _fs(fs), _fd(fd), _opened(true), _flags(flags), _creation(creation) {
         _name = std::shared_ptr<char>(new char[strlen(name) + 1], std::default_delete<char[]>());
         strcpy(_name.get(), name);
     }
 
-    ~LittleFSFileImpl() override {
+    ~LittleFSFileImplT() override {
         if (_opened) {
             close();
         }
@@ -409,7 +963,9 @@ public:
         if (!_opened || !_fd || !buf) {
             return 0;
         }
-        int result = lfs_file_write(_fs->getFS(), _getFD(), (void*) buf, size);
+        ChromeTrace::Span span("FileImpl", "write", _name.get(), size); //Mock
+        int result = Lfs::file_write(_fs->getFS(), _getFD(), (void*) buf, size);
+        span.result(result);
         if (result < 0) {
             //DEBUGV("lfs_write rc=%d\n", result);
             return 0;
@@ -421,7 +977,9 @@ public:
         if (!_opened || !_fd | !buf) {
             return 0;
         }
-        int result = lfs_file_read(_fs->getFS(), _getFD(), (void*) buf, size);
+        ChromeTrace::Span span("FileImpl", "read", _name.get(), size); //Mock
+        int result = Lfs::file_read(_fs->getFS(), _getFD(), (void*) buf, size);
+        span.result(result);
         if (result < 0) {
             //DEBUGV("lfs_read rc=%d\n", result);
             return 0;
@@ -434,27 +992,29 @@ public:
         if (!_opened || !_fd) {
             return;
         }
-        int rc = lfs_file_sync(_fs->getFS(), _getFD());
+        ChromeTrace::Span span("FileImpl", "flush", _name.get()); //Mock
+        int rc = Lfs::file_sync(_fs->getFS(), _getFD());
+        span.result(rc);
         if (rc < 0) {
             //DEBUGV("lfs_file_sync rc=%d\n", rc);
         }
     }
 
-    bool seek(uint32_t pos, SeekMode mode) override {
+    bool seek(int64_t pos, SeekMode mode) override {
         if (!_opened || !_fd) {
             return false;
         }
-        int32_t offset = static_cast<int32_t>(pos);
+        lfs_soff_t offset = pos;
         if (mode == SeekEnd) {
             offset = -offset; // TODO - this seems like its plain wrong vs. POSIX
         }
-        auto lastPos = position();
-        int rc = lfs_file_seek(_fs->getFS(), _getFD(), offset, (int)mode); // NB. SeekMode === LFS_SEEK_TYPES
+        auto lastPos = position64();
+        lfs_soff_t rc = Lfs::file_seek(_fs->getFS(), _getFD(), offset, (int)mode); // NB. SeekMode === LFS_SEEK_TYPES
         if (rc < 0) {
             //DEBUGV("lfs_file_seek rc=%d\n", rc);
             return false;
         }
-        if (position() > size()) {
+        if (position64() > size64()) {
             seek(lastPos, SeekSet); // Pretend the seek() never happened
             return false;
         }
@@ -462,10 +1022,18 @@ public:
     }
 
     size_t position() const override {
+        return position64();
+    }
+
+    size_t size() const override {
+        return size64();
+    }
+
+    uint64_t position64() const override {
         if (!_opened || !_fd) {
             return 0;
         }
-        int result = lfs_file_tell(_fs->getFS(), _getFD());
+        lfs_soff_t result = Lfs::file_tell(_fs->getFS(), _getFD());
         if (result < 0) {
             //DEBUGV("lfs_file_tell rc=%d\n", result);
             return 0;
@@ -474,15 +1042,19 @@ public:
         return result;
     }
 
-    size_t size() const override {
-        return (_opened && _fd)? lfs_file_size(_fs->getFS(), _getFD()) : 0;
+    uint64_t size64() const override {
+        if (!_opened || !_fd) {
+            return 0;
+        }
+        lfs_soff_t result = Lfs::file_size(_fs->getFS(), _getFD());
+        return result < 0 ? 0 : result;
     }
 
-    bool truncate(uint32_t size) override {
+    bool truncate(uint64_t size) override {
         if (!_opened || !_fd) {
             return false;
         }
-        int rc = lfs_file_truncate(_fs->getFS(), _getFD(), size);
+        int rc = Lfs::file_truncate(_fs->getFS(), _getFD(), size);
         if (rc < 0) {
             //DEBUGV("lfs_file_truncate rc=%d\n", rc);
             return false;
@@ -490,22 +1062,36 @@ public:
         return true;
     }
 
+    //Mock
+    bool reserve(uint64_t size) override {
+        if (!_opened || !_fd) {
+            return false;
+        }
+        int rc = Lfs::file_reserve(_fs->getFS(), _getFD(), size);
+        if (rc < 0) {
+            //DEBUGV("lfs_file_reserve rc=%d\n", rc);
+            return false;
+        }
+        return true;
+    }
+
     void close() override {
         if (_opened && _fd) {
-            lfs_file_close(_fs->getFS(), _getFD());
+            ChromeTrace::Span span("FileImpl", "close", _name.get()); //Mock
+            span.result(Lfs::file_close(_fs->getFS(), _getFD()));
             _opened = false;
             //DEBUGV("lfs_file_close: fd=%p\n", _getFD());
             if (_timeCallback && (_flags & LFS_O_WRONLY)) {
                 // If the file opened with O_CREAT, write the creation time attribute
                 if (_creation) {
-                    int rc = lfs_setattr(_fs->getFS(), _name.get(), 'c', (const void *)&_creation, sizeof(_creation));
+                    int rc = Lfs::setattr(_fs->getFS(), _name.get(), 'c', (const void *)&_creation, sizeof(_creation));
                     if (rc < 0) {
                         //DEBUGV("Unable to set creation time on '%s' to %d\n", _name.get(), _creation);
                     }
                 }
                 // Add metadata with last write time
                 time_t now = _timeCallback();
-                int rc = lfs_setattr(_fs->getFS(), _name.get(), 't', (const void *)&now, sizeof(now));
+                int rc = Lfs::setattr(_fs->getFS(), _name.get(), 't', (const void *)&now, sizeof(now));
                 if (rc < 0) {
                     //DEBUGV("Unable to set last write time on '%s' to %d\n", _name.get(), now);
                 }
@@ -516,7 +1102,7 @@ public:
     time_t getLastWrite() override {
         time_t ftime = 0;
         if (_opened && _fd) {
-            int rc = lfs_getattr(_fs->getFS(), _name.get(), 't', (void *)&ftime, sizeof(ftime));
+            int rc = Lfs::getattr(_fs->getFS(), _name.get(), 't', (void *)&ftime, sizeof(ftime));
             if (rc != sizeof(ftime))
                 ftime = 0; // Error, so clear read value
         }
@@ -526,7 +1112,7 @@ public:
     time_t getCreationTime() override {
         time_t ftime = 0;
         if (_opened && _fd) {
-            int rc = lfs_getattr(_fs->getFS(), _name.get(), 'c', (void *)&ftime, sizeof(ftime));
+            int rc = Lfs::getattr(_fs->getFS(), _name.get(), 'c', (void *)&ftime, sizeof(ftime));
             if (rc != sizeof(ftime))
                 ftime = 0; // Error, so clear read value
         }
@@ -552,7 +1138,7 @@ public:
             return false;
         }
         lfs_info info;
-        int rc = lfs_stat(_fs->getFS(), fullName(), &info);
+        int rc = Lfs::stat(_fs->getFS(), fullName(), &info);
         return (rc == 0) && (info.type == LFS_TYPE_REG);
     }
 
@@ -563,7 +1149,7 @@ public:
             return true;
         }
         lfs_info info;
-        int rc = lfs_stat(_fs->getFS(), fullName(), &info);
+        int rc = Lfs::stat(_fs->getFS(), fullName(), &info);
         return (rc == 0) && (info.type == LFS_TYPE_DIR);
     }
 
@@ -572,7 +1158,7 @@ protected:
         return _fd.get();
     }
 
-    LittleFSImpl                *_fs;
+    LittleFSImplT<Hooks>        *_fs;
     std::shared_ptr<lfs_file_t>  _fd;
     std::shared_ptr<char>        _name;
     bool                         _opened;
@@ -580,10 +1166,13 @@ protected:
     time_t                       _creation;
 };
 
-class LittleFSDirImpl : public DirImpl
+template <typename Hooks>
+class LittleFSDirImplT : public DirImpl
 {
 public:
-    LittleFSDirImpl(const String& pattern, LittleFSImpl* fs, std::shared_ptr<lfs_dir_t> dir, const char *dirPath = nullptr)
+    using Lfs = HookedLfs<Hooks>;
+
+    LittleFSDirImplT(const String& pattern, LittleFSImplT<Hooks>* fs, std::shared_ptr<lfs_dir_t> dir, const char *dirPath = nullptr)
         : _pattern(pattern) , _fs(fs) , _dir(dir) , _dirPath(nullptr), _valid(false), _opened(true)
     {
         memset(&_dirent, 0, sizeof(_dirent));
@@ -593,9 +1182,9 @@ public:
         }
     }
 
-    ~LittleFSDirImpl() override {
+    ~LittleFSDirImplT() override {
         if (_opened) {
-            lfs_dir_close(_fs->getFS(), _getDir());
+            Lfs::dir_close(_fs->getFS(), _getDir());
         }
     }
 
@@ -669,11 +1258,11 @@ public:
 
     bool rewind() override {
         _valid = false;
-        int rc = lfs_dir_rewind(_fs->getFS(), _getDir());
+        int rc = Lfs::dir_rewind(_fs->getFS(), _getDir());
         // Skip the . and .. entries
         lfs_info dirent;
-        lfs_dir_read(_fs->getFS(), _getDir(), &dirent);
-        lfs_dir_read(_fs->getFS(), _getDir(), &dirent);
+        Lfs::dir_read(_fs->getFS(), _getDir(), &dirent);
+        Lfs::dir_read(_fs->getFS(), _getDir(), &dirent);
         return (rc == 0);
     }
 
@@ -682,7 +1271,7 @@ public:
         bool match;
         do {
             _dirent.name[0] = 0;
-            int rc = lfs_dir_read(_fs->getFS(), _getDir(), &_dirent);
+            int rc = Lfs::dir_read(_fs->getFS(), _getDir(), &_dirent);
             _valid = (rc == 1);
             match = (!n || !strncmp((const char*) _dirent.name, _pattern.c_str(), n));
         } while (_valid && !match);
@@ -703,12 +1292,12 @@ protected:
         nameLen += strlen(_dirent.name);
         char tmpName[nameLen];
         snprintf(tmpName, nameLen, "%s%s%s", _dirPath.get() ? _dirPath.get() : "", _dirPath.get()&&_dirPath.get()[0]?"/":"", _dirent.name);
-        int rc = lfs_getattr(_fs->getFS(), tmpName, attr, dest, len);
+        int rc = Lfs::getattr(_fs->getFS(), tmpName, attr, dest, len);
         return (rc == len);
     }
 
     String                      _pattern;
-    LittleFSImpl               *_fs;
+    LittleFSImplT<Hooks>       *_fs;
     std::shared_ptr<lfs_dir_t>  _dir;
     std::shared_ptr<char>       _dirPath;
     lfs_info                    _dirent;
@@ -716,6 +1305,135 @@ protected:
     bool                        _opened;
 };
 
+template <typename Hooks>
+FileImplPtr LittleFSImplT<Hooks>::open(const char* path, OpenMode openMode, AccessMode accessMode) {
+    if (!_mounted) {
+        //DEBUGV("LittleFSImpl::open() called on unmounted FS\n");
+        return FileImplPtr();
+    }
+    if (!path || !path[0]) {
+        //DEBUGV("LittleFSImpl::open() called with invalid filename\n");
+        return FileImplPtr();
+    }
+    if (!pathValid(path)) {
+        //DEBUGV("LittleFSImpl::open() called with too long filename\n");
+        return FileImplPtr();
+    }
+    ChromeTrace::Span span("FileImpl", "open", path); //Mock
+    int flags = _getFlags(openMode, accessMode);
+    auto fd = std::make_shared<lfs_file_t>();
+
+    if (openMode & OM_CREATE) {
+        _makeParents(path); //Mock - shared with writeFiles()
+    }
+
+    time_t creation = 0;
+    if (_timeCallback && (openMode & OM_CREATE)) {
+        // O_CREATE means we *may* make the file, but not if it already exists.
+        // See if it exists, and only if not update the creation time
+        int rc = Lfs::file_open(&_lfs, fd.get(), path, LFS_O_RDONLY);
+	if (rc == 0) {
+            Lfs::file_close(&_lfs, fd.get()); // It exists, don't update create time
+        } else {
+            creation = _timeCallback();  // File didn't exist or otherwise, so we're going to create this time
+        }
+    }
+
+    int rc = Lfs::file_open(&_lfs, fd.get(), path, flags);
+    span.result(rc); //Mock
+    if (rc == LFS_ERR_ISDIR) {
+        // To support the SD.openNextFile, a null FD indicates to the LittleFSFile this is just
+        // a directory whose name we are carrying around but which cannot be read or written
+        return std::make_shared<LittleFSFileImplT<Hooks>>(this, path, nullptr, flags, creation);
+    } else if (rc == 0) {
+        return std::make_shared<LittleFSFileImplT<Hooks>>(this, path, fd, flags, creation);
+    } else {
+        //DEBUGV("LittleFSDirImpl::openFile: rc=%d fd=%p path=`%s` openMode=%d accessMode=%d err=%d\n",
+        //    rc, fd.get(), path, openMode, accessMode, rc);
+        return FileImplPtr();
+    }
+}
+
+template <typename Hooks>
+DirImplPtr LittleFSImplT<Hooks>::openDir(const char *path) {
+    if (!_mounted || !path) {
+        return DirImplPtr();
+    }
+    //Mock
+    //char *pathStr = strdup(path); // Allow edits on our scratch copy
+    char *pathStr = strdup(path); // Allow edits on our scratch copy
+
+    // Get rid of any trailing slashes
+    //while (strlen(pathStr) && (pathStr[strlen(pathStr)-1]=='/')) {
+    //    pathStr[strlen(pathStr)-1] = 0;
+    //}
+    size_t len = strlen(pathStr);
+    while (len && (pathStr[len-1]=='/')) {
+        pathStr[--len] = 0;
+    }
+    // At this point we have a name of "blah/blah/blah" or "blah" or ""
+    // If that references a directory, just open it and we're done.
+    auto dir = std::make_shared<lfs_dir_t>();
+    int rc;
+    const char *filter = "";
+    if (!pathStr[0]) {
+        // openDir("") === openDir("/") ==> not possible for Mock
+        rc = Lfs::dir_open(&_lfs, dir.get(), "/");
+        filter = "";
+    } else {
+        //Mock - open it as a directory right away instead of a lfs_stat() first,
+        // which looked the path up twice
+        rc = Lfs::dir_open(&_lfs, dir.get(), pathStr);
+        bool file = rc == LFS_ERR_NOTDIR;
+        if (file) {
+            //Mock - a file is the only entry, the parent dir isn't read
+            rc = Lfs::dir_open_file(&_lfs, dir.get(), pathStr);
+        }
+        if (file || (rc == LFS_ERR_NOENT)) {
+            // A file, or the name doesn't exist, so use the parent dir of whatever was sent in
+            char *ptr = strrchr(pathStr, '/');
+            if (!ptr) {
+                // No slashes, open the root dir ==> not possible for Mock
+                if (!file) {
+                    rc = Lfs::dir_open(&_lfs, dir.get(), "/");
+                }
+                filter = pathStr;
+            } else {
+                // We've got slashes, open the dir one up
+                *ptr = 0; // Remove slash, truncate string
+                if (!file) {
+                    rc = Lfs::dir_open(&_lfs, dir.get(), pathStr);
+                }
+                filter = ptr + 1;
+            }
+        }
+    }
+    if (rc < 0) {
+        //DEBUGV("LittleFSImpl::openDir: path=`%s` err=%d\n", path, rc);
+        free(pathStr);
+        return DirImplPtr();
+    }
+    // Skip the . and .. entries
+    lfs_info dirent;
+    Lfs::dir_read(&_lfs, dir.get(), &dirent);
+    Lfs::dir_read(&_lfs, dir.get(), &dirent);
+
+    //Mock - provide the original path (without test-dir prefix) to the instance
+    //auto ret = std::make_shared<LittleFSDirImpl>(filter, this, dir, pathStr);
+    auto ret = std::make_shared<LittleFSDirImplT<Hooks>>(filter, this, dir, pathStr);
+    free(pathStr);
+    return ret;
+}
+
+// compiled once, in LittleFS.cpp
+extern template class LittleFSImplT<NullHooks>;
+extern template class LittleFSFileImplT<NullHooks>;
+extern template class LittleFSDirImplT<NullHooks>;
+
+using LittleFSImpl = LittleFSImplT<>;
+using LittleFSFileImpl = LittleFSFileImplT<NullHooks>;
+using LittleFSDirImpl = LittleFSDirImplT<NullHooks>;
+
 };
 
 #if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_LITTLEFS)
@@ -0,0 +1,158 @@
+/*
+ LittleFSTrace.h - binary trace of the lfs layer of the LittleFS mock
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LITTLEFS_TRACE_H
+#define __LITTLEFS_TRACE_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdio.h>
+#include "lfs.h"
+#include "FS.h"
+
+namespace littlefs_impl {
+
+/*
+ * Trace file
+ *
+ * Little endian, the header "LFSTRACE" and the u32 version are followed by
+ *   'S' u32 id, u16 length, bytes       a path, before the first event using it
+ *   'E' u8 op, u32 path, u32 target, u64 offset, u64 length, u32 flags,
+ *       i64 result, u64 time_ns, u64 duration_ns
+ * Paths are ids into the string table, 0 is "". time_ns counts from the
+ * start of the recording. The fields follow lfs_trace_event.
+ */
+static constexpr char TRACE_MAGIC[8] = { 'L', 'F', 'S', 'T', 'R', 'A', 'C', 'E' };
+static constexpr uint32_t TRACE_VERSION = 1;
+
+struct TraceEvent {
+    lfs_op   op;
+    uint32_t path;
+    uint32_t target;
+    uint64_t offset;
+    uint64_t length;
+    uint32_t flags;
+    int64_t  result;
+    uint64_t timeNs;
+    uint64_t durationNs;
+};
+
+// Records lfs_* calls into a trace file, record() is called from the trace
+// callback of the littlefs object
+//
+// The calls only copy their event into a lock-free ring buffer, a background
+// thread interns the paths and writes the file. When the ring is full the
+// calls wait for the thread.
+class TraceRecorder
+{
+public:
+    static constexpr size_t SLOTS = 1024;
+
+    TraceRecorder();
+    ~TraceRecorder();
+
+    bool start(const char* path);
+    // After the last record()
+    bool stop();
+    void record(const lfs_trace_event* event);
+
+    uint64_t events() const { return _events; }
+    uint64_t stalls() const { return _stalls.load(std::memory_order_relaxed); }
+
+protected:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        lfs_trace_event event;
+        // paths in littlefs, below the test dir of at most LFS_MOCK_PATH_MAX
+        char path[LFS_MOCK_PATH_MAX];
+        char target[LFS_MOCK_PATH_MAX];
+    };
+
+    size_t _drain();
+    void _run();
+    uint32_t _intern(const char* path);
+    void _write(const void* data, size_t size);
+
+    FILE*                   _file = nullptr;
+    std::vector<Slot>       _slots;
+    std::atomic<size_t>     _enqueue;
+    size_t                  _dequeue = 0;
+    std::atomic<bool>       _stopping;
+    std::atomic<uint64_t>   _stalls;
+    std::thread             _flusher;
+    uint64_t                _startNs = 0;
+    uint64_t                _events = 0;
+    bool                    _failed = false;
+    std::unordered_map<std::string, uint32_t> _paths;
+};
+
+// Reads a trace file written by TraceRecorder
+class TraceReader
+{
+public:
+    ~TraceReader() { close(); }
+
+    bool open(const char* path);
+    void close();
+
+    // Next event, false at the end or on a corrupt file
+    bool next(TraceEvent& event);
+    const char* path(uint32_t id) const;
+
+protected:
+    bool _read(void* data, size_t size);
+
+    FILE*                    _file = nullptr;
+    std::vector<std::string> _paths;
+};
+
+// Runs the lfs_* calls of a trace file again on a mounted littlefs object
+//
+// The trace is read up front, so that only the calls are timed. Files and
+// directories are found by their path, the data written is zeros. The
+// files and folders the trace starts with should exist, like when it was
+// recorded, else the calls using them are mismatches.
+class TraceReplay
+{
+public:
+    ~TraceReplay() { _closeAll(); }
+
+    bool run(lfs_t* lfs, const char* path, const fs::FSReplayOptions& options, fs::FSReplayReport& report);
+
+protected:
+    int64_t _call(const TraceEvent& event);
+    lfs_file_t* _file(uint32_t path);
+    void _closeAll();
+
+    lfs_t*                  _lfs = nullptr;
+    TraceReader             _reader;
+    std::vector<TraceEvent> _events;
+    std::vector<uint8_t>    _buffer;
+    std::vector<uint8_t>    _zeros;
+    std::unordered_map<uint32_t, std::vector<std::unique_ptr<lfs_file_t>>> _files;
+    std::unordered_map<uint32_t, std::unique_ptr<lfs_dir_t>> _dirs;
+    lfs_dir_t*              _lastDir = nullptr;
+};
+
+} // namespace littlefs_impl
+
+#endif // __LITTLEFS_TRACE_H
@@ -13,6 +13,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <dirent.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 
 #ifdef __cplusplus
 extern "C"
@@ -40,11 +43,12 @@ extern "C"
 /// Definitions ///
 
 // Type definitions
+// Mock - offsets are 64-bit to replay large captures on the host
 typedef uint32_t lfs_size_t;
-typedef uint32_t lfs_off_t;
+typedef uint64_t lfs_off_t;
 
 typedef int32_t  lfs_ssize_t;
-typedef int32_t  lfs_soff_t;
+typedef int64_t  lfs_soff_t;
 
 typedef uint32_t lfs_block_t;
 
@@ -60,8 +64,9 @@ typedef uint32_t lfs_block_t;
 // functions lfs_file_seek, lfs_file_size, and lfs_file_tell will return
 // incorrect values due to using signed integers. Stored in superblock and
 // must be respected by other littlefs drivers.
+// Mock - the host files are only limited by the 64-bit lfs_soff_t.
 #ifndef LFS_FILE_MAX
-#define LFS_FILE_MAX 2147483647
+#define LFS_FILE_MAX 9223372036854775807
 #endif
 
 // Maximum size of custom attributes in bytes, may be redefined, but there is
@@ -70,6 +75,9 @@ typedef uint32_t lfs_block_t;
 #define LFS_ATTR_MAX 1022
 #endif
 
+// Mock - maximum length of a host path, the test dir and the path in littlefs
+#define LFS_MOCK_PATH_MAX 512
+
 // Possible error codes, these are negative to allow
 // valid positive return values
 enum lfs_error {
@@ -142,6 +150,14 @@ enum lfs_open_flags {
     LFS_F_INLINE  = 0x100000, // Currently inlined in directory entry
 };
 
+// Mock - how far lfs_file_sync and lfs_file_close push written data
+enum lfs_durability {
+    LFS_DURABILITY_FLUSH     = 0, // Flush the stdio buffers to the host OS
+    LFS_DURABILITY_NONE      = 1, // Leave data in the stdio buffers until close
+    LFS_DURABILITY_FDATASYNC = 2, // Flush and wait until the data is on the host storage
+    LFS_DURABILITY_FSYNC     = 3, // Flush and wait until data and metadata are on the host storage
+};
+
 // File seek flags
 enum lfs_whence_flags {
     LFS_SEEK_SET = 0,   // Seek relative to an absolute position
@@ -251,7 +267,8 @@ struct lfs_info {
     uint8_t type;
 
     // Size of the file, only valid for REG files. Limited to 32-bits.
-    lfs_size_t size;
+    // Mock - 64-bits, see lfs_off_t
+    lfs_off_t size;
 
     // Name of the file stored as a null-terminated string. Limited to
     // LFS_NAME_MAX+1, which can be changed by redefining LFS_NAME_MAX to
@@ -327,9 +344,13 @@ typedef struct lfs_dir {
     lfs_off_t pos;
     lfs_block_t head[2];
 
-    // Mock
-    DIR* pDir;
-    char path[260];
+    // Mock - entries sorted by name, read at lfs_dir_open
+    char **names;       // Into buffer
+    char *buffer;
+    lfs_size_t count;
+    DIR *host;          // Open until lfs_dir_close, the entries are looked up in it
+    bool file;          // Of lfs_dir_open_file, path is the host path of the entry
+    char path[LFS_MOCK_PATH_MAX];
 } lfs_dir_t;
 
 // littlefs file type
@@ -346,6 +367,7 @@ typedef struct lfs_file {
 
     uint32_t flags;
     lfs_off_t pos;
+    // Mock - block is the index + 1 of the block currently programmed, 0 if none
     lfs_block_t block;
     lfs_off_t off;
     lfs_cache_t cache;
@@ -354,6 +376,10 @@ typedef struct lfs_file {
 
     // Mock
     FILE* pFile;
+    lfs_block_t wear_block;   // Block being programmed, indexes lfs_wear.erases/progs
+    lfs_off_t size;           // Size of the file while limited, see lfs_fs_limit
+    char path[LFS_MOCK_PATH_MAX];     // Host path of the file
+    char shadow[LFS_MOCK_PATH_MAX];   // Host file of pFile until the commit, "" if none
 } lfs_file_t;
 
 typedef struct lfs_superblock {
@@ -370,6 +396,143 @@ typedef struct lfs_gstate {
     lfs_block_t pair[2];
 } lfs_gstate_t;
 
+// Mock - virtual flash timing
+//
+// Costs of the flash accesses littlefs would make on the device, accumulated
+// on a virtual clock. All costs 0 only counts the accesses.
+struct lfs_timing {
+    uint32_t read_ns;   // Cost of reading read_size bytes
+    uint32_t prog_ns;   // Cost of programming prog_size bytes
+    uint32_t erase_ns;  // Cost of erasing one block
+
+    uint64_t clock_ns;  // Virtual clock, device time since the last reset
+    uint64_t last_ns;   // Device time of the last lfs_* call accessing the flash
+    uint64_t reads;
+    uint64_t progs;
+    uint64_t erases;
+};
+
+// Mock - wear of the virtual flash
+//
+// Erases and programs per block. The accesses are mapped to blocks like
+// littlefs does: data goes to the next free block of a linear allocator,
+// metadata to a block pair which is relocated after block_cycles erases.
+struct lfs_wear {
+    uint32_t *erases;           // Per block, NULL while not tracking
+    uint32_t *progs;            // Per block
+    lfs_block_t count;          // Number of blocks tracked
+    lfs_block_t next;           // Next block of the allocator
+    lfs_block_t meta[2];        // Metadata pair
+    uint8_t meta_cur;           // Block of the pair currently committed to
+    uint32_t meta_erases;       // Erases of the pair since its relocation
+};
+
+// Mock - statistics of the lfs_* calls
+//
+// Counted for every call, the latency is the time on the host. The
+// histogram has 1 << LFS_STATS_SUB_BITS linear buckets per power of 2 of
+// the latency in ns, the first ones hold the values below that. The ops
+// from LFS_OP_TELL on are only seen by the Hooks of LittleFSImplT, they are
+// neither counted nor traced.
+enum lfs_op {
+    LFS_OP_OPEN,
+    LFS_OP_CLOSE,
+    LFS_OP_READ,
+    LFS_OP_WRITE,
+    LFS_OP_SEEK,
+    LFS_OP_SYNC,
+    LFS_OP_TRUNCATE,
+    LFS_OP_STAT,
+    LFS_OP_DIR_OPEN,
+    LFS_OP_DIR_READ,
+    LFS_OP_MKDIR,
+    LFS_OP_REMOVE,
+    LFS_OP_RENAME,
+    LFS_OP_TELL,
+    LFS_OP_SIZE,
+    LFS_OP_RESERVE,
+    LFS_OP_DIR_CLOSE,
+    LFS_OP_DIR_REWIND,
+    LFS_OP_GETATTR,
+    LFS_OP_SETATTR,
+    LFS_OP_FS_SIZE,
+    LFS_OP_MOUNT,
+    LFS_OP_FORMAT,
+    LFS_OP_UNMOUNT,
+    LFS_OP_COUNT
+};
+
+#define LFS_STATS_SUB_BITS 3
+#define LFS_STATS_BUCKETS 320
+
+struct lfs_op_stats {
+    uint64_t count;
+    uint64_t errors;        // Calls returning an error
+    uint64_t bytes;         // Read or written
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t histogram[LFS_STATS_BUCKETS];
+};
+
+// Mock - one lfs_* call of enum lfs_op, see lfs_trace
+struct lfs_trace_event {
+    enum lfs_op op;
+    const char *path;       // Path in littlefs, "" for none
+    const char *target;     // Rename: new path, NULL for the others
+    uint64_t offset;        // Read, write: position before, seek: offset
+    uint64_t length;        // Read, write: requested bytes, truncate: size
+    uint32_t flags;         // Open: flags, seek: whence, dir open: 1 for lfs_dir_open_file
+    int64_t result;
+    uint64_t start_ns;      // lfs_clock_ns at the call
+    uint64_t duration_ns;
+};
+
+typedef void (*lfs_trace_t)(void *context, const struct lfs_trace_event *event);
+
+// Mock - power loss simulation, see lfs_powerloss_begin
+#define LFS_POWERLOSS_NEVER UINT64_MAX
+
+struct lfs_powerloss_entry;
+struct lfs_powerloss {
+    bool active;                        // Changes are recorded
+    bool lost;                          // Power cut, changes fail with LFS_ERR_IO
+    uint64_t ops;                       // Programs and erases since lfs_powerloss_begin
+    uint64_t cut;                       // Programs and erases before the power is cut
+    struct lfs_powerloss_entry *log;    // Undo log of the committed changes
+    size_t count;
+    size_t capacity;
+    uint32_t saved;                     // Files moved to dir so far, names them
+    char dir[LFS_MOCK_PATH_MAX];        // Saved files and shadows, next to the test dir
+};
+
+// Mock - last write times 't' set while mounted, see lfs_setattr
+struct lfs_stamp;
+struct lfs_stamps {
+    struct lfs_stamp **buckets;         // Chained by the hash of the host path
+    size_t capacity;                    // Number of buckets, a power of 2
+    size_t count;
+};
+
+// Mock - one file of lfs_files_read and lfs_files_write
+struct lfs_batch_file {
+    const char *path;       // Path in littlefs
+    void *buffer;           // Read: the content, allocated by the batch, write: the data
+    lfs_size_t size;        // Read: size of the content, write: bytes to write
+    int result;             // 0 or a negative error code
+};
+
+// Mock - the buffer for the content of a file read by lfs_files_read
+typedef void *(*lfs_batch_alloc_t)(void *context, struct lfs_batch_file *file, lfs_size_t size);
+
+struct lfs_uring;
+
+// Mock - the reader/writer lock of a littlefs object, see lfs_mount
+#if defined(_WIN32)
+typedef struct { void *ptr; } lfs_rwlock_t;    // SRWLOCK
+#else
+typedef pthread_rwlock_t lfs_rwlock_t;
+#endif
+
 // The littlefs filesystem type
 typedef struct lfs {
     lfs_cache_t rcache;
@@ -407,12 +570,87 @@ typedef struct lfs {
 
     //Mock
     char test_dir[256];
+    enum lfs_durability durability;
+    struct lfs_timing timing;
+    struct lfs_wear wear;
+    lfs_size_t meta_off;    // Bytes committed to the current metadata block
+    bool limited;           // Files limited to block_count, see lfs_fs_limit
+    uint64_t used;          // Blocks used by the files while limited
+    struct lfs_powerloss powerloss;
+    struct lfs_stamps stamps;
+    struct lfs_op_stats stats[LFS_OP_COUNT];
+    lfs_trace_t trace;
+    void *trace_context;
+    lfs_rwlock_t lock;
+    bool lock_ready;
+    struct lfs_uring *uring;    // Ring of the batches while idle, see lfs_files_read
+    bool uring_off;             // Batches run as plain calls
 } lfs_t;
 
 /// Mock functions ///
+
 // Provides the relative path in the real file system
-// Requires a littlefs object and the path in the lfs system
-const char* patch_path(lfs_t *lfs, const char* path);
+// Requires a littlefs object, the path in the lfs system and a buffer of
+// LFS_MOCK_PATH_MAX chars, returns the buffer or path when already patched,
+// NULL when the host path would be too long, LFS_ERR_NAMETOOLONG for the caller
+const char* patch_path(lfs_t *lfs, const char* path, char *buffer);
+
+// Mock - start or stop tracking the wear of the virtual flash
+//
+// Starting allocates the counters for the block_count of the config the
+// littlefs object was mounted with, and clears them. Stopping frees them.
+// Returns a negative error code on failure.
+int lfs_wear_track(lfs_t *lfs, bool enable);
+
+// Mock - the host monotonic clock of the statistics and traces
+uint64_t lfs_clock_ns(void);
+
+// Mock - call trace with every lfs_* call of enum lfs_op, NULL to stop
+//
+// Called on the thread of the call after it returned, the event and its
+// path are only valid during the callback.
+void lfs_trace(lfs_t *lfs, lfs_trace_t trace, void *context);
+
+// Mock - simulate a power loss after cut programs and erases
+//
+// Takes a copy-on-write snapshot of the test dir: files which are replaced
+// or removed are moved aside and changes are logged, nothing is copied.
+// Like on littlefs each change becomes visible with its metadata commit,
+// written data only with the commit of lfs_file_sync or lfs_file_close,
+// until then a file open for writing is backed by a shadow file. Once the
+// power is cut, the change in progress and all later ones fail with
+// LFS_ERR_IO and uncommitted data is lost. LFS_POWERLOSS_NEVER only records.
+// Returns a negative error code on failure.
+int lfs_powerloss_begin(lfs_t *lfs, uint64_t cut);
+
+// Mock - power the device again, changes are still recorded
+void lfs_powerloss_resume(lfs_t *lfs);
+
+// Mock - roll the test dir back to the snapshot of lfs_powerloss_begin
+// Returns a negative error code on failure.
+int lfs_powerloss_end(lfs_t *lfs);
+
+// Mock - read whole files in one batch
+//
+// Each file is opened, sized, read into a buffer from alloc, NULL for
+// malloc(), and closed. On Linux io_uring runs each of these steps for all
+// files with one system call, elsewhere they are plain calls. Each file
+// is counted as an open, a read and a close, and gets its own result.
+// Returns 0 when all files were read, else the error of the first failed.
+int lfs_files_read(lfs_t *lfs, struct lfs_batch_file *files, size_t count,
+        lfs_batch_alloc_t alloc, void *context);
+
+// Mock - write whole files in one batch, creating or replacing them
+//
+// Like lfs_files_read, the data is synced as far as lfs_t.durability asks.
+// While limited or simulating a power loss the files are written with
+// plain calls, which check the capacity and take part in the snapshot.
+// Returns 0 when all files were written, else the error of the first failed.
+int lfs_files_write(lfs_t *lfs, struct lfs_batch_file *files, size_t count);
+
+// Mock - run the batches on io_uring, the default where the host has it
+// Returns whether they do from now on.
+bool lfs_batch_uring(lfs_t *lfs, bool enable);
 
 /// Filesystem functions ///
 
@@ -532,6 +770,7 @@ int lfs_file_close(lfs_t *lfs, lfs_file_t *file);
 // Synchronize a file on storage
 //
 // Any pending writes are written out to storage.
+// Mock - how far is controlled by lfs_t.durability.
 // Returns a negative error code on failure.
 int lfs_file_sync(lfs_t *lfs, lfs_file_t *file);
 
@@ -581,6 +820,14 @@ int lfs_file_rewind(lfs_t *lfs, lfs_file_t *file);
 // Returns the size of the file, or a negative error code on failure.
 lfs_soff_t lfs_file_size(lfs_t *lfs, lfs_file_t *file);
 
+// Mock - preallocate storage for the file
+//
+// Allocates the host storage for the first size bytes of the file without
+// changing the size of the file. Hosts without preallocation ignore the
+// request.
+// Returns a negative error code on failure.
+int lfs_file_reserve(lfs_t *lfs, lfs_file_t *file, lfs_off_t size);
+
 
 /// Directory operations ///
 
@@ -595,6 +842,12 @@ int lfs_mkdir(lfs_t *lfs, const char *path);
 // Returns a negative error code on failure.
 int lfs_dir_open(lfs_t *lfs, lfs_dir_t *dir, const char *path);
 
+// Mock - open the file at path as a directory with that file as its only entry
+//
+// Like the parent directory filtered by the name, without reading the parent.
+// Returns a negative error code on failure.
+int lfs_dir_open_file(lfs_t *lfs, lfs_dir_t *dir, const char *path);
+
 // Close a directory
 //
 // Releases any allocated resources.
@@ -638,7 +891,19 @@ int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir);
 // size may be larger than the filesystem actually is.
 //
 // Returns the number of allocated blocks, or a negative error code on failure.
-lfs_ssize_t lfs_fs_size(lfs_t *lfs);
+// Mock - the blocks of the files in the test dir, each file rounded up to
+// whole blocks. Walks the test dir, so it picks up changes made outside of
+// littlefs.
+lfs_soff_t lfs_fs_size(lfs_t *lfs);
+
+// Mock - limit the files to the block_count of the config
+//
+// Creating, writing and growing files then fail with LFS_ERR_NOSPC once
+// the blocks are used up, writes which fit partially are short. The check
+// uses a usage counter kept up to date by every change, it is initialized
+// by walking the test dir here, on mount and by lfs_fs_size.
+// Returns a negative error code on failure.
+int lfs_fs_limit(lfs_t *lfs, bool enable);
 
 // Traverse through all blocks in use by the filesystem
 //
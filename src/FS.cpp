@@ -21,6 +21,11 @@
  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <stdio.h>
 #include "FS.h"
 #include "FSImpl.h"
 
@@ -29,6 +34,7 @@ using namespace fs;
 static bool sflags(const char* mode, OpenMode& om, AccessMode& am);
 
 size_t File::write(uint8_t c) {
+    FSAlloc::Scope scope("File::write");
     if (!_p)
         return 0;
 
@@ -36,20 +42,30 @@ size_t File::write(uint8_t c) {
 }
 
 size_t File::write(const uint8_t *buf, size_t size) {
+    FSAlloc::Scope scope("File::write");
     if (!_p)
         return 0;
 
-    return _p->write(buf, size);
+    ChromeTrace::Span span("File", "write", _p->fullName(), size);
+    size_t result = _p->write(buf, size);
+    span.result(result);
+    return result;
 }
 
 int File::available() {
+    FSAlloc::Scope scope("File::available");
     if (!_p)
         return false;
 
-    return _p->size() - _p->position();
+    uint64_t size = _p->size64();
+    uint64_t position = _p->position64();
+    if (position >= size)
+        return 0;
+    return std::min<uint64_t>(size - position, std::numeric_limits<int>::max());
 }
 
 int File::read() {
+    FSAlloc::Scope scope("File::read");
     if (!_p)
         return -1;
 
@@ -62,30 +78,48 @@ int File::read() {
 }
 
 size_t File::read(uint8_t* buf, size_t size) {
+    FSAlloc::Scope scope("File::read");
     if (!_p)
         return 0;
 
-    return _p->read(buf, size);
+    ChromeTrace::Span span("File", "read", _p->fullName(), size);
+    size_t result = _p->read(buf, size);
+    span.result(result);
+    return result;
 }
 
 int File::peek() {
+    FSAlloc::Scope scope("File::peek");
     if (!_p)
         return -1;
 
-    size_t curPos = _p->position();
+    uint64_t curPos = _p->position64();
     int result = read();
-    seek(curPos, SeekSet);
+    seek64(curPos, SeekSet);
     return result;
 }
 
 void File::flush() {
+    FSAlloc::Scope scope("File::flush");
     if (!_p)
         return;
 
+    ChromeTrace::Span span("File", "flush", _p->fullName());
     _p->flush();
 }
 
 bool File::seek(uint32_t pos, SeekMode mode) {
+    FSAlloc::Scope scope("File::seek");
+    if (!_p)
+        return false;
+
+    // relative offsets are signed, e.g. seek(-3, SeekCur)
+    int64_t offset = (mode == SeekSet) ? (int64_t)pos : (int64_t)(int32_t)pos;
+    return _p->seek(offset, mode);
+}
+
+bool File::seek64(int64_t pos, SeekMode mode) {
+    FSAlloc::Scope scope("File::seek64");
     if (!_p)
         return false;
 
@@ -93,6 +127,7 @@ bool File::seek(uint32_t pos, SeekMode mode) {
 }
 
 size_t File::position() const {
+    FSAlloc::Scope scope("File::position");
     if (!_p)
         return 0;
 
@@ -100,14 +135,33 @@ size_t File::position() const {
 }
 
 size_t File::size() const {
+    FSAlloc::Scope scope("File::size");
     if (!_p)
         return 0;
 
     return _p->size();
 }
 
+uint64_t File::position64() const {
+    FSAlloc::Scope scope("File::position64");
+    if (!_p)
+        return 0;
+
+    return _p->position64();
+}
+
+uint64_t File::size64() const {
+    FSAlloc::Scope scope("File::size64");
+    if (!_p)
+        return 0;
+
+    return _p->size64();
+}
+
 void File::close() {
+    FSAlloc::Scope scope("File::close");
     if (_p) {
+        ChromeTrace::Span span("File", "close", _p->fullName());
         _p->close();
         _p = nullptr;
     }
@@ -118,12 +172,57 @@ File::operator bool() const {
 }
 
 bool File::truncate(uint32_t size) {
+    FSAlloc::Scope scope("File::truncate");
+    if (!_p)
+        return false;
+
+    return _p->truncate(size);
+}
+
+bool File::truncate64(uint64_t size) {
+    FSAlloc::Scope scope("File::truncate64");
     if (!_p)
         return false;
 
     return _p->truncate(size);
 }
 
+bool File::reserve(uint64_t size) {
+    FSAlloc::Scope scope("File::reserve");
+    if (!_p)
+        return false;
+
+    return _p->reserve(size);
+}
+
+//Mock - without the threads of an FS the call runs right away
+template <typename T>
+static std::future<T> runAsync(const std::shared_ptr<FSIoPool>& pool, std::function<T()> fn) {
+    if (pool) {
+        return pool->async(std::move(fn));
+    }
+    std::promise<T> result;
+    result.set_value(fn());
+    return result.get_future();
+}
+
+//Mock
+std::future<size_t> File::readAsync(uint8_t* buf, size_t size) {
+    // the copy keeps the file open until the call is done
+    File file = *this;
+    return runAsync<size_t>(_baseFS ? _baseFS->_asyncPool() : nullptr, [file, buf, size]() mutable {
+        return file.read(buf, size);
+    });
+}
+
+//Mock
+std::future<size_t> File::writeAsync(const uint8_t* buf, size_t size) {
+    File file = *this;
+    return runAsync<size_t>(_baseFS ? _baseFS->_asyncPool() : nullptr, [file, buf, size]() mutable {
+        return file.write(buf, size);
+    });
+}
+
 const char* File::name() const {
     if (!_p)
         return nullptr;
@@ -139,6 +238,7 @@ const char* File::fullName() const {
 }
 
 bool File::isFile() const {
+    FSAlloc::Scope scope("File::isFile");
     if (!_p)
         return false;
 
@@ -146,6 +246,7 @@ bool File::isFile() const {
 }
 
 bool File::isDirectory() const {
+    FSAlloc::Scope scope("File::isDirectory");
     if (!_p)
         return false;
 
@@ -153,6 +254,7 @@ bool File::isDirectory() const {
 }
 
 void File::rewindDirectory() {
+    FSAlloc::Scope scope("File::rewindDirectory");
     if (!_fakeDir) {
         _fakeDir = std::make_shared<Dir>(_baseFS->openDir(fullName()));
     } else {
@@ -161,6 +263,7 @@ void File::rewindDirectory() {
 }
 
 File File::openNextFile() {
+    FSAlloc::Scope scope("File::openNextFile");
     if (!_fakeDir) {
         _fakeDir = std::make_shared<Dir>(_baseFS->openDir(fullName()));
     }
@@ -184,6 +287,7 @@ String File::readString()
 }
 
 time_t File::getLastWrite() {
+    FSAlloc::Scope scope("File::getLastWrite");
     if (!_p)
         return 0;
 
@@ -191,6 +295,7 @@ time_t File::getLastWrite() {
 }
 
 time_t File::getCreationTime() {
+    FSAlloc::Scope scope("File::getCreationTime");
     if (!_p)
         return 0;
 
@@ -205,6 +310,7 @@ void File::setTimeCallback(time_t (*cb)(void)) {
 }
 
 File Dir::openFile(const char* mode) {
+    FSAlloc::Scope scope("Dir::openFile");
     if (!_impl) {
         return File();
     }
@@ -222,6 +328,7 @@ File Dir::openFile(const char* mode) {
 }
 
 String Dir::fileName() {
+    FSAlloc::Scope scope("Dir::fileName");
     if (!_impl) {
         return String();
     }
@@ -230,18 +337,21 @@ String Dir::fileName() {
 }
 
 time_t Dir::fileTime() {
+    FSAlloc::Scope scope("Dir::fileTime");
     if (!_impl)
         return 0;
     return _impl->fileTime();
 }
 
 time_t Dir::fileCreationTime() {
+    FSAlloc::Scope scope("Dir::fileCreationTime");
     if (!_impl)
         return 0;
     return _impl->fileCreationTime();
 }
 
 size_t Dir::fileSize() {
+    FSAlloc::Scope scope("Dir::fileSize");
     if (!_impl) {
         return 0;
     }
@@ -250,6 +360,7 @@ size_t Dir::fileSize() {
 }
 
 bool Dir::isFile() const {
+    FSAlloc::Scope scope("Dir::isFile");
     if (!_impl)
         return false;
 
@@ -257,6 +368,7 @@ bool Dir::isFile() const {
 }
 
 bool Dir::isDirectory() const {
+    FSAlloc::Scope scope("Dir::isDirectory");
     if (!_impl)
         return false;
 
@@ -264,6 +376,7 @@ bool Dir::isDirectory() const {
 }
 
 bool Dir::next() {
+    FSAlloc::Scope scope("Dir::next");
     if (!_impl) {
         return false;
     }
@@ -272,6 +385,7 @@ bool Dir::next() {
 }
 
 bool Dir::rewind() {
+    FSAlloc::Scope scope("Dir::rewind");
     if (!_impl) {
         return false;
     }
@@ -286,6 +400,109 @@ void Dir::setTimeCallback(time_t (*cb)(void)) {
     _timeCallback = cb;
 }
 
+std::atomic<time_t> VirtualClock::_now(VirtualClock::START);
+std::atomic<time_t> VirtualClock::_step(0);
+
+time_t VirtualClock::now() {
+    return _now.fetch_add(_step.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+bool VirtualClock::set(time_t t) {
+    time_t current = _now.load(std::memory_order_relaxed);
+    do {
+        if (t < current) {
+            return false;
+        }
+    } while (!_now.compare_exchange_weak(current, t, std::memory_order_relaxed));
+    return true;
+}
+
+void VirtualClock::advance(time_t seconds) {
+    if (seconds > 0) {
+        _now.fetch_add(seconds, std::memory_order_relaxed);
+    }
+}
+
+void VirtualClock::setStep(time_t seconds) {
+    _step.store(seconds > 0 ? seconds : 0, std::memory_order_relaxed);
+}
+
+void VirtualClock::reset() {
+    _now.store(START, std::memory_order_relaxed);
+    _step.store(0, std::memory_order_relaxed);
+}
+
+std::atomic<bool> ChromeTrace::_active(false);
+
+static std::mutex chromeMutex;
+static FILE* chromeFile = nullptr;
+static uint64_t chromeStartNs = 0;
+static uint64_t chromeEvents = 0;
+static std::atomic<uint32_t> chromeThreads(0);
+
+// the array is closed even if the test never stops the trace
+static struct ChromeTraceEnd {
+    ~ChromeTraceEnd() { ChromeTrace::stop(); }
+} chromeTraceEnd;
+
+bool ChromeTrace::start(const char* path) {
+    std::lock_guard<std::mutex> lock(chromeMutex);
+    if (chromeFile || !path || !path[0]) {
+        return false;
+    }
+    chromeFile = fopen(path, "w");
+    if (!chromeFile) {
+        return false;
+    }
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", chromeFile);
+    chromeStartNs = nowNs();
+    chromeEvents = 0;
+    _active.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+bool ChromeTrace::stop() {
+    std::lock_guard<std::mutex> lock(chromeMutex);
+    if (!chromeFile) {
+        return false;
+    }
+    _active.store(false, std::memory_order_relaxed);
+    fputs("\n]}\n", chromeFile);
+    bool ok = !ferror(chromeFile);
+    ok = fclose(chromeFile) == 0 && ok;
+    chromeFile = nullptr;
+    return ok;
+}
+
+uint64_t ChromeTrace::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ChromeTrace::complete(const char* category, const char* name, const char* path,
+                           uint64_t startNs, uint64_t durationNs, int64_t size, int64_t result) {
+    static thread_local uint32_t tid = ++chromeThreads;
+    std::lock_guard<std::mutex> lock(chromeMutex);
+    if (!chromeFile) {
+        return;
+    }
+    // spans begun before the start show at 0
+    uint64_t ts = startNs > chromeStartNs ? startNs - chromeStartNs : 0;
+    fprintf(chromeFile, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":1,\"tid\":%u,\"args\":{\"path\":\"", chromeEvents++ ? ",\n" : "", name, category,
+            ts / 1e3, durationNs / 1e3, tid);
+    for (const char* c = path ? path : ""; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', chromeFile);
+            fputc(*c, chromeFile);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(chromeFile, "\\u%04x", *c);
+        } else {
+            fputc(*c, chromeFile);
+        }
+    }
+    fprintf(chromeFile, "\",\"size\":%lld,\"result\":%lld}}", (long long)size, (long long)result);
+}
 
 bool FS::setConfig(const FSConfig &cfg) {
     if (!_impl) {
@@ -296,6 +513,7 @@ bool FS::setConfig(const FSConfig &cfg) {
 }
 
 bool FS::begin(int argc, char **argv) {
+    FSAlloc::Scope scope("FS::begin");
     if (!_impl) {
         //DEBUGV("#error: FS: no implementation");
         return false;
@@ -307,12 +525,22 @@ bool FS::begin(int argc, char **argv) {
 }
 
 void FS::end() {
+    FSAlloc::Scope scope("FS::end");
+    //Mock - the async calls submitted so far finish first. Calls in flight
+    // may hold the pool too, so it stops here rather than on the thread
+    // letting go of it last, which could be one of its own.
+    std::shared_ptr<FSIoPool> pool = std::atomic_load(&_pool);
+    if (pool) {
+        pool->stop();
+        std::atomic_store(&_pool, std::shared_ptr<FSIoPool>());
+    }
     if (_impl) {
         _impl->end();
     }
 }
 
 bool FS::gc() {
+    FSAlloc::Scope scope("FS::gc");
     if (!_impl) {
         return false;
     }
@@ -320,6 +548,7 @@ bool FS::gc() {
 }
 
 bool FS::check() {
+    FSAlloc::Scope scope("FS::check");
     if (!_impl) {
         return false;
     }
@@ -327,6 +556,7 @@ bool FS::check() {
 }
 
 bool FS::format() {
+    FSAlloc::Scope scope("FS::format");
     if (!_impl) {
         return false;
     }
@@ -341,6 +571,21 @@ bool FS::mockSetInfo(FSInfo& info){
     return true;
 }
 
+bool FS::mockSetInfo64(FSInfo64& info){
+    if (!_impl) {
+        return false;
+    }
+    _impl->mockSetInfo64(info);
+    return true;
+}
+
+bool FS::mockLimitCapacity(bool enable) {
+    if (!_impl) {
+        return false;
+    }
+    return _impl->mockLimitCapacity(enable);
+}
+
 bool FS::info(FSInfo& info){
     if (!_impl) {
         return false;
@@ -355,11 +600,228 @@ bool FS::info64(FSInfo64& info){
     return _impl->info64(info);
 }
 
+bool FS::mockSetTimingModel(const FSTimingModel& model) {
+    if (!_impl) {
+        return false;
+    }
+    return _impl->mockSetTimingModel(model);
+}
+
+bool FS::mockTiming(FSTiming& timing) {
+    if (!_impl) {
+        return false;
+    }
+    return _impl->mockTiming(timing);
+}
+
+void FS::mockResetTiming() {
+    if (_impl) {
+        _impl->mockResetTiming();
+    }
+}
+
+bool FS::mockTrackWear(bool enable) {
+    if (!_impl) {
+        return false;
+    }
+    return _impl->mockTrackWear(enable);
+}
+
+bool FS::mockWearReport(FSWearReport& report, uint32_t endurance) {
+    if (!_impl) {
+        return false;
+    }
+    return _impl->mockWearReport(report, endurance);
+}
+
+bool FS::stats(FSStats& stats) {
+    if (!_impl) {
+        return false;
+    }
+    return _impl->stats(stats);
+}
+
+void FS::resetStats() {
+    if (_impl) {
+        _impl->resetStats();
+    }
+}
+
+bool FS::mockStartTrace(const char* path) {
+    if (!_impl) {
+        return false;
+    }
+    return _impl->mockStartTrace(path);
+}
+
+bool FS::mockStopTrace() {
+    if (!_impl) {
+        return false;
+    }
+    return _impl->mockStopTrace();
+}
+
+bool FS::mockReplay(const char* trace, const FSReplayOptions& options, FSReplayReport& report) {
+    if (!_impl) {
+        return false;
+    }
+    return _impl->mockReplay(trace, options, report);
+}
+
+double FSReplayReport::opsPerSecond() const {
+    return elapsedNs ? events * 1e9 / elapsedNs : 0;
+}
+
+double FSReplayReport::bytesPerSecond() const {
+    return elapsedNs ? bytes * 1e9 / elapsedNs : 0;
+}
+
+uint64_t FSOpStats::meanNs() const {
+    return count ? totalNs / count : 0;
+}
+
+uint64_t FSOpStats::percentileNs(double percentile) const {
+    if (!count) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(percentile / 100.0 * count);
+    if (rank >= count) {
+        rank = count - 1;
+    }
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; bucket++) {
+        seen += histogram[bucket];
+        if (seen > rank) {
+            return bucketNs(bucket);
+        }
+    }
+    return maxNs;
+}
+
+uint64_t FSOpStats::bucketNs(size_t bucket) {
+    // the layout of lfs_op_stats.histogram
+    if (bucket < 8) {
+        return bucket;
+    }
+    return (uint64_t)(8 + bucket % 8) << (bucket / 8 - 1);
+}
+
+void FSOpStats::add(uint64_t ns, uint64_t bytes, bool failed) {
+    count++;
+    errors += failed ? 1 : 0;
+    this->bytes += bytes;
+    totalNs += ns;
+    if (ns > maxNs) {
+        maxNs = ns;
+    }
+    histogram[bucket(ns)]++;
+}
+
+size_t FSOpStats::bucket(uint64_t ns) {
+    // as stats_bucket() of lfs.c
+    if (ns < 8) {
+        return (size_t)ns;
+    }
+    unsigned magnitude = 63;
+    while (!(ns >> magnitude)) {
+        magnitude--;
+    }
+    size_t bucket = (size_t)(magnitude - 2) * 8 + ((ns >> (magnitude - 3)) & 7);
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+const char* FSStats::opName(FSOp op) {
+    static const char* const names[FSOpCount] = {
+        "open", "close", "read", "write", "seek", "sync", "truncate",
+        "stat", "dir_open", "dir_read", "mkdir", "remove", "rename",
+        "tell", "size", "reserve", "dir_close", "dir_rewind", "getattr", "setattr",
+        "fs_size", "mount", "format", "unmount"
+    };
+    return op < FSOpCount ? names[op] : "";
+}
+
+bool FS::mockPowerLoss(const std::function<void()>& workload, const std::function<bool()>& check,
+                       FSPowerLossReport& report, uint64_t stride) {
+    if (!_impl) {
+        return false;
+    }
+    return _impl->mockPowerLoss(workload, check, report, stride);
+}
+
+//Mock
+std::shared_ptr<FSIoPool> FS::_asyncPool() {
+    std::shared_ptr<FSIoPool> pool = std::atomic_load(&_pool);
+    if (pool) {
+        return pool;
+    }
+    // first async call, another thread may start the pool at the same time
+    std::shared_ptr<FSIoPool> started = std::make_shared<FSIoPool>(_asyncThreads);
+    if (std::atomic_compare_exchange_strong(&_pool, &pool, started)) {
+        return started;
+    }
+    return pool;
+}
+
+//Mock
+bool FS::setAsyncThreads(unsigned threads) {
+    if (std::atomic_load(&_pool)) {
+        return false;
+    }
+    _asyncThreads = threads;
+    return true;
+}
+
+//Mock
+std::future<File> FS::openAsync(const char* path, const char* mode) {
+    std::string pathStr = path ? path : "";
+    std::string modeStr = mode ? mode : "";
+    return runAsync<File>(_asyncPool(), [this, pathStr, modeStr] {
+        return open(pathStr.c_str(), modeStr.c_str());
+    });
+}
+
+std::future<File> FS::openAsync(const String& path, const char* mode) {
+    return openAsync(path.c_str(), mode);
+}
+
+//Mock
+bool FS::readFiles(std::vector<FSBatchFile>& files) {
+    FSAlloc::Scope scope("FS::readFiles");
+    if (!_impl) {
+        return false;
+    }
+    ChromeTrace::Span span("FS", "readFiles", files.empty() ? "" : files[0].path.c_str());
+    bool ok = _impl->readFiles(files);
+    span.result(ok ? 0 : -1);
+    return ok;
+}
+
+//Mock
+bool FS::writeFiles(std::vector<FSBatchFile>& files) {
+    FSAlloc::Scope scope("FS::writeFiles");
+    if (!_impl) {
+        return false;
+    }
+    ChromeTrace::Span span("FS", "writeFiles", files.empty() ? "" : files[0].path.c_str());
+    bool ok = _impl->writeFiles(files);
+    span.result(ok ? 0 : -1);
+    return ok;
+}
+
+//Mock
+bool FS::mockBatchUring(bool enable) {
+    if (!_impl) {
+        return false;
+    }
+    return _impl->mockBatchUring(enable);
+}
+
 File FS::open(const String& path, const char* mode) {
     return open(path.c_str(), mode);
 }
 
 File FS::open(const char* path, const char* mode) {
+    FSAlloc::Scope scope("FS::open");
     if (!_impl) {
         return File();
     }
@@ -370,12 +832,15 @@ File FS::open(const char* path, const char* mode) {
         //DEBUGV("FS::open: invalid mode `%s`\r\n", mode);
         return File();
     }
+    ChromeTrace::Span span("File", "open", path);
     File f(_impl->open(path, om, am), this);
     f.setTimeCallback(_timeCallback);
+    span.result(f ? 0 : -1);
     return f;
 }
 
 bool FS::exists(const char* path) {
+    FSAlloc::Scope scope("FS::exists");
     if (!_impl) {
         return false;
     }
@@ -387,6 +852,7 @@ bool FS::exists(const String& path) {
 }
 
 Dir FS::openDir(const char* path) {
+    FSAlloc::Scope scope("FS::openDir");
     if (!_impl) {
         return Dir();
     }
@@ -401,6 +867,7 @@ Dir FS::openDir(const String& path) {
 }
 
 bool FS::remove(const char* path) {
+    FSAlloc::Scope scope("FS::remove");
     if (!_impl) {
         return false;
     }
@@ -412,6 +879,7 @@ bool FS::remove(const String& path) {
 }
 
 bool FS::rmdir(const char* path) {
+    FSAlloc::Scope scope("FS::rmdir");
     if (!_impl) {
         return false;
     }
@@ -423,6 +891,7 @@ bool FS::rmdir(const String& path) {
 }
 
 bool FS::mkdir(const char* path) {
+    FSAlloc::Scope scope("FS::mkdir");
     if (!_impl) {
         return false;
     }
@@ -434,6 +903,7 @@ bool FS::mkdir(const String& path) {
 }
 
 bool FS::rename(const char* pathFrom, const char* pathTo) {
+    FSAlloc::Scope scope("FS::rename");
     if (!_impl) {
         return false;
     }
@@ -445,6 +915,7 @@ bool FS::rename(const String& pathFrom, const String& pathTo) {
 }
 
 time_t FS::getCreationTime() {
+    FSAlloc::Scope scope("FS::getCreationTime");
     if (!_impl) {
         return 0;
     }
@@ -0,0 +1,228 @@
+/*
+ FSAlloc.cpp - heap allocations of the public FS calls, see FSAlloc in FS.h
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include "FS.h"
+
+// the sanitizers replace malloc() themselves
+#if defined(FS_TRACK_ALLOC) && defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#define FS_ALLOC_HOOKS
+#include <malloc.h>
+#endif
+
+using namespace fs;
+
+std::atomic<bool> FSAlloc::_active(false);
+
+// Nothing here may allocate, the hooks below run inside malloc()
+
+// The outermost call of the thread
+struct AllocCall {
+    const char* call;
+    uint64_t    allocations;
+    uint64_t    bytes;
+};
+static thread_local AllocCall current;
+
+static std::atomic_flag callsLock = ATOMIC_FLAG_INIT;
+static FSAllocStats calls[FSAlloc::CALLS];
+static std::atomic<int64_t> liveBytes(0);
+static std::atomic<int64_t> baseBytes(0);
+static std::atomic<int64_t> peak(0);
+
+static void lockCalls() {
+    while (callsLock.test_and_set(std::memory_order_acquire)) {
+    }
+}
+
+static void unlockCalls() {
+    callsLock.clear(std::memory_order_release);
+}
+
+#if defined(FS_ALLOC_HOOKS)
+
+static void grow(void* p) {
+    int64_t size = malloc_usable_size(p);
+    int64_t live = liveBytes.fetch_add(size, std::memory_order_relaxed) + size
+        - baseBytes.load(std::memory_order_relaxed);
+    int64_t highest = peak.load(std::memory_order_relaxed);
+    while (live > highest && !peak.compare_exchange_weak(highest, live, std::memory_order_relaxed)) {
+    }
+}
+
+static void allocated(void* p, size_t size) {
+    if (!p || !FSAlloc::active()) {
+        return;
+    }
+    if (current.call) {
+        current.allocations++;
+        current.bytes += size;
+    }
+    grow(p);
+}
+
+static void freed(void* p) {
+    if (p && FSAlloc::active()) {
+        liveBytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+    }
+}
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void  __libc_free(void* p);
+
+// glibc calls these from strdup() and operator new too
+void* malloc(size_t size) {
+    void* p = __libc_malloc(size);
+    allocated(p, size);
+    return p;
+}
+
+void* calloc(size_t count, size_t size) {
+    void* p = __libc_calloc(count, size);
+    allocated(p, count * size);
+    return p;
+}
+
+void* realloc(void* p, size_t size) {
+    freed(p);
+    void* q = __libc_realloc(p, size);
+    if (q) {
+        allocated(q, size);
+    } else if (p && size && FSAlloc::active()) {
+        // failed, p is still there
+        grow(p);
+    }
+    return q;
+}
+
+void* memalign(size_t alignment, size_t size) {
+    void* p = __libc_memalign(alignment, size);
+    allocated(p, size);
+    return p;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** p, size_t alignment, size_t size) {
+    if (!alignment || (alignment & (alignment - 1)) || alignment % sizeof(void*)) {
+        return EINVAL;
+    }
+    *p = memalign(alignment, size);
+    return *p || !size ? 0 : ENOMEM;
+}
+
+void free(void* p) {
+    freed(p);
+    __libc_free(p);
+}
+
+} // extern "C"
+
+#endif // FS_ALLOC_HOOKS
+
+bool FSAlloc::supported() {
+#if defined(FS_ALLOC_HOOKS)
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool FSAlloc::start() {
+    if (!supported()) {
+        return false;
+    }
+    lockCalls();
+    memset(calls, 0, sizeof(calls));
+    unlockCalls();
+    reset();
+    _active.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void FSAlloc::stop() {
+    _active.store(false, std::memory_order_relaxed);
+}
+
+void FSAlloc::reset() {
+    baseBytes.store(liveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    peak.store(0, std::memory_order_relaxed);
+}
+
+int64_t FSAlloc::peakBytes() {
+    return peak.load(std::memory_order_relaxed);
+}
+
+size_t FSAlloc::report(FSAllocStats* stats, size_t count) {
+    size_t n = 0;
+    lockCalls();
+    for (size_t i = 0; i < CALLS && calls[i].call; i++) {
+        if (calls[i].allocations && n < count) {
+            stats[n++] = calls[i];
+        }
+    }
+    unlockCalls();
+    std::sort(stats, stats + n, [](const FSAllocStats& a, const FSAllocStats& b) {
+        return a.bytes > b.bytes;
+    });
+    return n;
+}
+
+bool FSAlloc::_enter(const char* call) {
+    if (current.call) {
+        return false;
+    }
+    current.call = call;
+    current.allocations = 0;
+    current.bytes = 0;
+    return true;
+}
+
+void FSAlloc::_leave() {
+    AllocCall done = current;
+    current.call = nullptr;
+    lockCalls();
+    for (size_t i = 0; i < CALLS; i++) {
+        FSAllocStats& stats = calls[i];
+        // the last slot takes what does not fit
+        bool last = i + 1 == CALLS;
+        if (stats.call && !last && stats.call != done.call && strcmp(stats.call, done.call) != 0) {
+            continue;
+        }
+        if (!stats.call) {
+            stats.call = last ? "..." : done.call;
+        }
+        stats.calls++;
+        stats.allocations += done.allocations;
+        stats.bytes += done.bytes;
+        stats.maxAllocations = std::max(stats.maxAllocations, done.allocations);
+        stats.maxBytes = std::max(stats.maxBytes, done.bytes);
+        break;
+    }
+    unlockCalls();
+}
@@ -0,0 +1,159 @@
+/*
+ FSIoPool.cpp - I/O threads of the async FS and File calls, see FSIoPool in FS.h
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <algorithm>
+#include "FS.h"
+
+using namespace fs;
+
+static constexpr unsigned MAX_THREADS = 8;
+static constexpr int SPINS = 64;    // Polls of an idle thread before it sleeps
+
+FSIoPool::FSIoPool(unsigned threads)
+    : _slots(SLOTS), _enqueue(0), _dequeue(0), _stopping(false), _submitting(0), _sleeping(0) {
+    for (size_t i = 0; i < SLOTS; i++) {
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    if (threads == 0) {
+        threads = std::min(std::max(std::thread::hardware_concurrency(), 1u), MAX_THREADS);
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        _threads.emplace_back(&FSIoPool::_run, this);
+    }
+}
+
+FSIoPool::~FSIoPool() {
+    stop();
+}
+
+void FSIoPool::stop() {
+    std::call_once(_stopped, [this] {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping.store(true);
+        }
+        _wake.notify_all();
+        // seq_cst like in submit(): a submitter either sees _stopping or
+        // is waited for here until its task is in the ring
+        while (_submitting.load() > 0) {
+            std::this_thread::yield();
+        }
+        for (std::thread& thread : _threads) {
+            thread.join();
+        }
+        // pushed after the threads found the ring empty
+        std::function<void()> task;
+        while (_pop(task)) {
+            task();
+            task = nullptr;
+        }
+    });
+}
+
+void FSIoPool::submit(std::function<void()> task) {
+    _submitting.fetch_add(1);
+    if (_stopping.load() || !_push(task)) {
+        _submitting.fetch_sub(1);
+        // stopped or full, the caller waits by doing the work
+        task();
+        return;
+    }
+    _submitting.fetch_sub(1);
+    // seq_cst like _enqueue in _push() and _sleeping in _run(): either a
+    // thread going to sleep sees the task or this sees it sleeping
+    if (_sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _wake.notify_one();
+    }
+}
+
+// Multi-producer multi-consumer ring of D. Vyukov, see TraceRecorder::record()
+bool FSIoPool::_push(std::function<void()>& task) {
+    size_t pos = _enqueue.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot = &_slots[pos % SLOTS];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = _enqueue.load(std::memory_order_relaxed);
+        }
+    }
+    slot->task = std::move(task);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool FSIoPool::_pop(std::function<void()>& task) {
+    size_t pos = _dequeue.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot = &_slots[pos % SLOTS];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = _dequeue.load(std::memory_order_relaxed);
+        }
+    }
+    task = std::move(slot->task);
+    slot->task = nullptr;
+    slot->sequence.store(pos + SLOTS, std::memory_order_release);
+    return true;
+}
+
+// Tasks submitted and not taken yet, including those still being written
+bool FSIoPool::_empty() const {
+    return _enqueue.load() == _dequeue.load();
+}
+
+void FSIoPool::_run() {
+    std::function<void()> task;
+    int idle = 0;
+    for (;;) {
+        if (_pop(task)) {
+            task();
+            task = nullptr;
+            idle = 0;
+            continue;
+        }
+        if (_stopping.load(std::memory_order_acquire) && _empty()) {
+            return;
+        }
+        if (++idle < SPINS) {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _sleeping.fetch_add(1);
+        _wake.wait(lock, [this] { return !_empty() || _stopping.load(std::memory_order_relaxed); });
+        _sleeping.fetch_sub(1, std::memory_order_relaxed);
+        idle = 0;
+    }
+}
@@ -25,8 +25,18 @@
  */
 
 //#include <Arduino.h>
+#include <dirent.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 #include <algorithm>
+#include <atomic>
 #include "LittleFS.h"
 //#include "debug.h"
 //#include "flash_hal.h"
@@ -38,143 +48,91 @@
 
 namespace littlefs_impl {
 
-FileImplPtr LittleFSImpl::open(const char* path, OpenMode openMode, AccessMode accessMode) {
-    if (!_mounted) {
-        //DEBUGV("LittleFSImpl::open() called on unmounted FS\n");
-        return FileImplPtr();
-    }
-    if (!path || !path[0]) {
-        //DEBUGV("LittleFSImpl::open() called with invalid filename\n");
-        return FileImplPtr();
-    }
-    if (!LittleFSImpl::pathValid(path)) {
-        //DEBUGV("LittleFSImpl::open() called with too long filename\n");
-        return FileImplPtr();
-    }
-    int flags = _getFlags(openMode, accessMode);
-    auto fd = std::make_shared<lfs_file_t>();
-
-    if ((openMode & OM_CREATE) && strchr(path, '/')) {
-        // For file creation, silently make subdirs as needed.  If any fail,
-        // it will be caught by the real file open later on
-        char *pathStr = strdup(path);
-        if (pathStr) {
-            // Make dirs up to the final fnamepart
-            char *ptr = strchr(pathStr, '/');
-            while (ptr) {
-                *ptr = 0;
-                lfs_mkdir(&_lfs, pathStr);
-                *ptr = '/';
-                ptr = strchr(ptr+1, '/');
-            }
+template class LittleFSImplT<NullHooks>;
+template class LittleFSFileImplT<NullHooks>;
+template class LittleFSDirImplT<NullHooks>;
+
+//Mock
+String LittleFSConfig::uniqueRoot(const char* base) {
+    // the pid tells processes apart, the counter threads, mkdir() leftovers of earlier runs
+    static std::atomic<unsigned> next(0);
+#if defined(_WIN32)
+    long pid = _getpid();
+#else
+    long pid = getpid();
+#endif
+    for (int tries = 0; tries < 1000; tries++) {
+        String root = String(base) + "-" + String(pid) + "-" + String(next++) + "/";
+#if defined(_WIN32)
+        int rc = _mkdir(root.c_str());
+#else
+        int rc = ::mkdir(root.c_str(), 0777);
+#endif
+        if (rc == 0) {
+            return root;
         }
-        free(pathStr);
-    }
-
-    time_t creation = 0;
-    if (_timeCallback && (openMode & OM_CREATE)) {
-        // O_CREATE means we *may* make the file, but not if it already exists.
-        // See if it exists, and only if not update the creation time
-        int rc = lfs_file_open(&_lfs, fd.get(), path, LFS_O_RDONLY);
-	if (rc == 0) {
-            lfs_file_close(&_lfs, fd.get()); // It exists, don't update create time
-        } else {
-            creation = _timeCallback();  // File didn't exist or otherwise, so we're going to create this time
+        if (errno != EEXIST) {
+            break;
         }
     }
+    return String();
+}
 
-    int rc = lfs_file_open(&_lfs, fd.get(), path, flags);
-    if (rc == LFS_ERR_ISDIR) {
-        // To support the SD.openNextFile, a null FD indicates to the LittleFSFile this is just
-        // a directory whose name we are carrying around but which cannot be read or written
-        return std::make_shared<LittleFSFileImpl>(this, path, nullptr, flags, creation);
-    } else if (rc == 0) {
-        lfs_file_sync(&_lfs, fd.get());
-        return std::make_shared<LittleFSFileImpl>(this, path, fd, flags, creation);
+//Mock
+String LittleFSConfig::uniqueRamRoot() {
+    struct stat st;
+    String base;
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    if (stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode)) {
+        base = "/dev/shm";
+    } else if (runtime && runtime[0]) {
+        base = runtime;
     } else {
-        //DEBUGV("LittleFSDirImpl::openFile: rc=%d fd=%p path=`%s` openMode=%d accessMode=%d err=%d\n",
-        //    rc, fd.get(), path, openMode, accessMode, rc);
-        return FileImplPtr();
+#if defined(_WIN32)
+        const char* temp = getenv("TEMP");
+#else
+        const char* temp = getenv("TMPDIR");
+#endif
+        base = temp && temp[0] ? temp : "/tmp";
+    }
+    if (base.endsWith("/") || base.endsWith("\\")) {
+        base.remove(base.length() - 1);
     }
+    return uniqueRoot((base + "/littlefs").c_str());
 }
 
-DirImplPtr LittleFSImpl::openDir(const char *path) {
-    if (!_mounted || !path) {
-        return DirImplPtr();
+//Mock
+bool LittleFSConfig::removeRoot(const String& root) {
+    if (!root.length()) {
+        return false;
     }
-    //Mock
-    //char *pathStr = strdup(path); // Allow edits on our scratch copy
-    char *pathStr = strdup(path); // Allow edits on our scratch copy
-
-    // Get rid of any trailing slashes
-    while (strlen(pathStr) && (pathStr[strlen(pathStr)-1]=='/')) {
-        pathStr[strlen(pathStr)-1] = 0;
+    String dir = root.endsWith("/") ? root : root + "/";
+    DIR* pDir = opendir(dir.c_str());
+    if (!pDir) {
+        return false;
     }
-    // At this point we have a name of "blah/blah/blah" or "blah" or ""
-    // If that references a directory, just open it and we're done.
-    lfs_info info;
-    auto dir = std::make_shared<lfs_dir_t>();
-    int rc;
-    const char *filter = "";
-    if (!pathStr[0]) {
-        // openDir("") === openDir("/") ==> not possible for Mock
-        rc = lfs_dir_open(&_lfs, dir.get(), "/");
-        filter = "";
-    } else if (lfs_stat(&_lfs, pathStr, &info) >= 0) {
-        if (info.type == LFS_TYPE_DIR) {
-            // Easy peasy, path specifies an existing dir!
-            rc = lfs_dir_open(&_lfs, dir.get(), pathStr);
-            // ignore test-dir prefix
-            path = strchr(pathStr, '/') + (path[0] == '/' ? 0 : 1);
-	        filter = "";
-        } else {
-            // This is a file, so open the containing dir
-            char *ptr = strrchr(pathStr, '/');
-            if (!ptr) {
-                // No slashes, open the root dir ==> not possible for Mock
-                rc = lfs_dir_open(&_lfs, dir.get(), "/");
-		        filter = pathStr;
-            } else {
-                // We've got slashes, open the dir one up
-                *ptr = 0; // Remove slash, truncate string
-                rc = lfs_dir_open(&_lfs, dir.get(), pathStr);
-                // ignore test-dir prefix
-                path = strchr(pathStr, '/') + (path[0] == '/' ? 0 : 1);
-        		filter = ptr + 1;
-            }
+    bool removed = true;
+    struct dirent* pEntry;
+    while ((pEntry = readdir(pDir)) != NULL) {
+        if (strcmp(pEntry->d_name, ".") == 0 || strcmp(pEntry->d_name, "..") == 0) {
+            continue;
         }
-    } else { 
-        // Name doesn't exist, so use the parent dir of whatever was sent in
-        // This is a file, so open the containing dir
-        char *ptr = strrchr(pathStr, '/');
-        if (!ptr) {
-            // No slashes, open the root dir ==> not possible for Mock
-            rc = lfs_dir_open(&_lfs, dir.get(), "/");
-	        filter = pathStr;
-        } else {
-            // We've got slashes, open the dir one up
-            *ptr = 0; // Remove slash, truncate string
-            rc = lfs_dir_open(&_lfs, dir.get(), pathStr);
-            // ignore test-dir prefix
-            path = strchr(pathStr, '/') + (path[0] == '/' ? 0 : 1);
-    	    filter = ptr + 1;
+        String path = dir + pEntry->d_name;
+        struct stat st;
+#if defined(_WIN32)
+        int rc = stat(path.c_str(), &st);
+#else
+        // a symlink is removed itself, never what it points to
+        int rc = lstat(path.c_str(), &st);
+#endif
+        if (rc == 0 && S_ISDIR(st.st_mode)) {
+            removed = removeRoot(path) && removed;
+        } else if (::remove(path.c_str()) != 0) {
+            removed = false;
         }
     }
-    if (rc < 0) {
-        //DEBUGV("LittleFSImpl::openDir: path=`%s` err=%d\n", path, rc);
-        free(pathStr);
-        return DirImplPtr();
-    }
-    // Skip the . and .. entries
-    lfs_info dirent;
-    lfs_dir_read(&_lfs, dir.get(), &dirent);
-    lfs_dir_read(&_lfs, dir.get(), &dirent);
-
-    //Mock - provide the original path (without test-dir prefix) to the instance
-    //auto ret = std::make_shared<LittleFSDirImpl>(filter, this, dir, pathStr);
-    auto ret = std::make_shared<LittleFSDirImpl>(filter, this, dir, pathStr);
-    free(pathStr);
-    return ret;
+    closedir(pDir);
+    return rmdir(dir.c_str()) == 0 && removed;
 }
 
 // int LittleFSImpl::lfs_flash_read(const struct lfs_config *c,
@@ -0,0 +1,448 @@
+/*
+ LittleFSTrace.cpp - binary trace of the lfs layer of the LittleFS mock
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <chrono>
+#include "LittleFSTrace.h"
+
+namespace littlefs_impl {
+
+static constexpr size_t EVENT_SIZE = 54;
+
+static uint8_t* put(uint8_t* p, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        *p++ = (uint8_t)(value >> (8 * i));
+    }
+    return p;
+}
+
+static uint64_t get(const uint8_t* p, size_t size) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; i++) {
+        value |= (uint64_t)p[i] << (8 * i);
+    }
+    return value;
+}
+
+static void copyPath(char* to, const char* from) {
+    if (!from) {
+        to[0] = 0;
+        return;
+    }
+    size_t length = strnlen(from, LFS_MOCK_PATH_MAX - 1);
+    memcpy(to, from, length);
+    to[length] = 0;
+}
+
+TraceRecorder::TraceRecorder()
+    : _slots(SLOTS),
+    _enqueue(0),
+    _stopping(false),
+    _stalls(0)
+{
+}
+
+TraceRecorder::~TraceRecorder() {
+    stop();
+}
+
+bool TraceRecorder::start(const char* path) {
+    if (_file || !path || !path[0]) {
+        return false;
+    }
+    _file = fopen(path, "wb");
+    if (!_file) {
+        return false;
+    }
+    setvbuf(_file, nullptr, _IOFBF, 1 << 20);
+    for (size_t i = 0; i < SLOTS; i++) {
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    _enqueue.store(0, std::memory_order_relaxed);
+    _dequeue = 0;
+    _stopping.store(false, std::memory_order_relaxed);
+    _stalls.store(0, std::memory_order_relaxed);
+    _events = 0;
+    _failed = false;
+    _paths.clear();
+    _paths[""] = 0;
+
+    uint8_t header[12];
+    memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    put(header + 8, TRACE_VERSION, 4);
+    _write(header, sizeof(header));
+
+    _startNs = lfs_clock_ns();
+    _flusher = std::thread(&TraceRecorder::_run, this);
+    return true;
+}
+
+bool TraceRecorder::stop() {
+    if (!_file) {
+        return false;
+    }
+    // the flusher drains the ring
+    _stopping.store(true, std::memory_order_release);
+    _flusher.join();
+    bool ok = !_failed;
+    if (fclose(_file) != 0) {
+        ok = false;
+    }
+    _file = nullptr;
+    return ok;
+}
+
+// Bounded multi-producer queue after Dmitry Vyukov, the sequence of a slot
+// tells whether it is free for the position or already filled
+void TraceRecorder::record(const lfs_trace_event* event) {
+    size_t pos = _enqueue.load(std::memory_order_relaxed);
+    bool stalled = false;
+    Slot* slot;
+    for (;;) {
+        slot = &_slots[pos % SLOTS];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // full, wait for the flusher
+            if (!stalled) {
+                stalled = true;
+                _stalls.fetch_add(1, std::memory_order_relaxed);
+            }
+            std::this_thread::yield();
+            pos = _enqueue.load(std::memory_order_relaxed);
+        } else {
+            pos = _enqueue.load(std::memory_order_relaxed);
+        }
+    }
+    slot->event = *event;
+    copyPath(slot->path, event->path);
+    copyPath(slot->target, event->target);
+    slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+size_t TraceRecorder::_drain() {
+    size_t count = 0;
+    for (;;) {
+        Slot& slot = _slots[_dequeue % SLOTS];
+        if (slot.sequence.load(std::memory_order_acquire) != _dequeue + 1) {
+            return count;
+        }
+        const lfs_trace_event& e = slot.event;
+        uint32_t path = _intern(slot.path);
+        uint32_t target = _intern(slot.target);
+
+        uint8_t record[EVENT_SIZE];
+        uint8_t* p = record;
+        *p++ = 'E';
+        *p++ = (uint8_t)e.op;
+        p = put(p, path, 4);
+        p = put(p, target, 4);
+        p = put(p, e.offset, 8);
+        p = put(p, e.length, 8);
+        p = put(p, e.flags, 4);
+        p = put(p, (uint64_t)e.result, 8);
+        p = put(p, e.start_ns - _startNs, 8);
+        put(p, e.duration_ns, 8);
+        _write(record, sizeof(record));
+
+        slot.sequence.store(_dequeue + SLOTS, std::memory_order_release);
+        _dequeue++;
+        _events++;
+        count++;
+    }
+}
+
+void TraceRecorder::_run() {
+    for (;;) {
+        // read before draining, so that the last drain sees every event
+        bool stopping = _stopping.load(std::memory_order_acquire);
+        if (_drain() == 0) {
+            if (stopping) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+}
+
+uint32_t TraceRecorder::_intern(const char* path) {
+    auto it = _paths.find(path);
+    if (it != _paths.end()) {
+        return it->second;
+    }
+    uint32_t id = (uint32_t)_paths.size();
+    _paths.emplace(path, id);
+    size_t length = strlen(path);
+    uint8_t record[7];
+    record[0] = 'S';
+    put(record + 1, id, 4);
+    put(record + 5, length, 2);
+    _write(record, sizeof(record));
+    _write(path, length);
+    return id;
+}
+
+void TraceRecorder::_write(const void* data, size_t size) {
+    if (fwrite(data, 1, size, _file) != size) {
+        _failed = true;
+    }
+}
+
+bool TraceReader::open(const char* path) {
+    close();
+    _file = fopen(path, "rb");
+    if (!_file) {
+        return false;
+    }
+    uint8_t header[12];
+    if (!_read(header, sizeof(header)) || memcmp(header, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+        || get(header + 8, 4) != TRACE_VERSION) {
+        close();
+        return false;
+    }
+    _paths.assign(1, "");
+    return true;
+}
+
+void TraceReader::close() {
+    if (_file) {
+        fclose(_file);
+        _file = nullptr;
+    }
+    _paths.clear();
+}
+
+bool TraceReader::next(TraceEvent& event) {
+    uint8_t type;
+    while (_file && _read(&type, 1)) {
+        if (type == 'S') {
+            uint8_t record[6];
+            if (!_read(record, sizeof(record))) {
+                return false;
+            }
+            uint32_t id = (uint32_t)get(record, 4);
+            if (id != _paths.size()) {
+                // the recorder numbers the paths in order, see _intern()
+                return false;
+            }
+            std::string path(get(record + 4, 2), '\0');
+            if (!_read(&path[0], path.size())) {
+                return false;
+            }
+            _paths.push_back(path);
+        } else if (type == 'E') {
+            uint8_t record[EVENT_SIZE - 1];
+            if (!_read(record, sizeof(record))) {
+                return false;
+            }
+            const uint8_t* p = record;
+            event.op = (lfs_op)p[0];
+            event.path = (uint32_t)get(p + 1, 4);
+            event.target = (uint32_t)get(p + 5, 4);
+            event.offset = get(p + 9, 8);
+            event.length = get(p + 17, 8);
+            event.flags = (uint32_t)get(p + 25, 4);
+            event.result = (int64_t)get(p + 29, 8);
+            event.timeNs = get(p + 37, 8);
+            event.durationNs = get(p + 45, 8);
+            return event.op < LFS_OP_COUNT;
+        } else {
+            return false;
+        }
+    }
+    return false;
+}
+
+const char* TraceReader::path(uint32_t id) const {
+    return id < _paths.size() ? _paths[id].c_str() : "";
+}
+
+bool TraceReader::_read(void* data, size_t size) {
+    return size == 0 || fread(data, 1, size, _file) == size;
+}
+
+bool TraceReplay::run(lfs_t* lfs, const char* path, const fs::FSReplayOptions& options,
+                      fs::FSReplayReport& report) {
+    memset(&report, 0, sizeof(report));
+    if (!lfs || options.speed <= 0 || !_reader.open(path)) {
+        return false;
+    }
+    _events.clear();
+    TraceEvent event;
+    while (_reader.next(event)) {
+        _events.push_back(event);
+    }
+    _lfs = lfs;
+
+    uint64_t startNs = lfs_clock_ns();
+    for (const TraceEvent& e : _events) {
+        if (options.paced) {
+            uint64_t due = startNs + (uint64_t)(e.timeNs / options.speed);
+            uint64_t now = lfs_clock_ns();
+            while (now < due) {
+                // sleeping overshoots, so yield for the last bit
+                if (due - now > 200000) {
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(due - now - 100000));
+                } else {
+                    std::this_thread::yield();
+                }
+                now = lfs_clock_ns();
+            }
+            if (now - due > report.maxLagNs) {
+                report.maxLagNs = now - due;
+            }
+        }
+        uint64_t callNs = lfs_clock_ns();
+        int64_t result = _call(e);
+        callNs = lfs_clock_ns() - callNs;
+
+        bool data = e.op == LFS_OP_READ || e.op == LFS_OP_WRITE;
+        uint64_t bytes = data && result > 0 ? result : 0;
+        report.stats.ops[e.op].add(callNs, bytes, result < 0);
+        report.bytes += bytes;
+        report.events++;
+        if ((result < 0) != (e.result < 0) || (data && result != e.result)) {
+            report.mismatches++;
+        }
+    }
+    report.elapsedNs = lfs_clock_ns() - startNs;
+
+    _closeAll();
+    _events.clear();
+    _reader.close();
+    return true;
+}
+
+int64_t TraceReplay::_call(const TraceEvent& event) {
+    const char* path = _reader.path(event.path);
+    switch (event.op) {
+    case LFS_OP_OPEN: {
+        std::unique_ptr<lfs_file_t> file(new lfs_file_t());
+        int rc = lfs_file_open(_lfs, file.get(), path, (int)event.flags);
+        if (rc == 0) {
+            _files[event.path].push_back(std::move(file));
+        }
+        return rc;
+    }
+    case LFS_OP_CLOSE: {
+        auto it = _files.find(event.path);
+        if (it == _files.end() || it->second.empty()) {
+            return LFS_ERR_BADF;
+        }
+        int rc = lfs_file_close(_lfs, it->second.back().get());
+        it->second.pop_back();
+        return rc;
+    }
+    case LFS_OP_READ:
+    case LFS_OP_WRITE: {
+        lfs_file_t* file = _file(event.path);
+        if (!file) {
+            return LFS_ERR_BADF;
+        }
+        // at the recorded position, even if an earlier call went differently
+        if (lfs_file_tell(_lfs, file) != (lfs_soff_t)event.offset) {
+            lfs_file_seek(_lfs, file, (lfs_soff_t)event.offset, LFS_SEEK_SET);
+        }
+        if (event.op == LFS_OP_READ) {
+            if (_buffer.size() < event.length) {
+                _buffer.resize(event.length);
+            }
+            return lfs_file_read(_lfs, file, _buffer.data(), (lfs_size_t)event.length);
+        }
+        if (_zeros.size() < event.length) {
+            _zeros.resize(event.length);
+        }
+        return lfs_file_write(_lfs, file, _zeros.data(), (lfs_size_t)event.length);
+    }
+    case LFS_OP_SEEK: {
+        lfs_file_t* file = _file(event.path);
+        return file ? lfs_file_seek(_lfs, file, (lfs_soff_t)event.offset, (int)event.flags) : LFS_ERR_BADF;
+    }
+    case LFS_OP_SYNC: {
+        lfs_file_t* file = _file(event.path);
+        return file ? lfs_file_sync(_lfs, file) : LFS_ERR_BADF;
+    }
+    case LFS_OP_TRUNCATE: {
+        lfs_file_t* file = _file(event.path);
+        return file ? lfs_file_truncate(_lfs, file, (lfs_off_t)event.length) : LFS_ERR_BADF;
+    }
+    case LFS_OP_STAT: {
+        lfs_info info;
+        return lfs_stat(_lfs, path, &info);
+    }
+    case LFS_OP_DIR_OPEN: {
+        // the trace has no close of directories, opening one again replaces it
+        std::unique_ptr<lfs_dir_t>& slot = _dirs[event.path];
+        if (slot) {
+            lfs_dir_close(_lfs, slot.get());
+            slot.reset();
+        }
+        std::unique_ptr<lfs_dir_t> dir(new lfs_dir_t());
+        int rc = event.flags ? lfs_dir_open_file(_lfs, dir.get(), path) : lfs_dir_open(_lfs, dir.get(), path);
+        if (rc == 0) {
+            slot = std::move(dir);
+        }
+        _lastDir = slot.get();
+        return rc;
+    }
+    case LFS_OP_DIR_READ: {
+        auto it = _dirs.find(event.path);
+        lfs_dir_t* dir = it != _dirs.end() && it->second ? it->second.get() : _lastDir;
+        if (!dir) {
+            return LFS_ERR_BADF;
+        }
+        lfs_info info;
+        return lfs_dir_read(_lfs, dir, &info);
+    }
+    case LFS_OP_MKDIR:
+        return lfs_mkdir(_lfs, path);
+    case LFS_OP_REMOVE:
+        return lfs_remove(_lfs, path);
+    case LFS_OP_RENAME:
+        return lfs_rename(_lfs, path, _reader.path(event.target));
+    default:
+        return LFS_ERR_INVAL;
+    }
+}
+
+lfs_file_t* TraceReplay::_file(uint32_t path) {
+    auto it = _files.find(path);
+    return it != _files.end() && !it->second.empty() ? it->second.back().get() : nullptr;
+}
+
+void TraceReplay::_closeAll() {
+    for (auto& files : _files) {
+        for (auto& file : files.second) {
+            lfs_file_close(_lfs, file.get());
+        }
+    }
+    _files.clear();
+    for (auto& dir : _dirs) {
+        if (dir.second) {
+            lfs_dir_close(_lfs, dir.second.get());
+        }
+    }
+    _dirs.clear();
+    _lastDir = nullptr;
+}
+
+} // namespace littlefs_impl
@@ -33,6 +33,53 @@
 #define __STRHELPER(x) #x
 #define STR(x) __STRHELPER(x) // stringifier
 
+#if !defined(_WIN32)
+// The integer conversions of the Windows C runtime, not available with glibc
+static char* ulltoa(unsigned long long value, char* str, int radix) {
+    char tmp[1 + 8 * sizeof(unsigned long long)];
+    char* t = tmp;
+    if (radix < 2 || radix > 36) {
+        str[0] = 0;
+        return str;
+    }
+    do {
+        unsigned digit = value % radix;
+        *t++ = digit < 10 ? '0' + digit : 'a' + digit - 10;
+        value /= radix;
+    } while (value);
+    char* s = str;
+    while (t > tmp) {
+        *s++ = *--t;
+    }
+    *s = 0;
+    return str;
+}
+
+static char* lltoa(long long value, char* str, int radix) {
+    if (value < 0 && radix == 10) {
+        str[0] = '-';
+        ulltoa(0ULL - (unsigned long long)value, str + 1, radix);
+        return str;
+    }
+    // like the Windows runtime, other radices print the two's complement
+    return ulltoa((unsigned long long)value, str, radix);
+}
+
+static char* ltoa(long value, char* str, int radix) {
+    if (value < 0 && radix != 10) {
+        return ulltoa((unsigned long)value, str, radix);
+    }
+    return lltoa(value, str, radix);
+}
+
+static char* itoa(int value, char* str, int radix) {
+    if (value < 0 && radix != 10) {
+        return ulltoa((unsigned int)value, str, radix);
+    }
+    return lltoa(value, str, radix);
+}
+#endif
+
 extern "C" {
 char * dtostrf(double number, signed char width, unsigned char prec, char *s) {
     bool negative = false;
@@ -197,13 +244,13 @@ String::String(unsigned long long value) {
 String::String(long long value, unsigned char base) {
     init();
     char buf[2 + 8 * sizeof(long long)];
-    *this = lltoa(value, buf, sizeof(buf));
+    *this = lltoa(value, buf, base);
 }
 
 String::String(unsigned long long value, unsigned char base) {
     init();
     char buf[1 + 8 * sizeof(unsigned long long)];
-    *this = ulltoa(value, buf, sizeof(buf));
+    *this = ulltoa(value, buf, base);
 }
 
 String::String(float value, unsigned char decimalPlaces) {
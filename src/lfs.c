@@ -8,10 +8,37 @@
  * (find original version in "framework-arduinoespressif8266/libraries/LittleFS/lib/littlefs")
  */
 
-#include <io.h>
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+    #define _GNU_SOURCE // fallocate()
+#endif
+#define _FILE_OFFSET_BITS 64 // 64-bit off_t on 32-bit hosts as well
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/stat.h>
+#if defined(_WIN32)
+    #include <windows.h>
+    #include <io.h>
+    #include <direct.h>
+    #include <sys/utime.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <utime.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #include <sys/mman.h>
+        #include <sys/syscall.h>
+        #if defined(__NR_io_uring_setup) && defined(STATX_SIZE)
+            #define LFS_MOCK_URING // batches on io_uring, without liburing
+        #endif
+    #endif
+#endif
 #include "lfs.h"
 
 /*
@@ -19,234 +46,2500 @@
  * use always \n only instead of translated \r\n
  */
 #if defined(_WIN32)
-    #define OM_APPEND_ONLY "ab"
-    #define OM_APPEND_READ "ab+"
-    #define OM_READ_ONLY   "rb"
-    #define OM_READ_WRITE  "rb+"
-    #define OM_WRITE_ONLY  "wb"
-    #define OM_WRITE_READ  "wb+"
+    #define OM_APPEND_ONLY "ab"
+    #define OM_APPEND_READ "ab+"
+    #define OM_READ_ONLY   "rb"
+    #define OM_READ_WRITE  "rb+"
+    #define OM_WRITE_ONLY  "wb"
+    #define OM_WRITE_READ  "wb+"
+#else
+    #define OM_APPEND_ONLY "a"
+    #define OM_APPEND_READ "a+"
+    #define OM_READ_ONLY   "r"
+    #define OM_READ_WRITE  "r+"
+    #define OM_WRITE_ONLY  "w"
+    #define OM_WRITE_READ  "w+"
+#endif
+
+/*
+ * 64-bit file positions, lfs_soff_t
+ */
+#if defined(_WIN32)
+    #define fseek64 _fseeki64
+    #define ftell64 _ftelli64
+#else
+    #define fseek64 fseeko
+    #define ftell64 ftello
+#endif
+
+const char* patch_path(lfs_t *lfs, const char* path, char *buffer)
+{
+    if ( strncmp(lfs->test_dir, path, strlen(lfs->test_dir)) == 0)
+        // already patched
+        return strlen(path) < LFS_MOCK_PATH_MAX ? path : NULL;
+
+    int len = snprintf(buffer, LFS_MOCK_PATH_MAX, "%s%s", lfs->test_dir, path);
+    return len >= 0 && len < LFS_MOCK_PATH_MAX ? buffer : NULL;
+}
+
+/*
+ * Threads
+ *
+ * Paths are patched into a buffer of the caller, and each mounted littlefs
+ * object has a reader/writer lock: calls changing the file system (writes,
+ * creating, removing, renaming, committing) hold it exclusively, reading
+ * data, listing folders and reading attributes share it. lfs_stat() is a
+ * single stat() of the host and takes no lock at all, so exists() never
+ * waits. The counters of the statistics and the virtual flash are updated
+ * atomically, shared and lock free calls charge them too.
+ *
+ * Like littlefs a file or dir object belongs to one thread at a time.
+ */
+enum lock_mode { LOCK_SHARED, LOCK_EXCLUSIVE };
+
+static void lock_init(lfs_t *lfs)
+{
+    if (lfs->lock_ready)
+        return;
+#if defined(_WIN32)
+    InitializeSRWLock((PSRWLOCK)&lfs->lock);
+#else
+    pthread_rwlock_init(&lfs->lock, NULL);
+#endif
+    lfs->lock_ready = true;
+}
+
+// Device time of the lfs_* call running on this thread, see flash_charge()
+static _Thread_local uint64_t call_ns;
+
+// On entry of each lfs_* call that charges the flash, lock() calls it
+static void begin_call(void)
+{
+    call_ns = 0;
+}
+
+// Unmounted, e.g. files closed after lfs_unmount, the calls run unlocked
+static void lock(lfs_t *lfs, enum lock_mode mode)
+{
+    // each lfs_* call locks once, on entry
+    begin_call();
+    if (!lfs->lock_ready)
+        return;
+#if defined(_WIN32)
+    if (mode == LOCK_EXCLUSIVE)
+        AcquireSRWLockExclusive((PSRWLOCK)&lfs->lock);
+    else
+        AcquireSRWLockShared((PSRWLOCK)&lfs->lock);
+#else
+    if (mode == LOCK_EXCLUSIVE)
+        pthread_rwlock_wrlock(&lfs->lock);
+    else
+        pthread_rwlock_rdlock(&lfs->lock);
+#endif
+}
+
+static void unlock(lfs_t *lfs, enum lock_mode mode)
+{
+    if (!lfs->lock_ready)
+        return;
+#if defined(_WIN32)
+    if (mode == LOCK_EXCLUSIVE)
+        ReleaseSRWLockExclusive((PSRWLOCK)&lfs->lock);
+    else
+        ReleaseSRWLockShared((PSRWLOCK)&lfs->lock);
+#else
+    (void)mode;
+    pthread_rwlock_unlock(&lfs->lock);
+#endif
+}
+
+// Files written to change the file system when closed or synced
+static enum lock_mode file_lock_mode(lfs_file_t *file)
+{
+    return (file->flags & LFS_O_WRONLY) || file->shadow[0] ? LOCK_EXCLUSIVE : LOCK_SHARED;
+}
+
+#define atomic_add(counter, value) __atomic_fetch_add(&(counter), (value), __ATOMIC_RELAXED)
+
+/*
+ * Virtual flash
+ *
+ * The host files take neither the time nor the wear of the device flash, so
+ * each lfs_* call charges the accesses littlefs would make instead:
+ * - reading data: one read per read_size bytes
+ * - writing data: one program per prog_size bytes, and one erase for every
+ *   block the data moves to, littlefs is copy-on-write
+ * - looking up metadata (open, stat, each dir entry): one read
+ * - committing metadata (create, sync or close after writes, remove, rename,
+ *   mkdir, setattr): one program, and one erase whenever the metadata
+ *   block is full
+ */
+static lfs_size_t flash_units(lfs_off_t size, lfs_size_t unit)
+{
+    if (unit == 0)
+        unit = 1;
+    return (lfs_size_t)((size + unit - 1) / unit);
+}
+
+static void flash_charge(lfs_t *lfs, uint64_t reads, uint64_t progs, uint64_t erases)
+{
+    struct lfs_timing *t = &lfs->timing;
+    uint64_t ns = reads * t->read_ns + progs * t->prog_ns + erases * t->erase_ns;
+    // reads charge under the shared lock as well
+    atomic_add(t->reads, reads);
+    atomic_add(t->progs, progs);
+    atomic_add(t->erases, erases);
+    atomic_add(t->clock_ns, ns);
+    // a call can charge several accesses, e.g. open looks up and creates
+    call_ns += ns;
+    __atomic_store_n(&t->last_ns, call_ns, __ATOMIC_RELAXED);
+
+    // programs and erases only happen under the exclusive lock
+    struct lfs_powerloss *p = &lfs->powerloss;
+    if (p->active && !p->lost && progs + erases > 0) {
+        p->ops += progs + erases;
+        if (p->ops > p->cut)
+            p->lost = true;
+    }
+}
+
+static lfs_block_t flash_alloc(lfs_t *lfs)
+{
+    struct lfs_wear *w = &lfs->wear;
+    lfs_block_t block;
+    do {
+        block = w->next;
+        w->next = (w->next + 1) % w->count;
+    } while ((block == w->meta[0] || block == w->meta[1]) && w->count > 2);
+    return block;
+}
+
+static int wear_track(lfs_t *lfs, bool enable)
+{
+    struct lfs_wear *w = &lfs->wear;
+    free(w->erases);
+    free(w->progs);
+    memset(w, 0, sizeof(*w));
+    if (!enable)
+        return 0;
+    if (!lfs->cfg || lfs->cfg->block_count == 0)
+        return LFS_ERR_INVAL;
+
+    w->erases = (uint32_t *)calloc(lfs->cfg->block_count, sizeof(uint32_t));
+    w->progs = (uint32_t *)calloc(lfs->cfg->block_count, sizeof(uint32_t));
+    if (!w->erases || !w->progs) {
+        wear_track(lfs, false);
+        return LFS_ERR_NOMEM;
+    }
+    w->count = lfs->cfg->block_count;
+    // like the superblock, the root metadata starts at blocks 0 and 1
+    w->meta[0] = 0;
+    w->meta[1] = w->count > 1 ? 1 : 0;
+    w->next = w->count > 2 ? 2 : 0;
+    return 0;
+}
+
+int lfs_wear_track(lfs_t *lfs, bool enable)
+{
+    lock(lfs, LOCK_EXCLUSIVE);
+    int rc = wear_track(lfs, enable);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    return rc;
+}
+
+static void flash_lookup(lfs_t *lfs)
+{
+    if (lfs->cfg)
+        flash_charge(lfs, 1, 0, 0);
+}
+
+static void flash_read(lfs_t *lfs, lfs_size_t size)
+{
+    if (lfs->cfg && size)
+        flash_charge(lfs, flash_units(size, lfs->cfg->read_size), 0, 0);
+}
+
+static void flash_commit(lfs_t *lfs)
+{
+    if (!lfs->cfg)
+        return;
+    uint64_t erases = 0;
+    lfs_size_t prog_size = lfs->cfg->prog_size ? lfs->cfg->prog_size : 1;
+    struct lfs_wear *w = &lfs->wear;
+    if (lfs->meta_off + prog_size > lfs->cfg->block_size) {
+        // compact into the other block of the metadata pair
+        lfs->meta_off = 0;
+        erases = 1;
+        if (w->erases) {
+            if (lfs->cfg->block_cycles > 0 && ++w->meta_erases > (uint32_t)lfs->cfg->block_cycles) {
+                // worn enough, evict the pair
+                w->meta[0] = flash_alloc(lfs);
+                w->meta[1] = flash_alloc(lfs);
+                w->meta_erases = 1;
+            }
+            w->meta_cur ^= 1;
+            w->erases[w->meta[w->meta_cur]]++;
+        }
+    }
+    lfs->meta_off += prog_size;
+    if (w->progs)
+        w->progs[w->meta[w->meta_cur]]++;
+    flash_charge(lfs, 0, 1, erases);
+}
+
+static void wear_write(lfs_t *lfs, lfs_file_t *file, lfs_off_t pos, lfs_off_t size, int continued)
+{
+    struct lfs_wear *w = &lfs->wear;
+    lfs_size_t block_size = lfs->cfg->block_size ? lfs->cfg->block_size : 1;
+    lfs_off_t end = pos + size;
+    for (lfs_off_t block = pos / block_size; block * block_size < end; block++) {
+        lfs_off_t from = block * block_size > pos ? block * block_size : pos;
+        lfs_off_t to = (block + 1) * block_size < end ? (block + 1) * block_size : end;
+        if (!continued) {
+            file->wear_block = flash_alloc(lfs);
+            w->erases[file->wear_block]++;
+        }
+        continued = 0;
+        w->progs[file->wear_block] += flash_units(to - from, lfs->cfg->prog_size);
+    }
+}
+
+static void flash_write(lfs_t *lfs, lfs_file_t *file, lfs_off_t pos, lfs_off_t size)
+{
+    if (!lfs->cfg || !size)
+        return;
+    lfs_size_t block_size = lfs->cfg->block_size ? lfs->cfg->block_size : 1;
+    lfs_off_t first = pos / block_size;
+    lfs_off_t last = (pos + size - 1) / block_size;
+    uint64_t erases = last - first + 1;
+    int continued = file->block == first + 1;
+    if (continued)
+        // still programming the block of the previous write
+        erases--;
+    if (lfs->wear.erases)
+        wear_write(lfs, file, pos, size, continued);
+    file->block = last + 1;
+    flash_charge(lfs, 0, flash_units(size, lfs->cfg->prog_size), erases);
+}
+
+/*
+ * Statistics
+ *
+ * Each lfs_* call of enum lfs_op is counted with the bytes it moved and its
+ * latency on the host. The latencies go to a histogram with 8 linear buckets
+ * per power of 2, like HdrHistogram: values are at most 12.5% off, and
+ * recording needs two clock reads and no allocation.
+ */
+uint64_t lfs_clock_ns(void)
+{
+#if defined(_WIN32)
+    // no cache in a static, lfs keeps no global state
+    LARGE_INTEGER frequency, now;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)(now.QuadPart / frequency.QuadPart) * 1000000000
+        + (uint64_t)(now.QuadPart % frequency.QuadPart) * 1000000000 / frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+static size_t stats_bucket(uint64_t ns)
+{
+    const unsigned sub = 1 << LFS_STATS_SUB_BITS;
+    if (ns < sub)
+        return (size_t)ns;
+    unsigned magnitude = 63;
+    while (!(ns >> magnitude))
+        magnitude--;
+    size_t bucket = (size_t)(magnitude - LFS_STATS_SUB_BITS + 1) * sub
+        + ((ns >> (magnitude - LFS_STATS_SUB_BITS)) & (sub - 1));
+    return bucket < LFS_STATS_BUCKETS ? bucket : LFS_STATS_BUCKETS - 1;
+}
+
+// Counts the call, which took ns, and passes it on to the trace
+static void record_ns(lfs_t *lfs, struct lfs_trace_event *event, uint64_t bytes, int failed, uint64_t ns)
+{
+    struct lfs_op_stats *stats = &lfs->stats[event->op];
+    // after the lock is released, other threads count at the same time
+    atomic_add(stats->count, 1);
+    atomic_add(stats->errors, failed ? 1 : 0);
+    atomic_add(stats->bytes, bytes);
+    atomic_add(stats->total_ns, ns);
+    uint64_t max_ns = __atomic_load_n(&stats->max_ns, __ATOMIC_RELAXED);
+    while (ns > max_ns && !__atomic_compare_exchange_n(&stats->max_ns, &max_ns, ns, true,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    atomic_add(stats->histogram[stats_bucket(ns)], 1);
+
+    if (lfs->trace) {
+        // the path in littlefs, without the test dir
+        size_t len = strlen(lfs->test_dir);
+        if (strncmp(event->path, lfs->test_dir, len) == 0)
+            event->path += len;
+        if (event->target && strncmp(event->target, lfs->test_dir, len) == 0)
+            event->target += len;
+        event->duration_ns = ns;
+        lfs->trace(lfs->trace_context, event);
+    }
+}
+
+// Counts the call and passes it on to the trace
+static void record(lfs_t *lfs, struct lfs_trace_event *event, uint64_t bytes, int failed)
+{
+    record_ns(lfs, event, bytes, failed, lfs_clock_ns() - event->start_ns);
+}
+
+void lfs_trace(lfs_t *lfs, lfs_trace_t trace, void *context)
+{
+    lfs->trace = trace;
+    lfs->trace_context = context;
+}
+
+/*
+ * Capacity
+ *
+ * While limited, lfs->used counts the blocks of all files and each open file
+ * caches its size, so checking a change against block_count is O(1).
+ */
+static uint64_t blocks_of(lfs_t *lfs, lfs_off_t size)
+{
+    lfs_size_t block_size = lfs->cfg && lfs->cfg->block_size ? lfs->cfg->block_size : 1;
+    return (size + block_size - 1) / block_size;
+}
+
+static uint64_t blocks_free(lfs_t *lfs)
+{
+    uint64_t count = lfs->cfg ? lfs->cfg->block_count : 0;
+    return lfs->used < count ? count - lfs->used : 0;
+}
+
+// Number of bytes of a change of the file to new_size that fit on the device
+static lfs_off_t capacity_fit(lfs_t *lfs, lfs_file_t *file, lfs_off_t new_size)
+{
+    if (!lfs->limited || new_size <= file->size)
+        return new_size;
+    uint64_t blocks = blocks_of(lfs, file->size) + blocks_free(lfs);
+    lfs_off_t max_size = blocks * (lfs->cfg->block_size ? lfs->cfg->block_size : 1);
+    return new_size < max_size ? new_size : max_size;
+}
+
+static void capacity_resize(lfs_t *lfs, lfs_file_t *file, lfs_off_t new_size)
+{
+    if (!lfs->limited)
+        return;
+    uint64_t blocks = blocks_of(lfs, file->size);
+    // files changed outside of littlefs may be missing from the count
+    lfs->used = (lfs->used > blocks ? lfs->used - blocks : 0) + blocks_of(lfs, new_size);
+    file->size = new_size;
+}
+
+// Releases the blocks of a file about to be removed or replaced
+static void capacity_release(lfs_t *lfs, const char *path)
+{
+    struct stat buffer;
+    if (lfs->limited && stat(path, &buffer) == 0 && S_ISREG(buffer.st_mode)) {
+        uint64_t blocks = blocks_of(lfs, buffer.st_size);
+        lfs->used = lfs->used > blocks ? lfs->used - blocks : 0;
+    }
+}
+
+static lfs_soff_t fs_size(lfs_t *lfs);
+
+int lfs_fs_limit(lfs_t *lfs, bool enable)
+{
+    lock(lfs, LOCK_EXCLUSIVE);
+    lfs->limited = false;
+    lfs->used = 0;
+    int rc = 0;
+    if (enable && !lfs->cfg) {
+        rc = LFS_ERR_INVAL;
+    } else if (enable) {
+        lfs_soff_t used = fs_size(lfs);
+        if (used < 0) {
+            rc = (int)used;
+        } else {
+            lfs->used = used;
+            lfs->limited = true;
+        }
+    }
+    unlock(lfs, LOCK_EXCLUSIVE);
+    return rc;
+}
+
+static int mkdir_host(const char *path)
+{
+#if defined(_WIN32)
+    return mkdir(path);
+#else
+    return mkdir(path, 0777);
+#endif
+}
+
+static int copy_host(const char *from, const char *to)
+{
+    FILE *in = fopen(from, OM_READ_ONLY);
+    if (in == NULL)
+        return LFS_ERR_IO;
+    FILE *out = fopen(to, OM_WRITE_ONLY);
+    if (out == NULL) {
+        fclose(in);
+        return LFS_ERR_IO;
+    }
+    char buffer[4096];
+    size_t count;
+    int rc = 0;
+    while ((count = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        if (fwrite(buffer, 1, count, out) != count) {
+            rc = LFS_ERR_IO;
+            break;
+        }
+    }
+    fclose(in);
+    if (fclose(out) != 0)
+        rc = LFS_ERR_IO;
+    return rc;
+}
+
+/*
+ * Last write times
+ *
+ * littlefs keeps the 't' attribute in the metadata of the file, the mock
+ * keeps the ones set while mounted in memory by host path, so closing a file
+ * costs no system call. The host files get them as their modification time
+ * on unmount, and before a power loss is simulated: its changes are all
+ * undone, and the times set meanwhile are dropped with them.
+ */
+struct lfs_stamp {
+    struct lfs_stamp *next;
+    int64_t time;
+    char path[];
+};
+
+static size_t stamp_hash(const char *path)
+{
+    // FNV-1a
+    size_t hash = 2166136261u;
+    while (*path)
+        hash = (hash ^ (unsigned char)*path++) * 16777619u;
+    return hash;
+}
+
+// The link to the stamp of path, to the NULL at the end of its chain if none
+static struct lfs_stamp **stamp_find(struct lfs_stamps *stamps, const char *path)
+{
+    struct lfs_stamp **link = &stamps->buckets[stamp_hash(path) & (stamps->capacity - 1)];
+    while (*link && strcmp((*link)->path, path) != 0)
+        link = &(*link)->next;
+    return link;
+}
+
+static void stamp_insert(struct lfs_stamps *stamps, struct lfs_stamp *stamp)
+{
+    struct lfs_stamp **bucket = &stamps->buckets[stamp_hash(stamp->path) & (stamps->capacity - 1)];
+    stamp->next = *bucket;
+    *bucket = stamp;
+    stamps->count++;
+}
+
+static int stamp_set(lfs_t *lfs, const char *path, int64_t time)
+{
+    struct lfs_stamps *stamps = &lfs->stamps;
+    if (stamps->count >= stamps->capacity) {
+        size_t capacity = stamps->capacity ? 2 * stamps->capacity : 64;
+        struct lfs_stamp **buckets = (struct lfs_stamp **)calloc(capacity, sizeof(*buckets));
+        if (buckets == NULL)
+            return LFS_ERR_NOMEM;
+        struct lfs_stamps grown = { buckets, capacity, 0 };
+        for (size_t i = 0; i < stamps->capacity; i++) {
+            struct lfs_stamp *stamp = stamps->buckets[i];
+            while (stamp) {
+                struct lfs_stamp *next = stamp->next;
+                stamp_insert(&grown, stamp);
+                stamp = next;
+            }
+        }
+        free(stamps->buckets);
+        *stamps = grown;
+    }
+    struct lfs_stamp **link = stamp_find(stamps, path);
+    if (*link) {
+        (*link)->time = time;
+        return 0;
+    }
+    size_t size = strlen(path) + 1;
+    struct lfs_stamp *stamp = (struct lfs_stamp *)malloc(sizeof(*stamp) + size);
+    if (stamp == NULL)
+        return LFS_ERR_NOMEM;
+    stamp->time = time;
+    memcpy(stamp->path, path, size);
+    stamp_insert(stamps, stamp);
+    return 0;
+}
+
+static bool stamp_get(lfs_t *lfs, const char *path, int64_t *time)
+{
+    if (lfs->stamps.count == 0)
+        return false;
+    struct lfs_stamp *stamp = *stamp_find(&lfs->stamps, path);
+    if (stamp)
+        *time = stamp->time;
+    return stamp != NULL;
+}
+
+static void stamp_remove(lfs_t *lfs, const char *path)
+{
+    if (lfs->stamps.count == 0)
+        return;
+    struct lfs_stamp **link = stamp_find(&lfs->stamps, path);
+    struct lfs_stamp *stamp = *link;
+    if (stamp) {
+        *link = stamp->next;
+        free(stamp);
+        lfs->stamps.count--;
+    }
+}
+
+// After renaming from to to, with the entries of a folder
+static void stamp_rename(lfs_t *lfs, const char *from, const char *to, bool folder)
+{
+    struct lfs_stamps *stamps = &lfs->stamps;
+    if (stamps->count == 0 || strcmp(from, to) == 0)
+        return;
+    stamp_remove(lfs, to);
+    struct lfs_stamp *moved = NULL;
+    if (folder) {
+        size_t len = strlen(from);
+        for (size_t i = 0; i < stamps->capacity; i++) {
+            struct lfs_stamp **link = &stamps->buckets[i];
+            while (*link) {
+                struct lfs_stamp *stamp = *link;
+                if (strncmp(stamp->path, from, len) == 0 && (stamp->path[len] == '/' || stamp->path[len] == '\0')) {
+                    *link = stamp->next;
+                    stamps->count--;
+                    stamp->next = moved;
+                    moved = stamp;
+                } else {
+                    link = &stamp->next;
+                }
+            }
+        }
+    } else {
+        struct lfs_stamp **link = stamp_find(stamps, from);
+        if (*link) {
+            moved = *link;
+            *link = moved->next;
+            stamps->count--;
+            moved->next = NULL;
+        }
+    }
+    size_t len = strlen(from);
+    char path[LFS_MOCK_PATH_MAX];
+    while (moved) {
+        struct lfs_stamp *stamp = moved;
+        moved = stamp->next;
+        // a name too long for the host has no file either
+        int n = snprintf(path, sizeof(path), "%s%s", to, stamp->path + len);
+        if (n >= 0 && n < (int)sizeof(path))
+            stamp_set(lfs, path, stamp->time);
+        free(stamp);
+    }
+}
+
+// Drops the times, after setting them as the modification times of the host files
+static void stamps_clear(lfs_t *lfs, bool apply)
+{
+    struct lfs_stamps *stamps = &lfs->stamps;
+    for (size_t i = 0; i < stamps->capacity; i++) {
+        struct lfs_stamp *stamp = stamps->buckets[i];
+        while (stamp) {
+            struct lfs_stamp *next = stamp->next;
+            if (apply) {
+                struct utimbuf times;
+                times.modtime = (time_t)stamp->time;
+                times.actime = times.modtime;
+                utime(stamp->path, &times);
+            }
+            free(stamp);
+            stamp = next;
+        }
+    }
+    free(stamps->buckets);
+    stamps->buckets = NULL;
+    stamps->capacity = 0;
+    stamps->count = 0;
+}
+
+/*
+ * Power loss
+ *
+ * littlefs is copy-on-write: each change becomes visible at once with its
+ * metadata commit, written data with the commit of sync or close. While a
+ * power loss is simulated the host files do the same, the data of a file
+ * open for writing goes to a shadow file renamed over the file by the
+ * commit. The commit is charged before the host is changed, so a cut during
+ * the commit leaves the change out.
+ *
+ * The undo log records how to take each change back. Replaced and removed
+ * files are renamed into the power loss dir instead of deleted, so taking
+ * the snapshot copies nothing.
+ */
+enum lfs_powerloss_kind {
+    LFS_POWERLOSS_CREATED,      // path created, undone by removing it
+    LFS_POWERLOSS_MOVED,        // path renamed to to, undone by renaming back
+    LFS_POWERLOSS_REMOVED_DIR,  // empty folder path removed, undone by mkdir
+};
+
+struct lfs_powerloss_entry {
+    enum lfs_powerloss_kind kind;
+    char path[LFS_MOCK_PATH_MAX];
+    char to[LFS_MOCK_PATH_MAX];
+};
+
+static int powerloss_log(lfs_t *lfs, enum lfs_powerloss_kind kind, const char *path, const char *to)
+{
+    struct lfs_powerloss *p = &lfs->powerloss;
+    if (strlen(path) >= LFS_MOCK_PATH_MAX || (to && strlen(to) >= LFS_MOCK_PATH_MAX))
+        return LFS_ERR_NAMETOOLONG;
+    if (p->count == p->capacity) {
+        size_t capacity = p->capacity ? 2 * p->capacity : 64;
+        struct lfs_powerloss_entry *log = (struct lfs_powerloss_entry *)realloc(p->log, capacity * sizeof(*log));
+        if (log == NULL)
+            return LFS_ERR_NOMEM;
+        p->log = log;
+        p->capacity = capacity;
+    }
+    struct lfs_powerloss_entry *entry = &p->log[p->count++];
+    entry->kind = kind;
+    snprintf(entry->path, sizeof(entry->path), "%s", path);
+    snprintf(entry->to, sizeof(entry->to), "%s", to ? to : "");
+    return 0;
+}
+
+// The next saved file or shadow, name is LFS_MOCK_PATH_MAX long
+static int powerloss_name(lfs_t *lfs, char *name)
+{
+    int len = snprintf(name, LFS_MOCK_PATH_MAX, "%s%u", lfs->powerloss.dir, (unsigned)lfs->powerloss.saved++);
+    return len >= 0 && len < LFS_MOCK_PATH_MAX ? 0 : LFS_ERR_NAMETOOLONG;
+}
+
+// Moves the file at path aside
+static int powerloss_save(lfs_t *lfs, const char *path)
+{
+    char to[LFS_MOCK_PATH_MAX];
+    int rc = powerloss_name(lfs, to);
+    if (rc != 0)
+        return rc;
+    if (rename(path, to) != 0)
+        return LFS_ERR_IO;
+    return powerloss_log(lfs, LFS_POWERLOSS_MOVED, path, to);
+}
+
+// The metadata commit of a change, fails if the power is cut before it is done
+static int powerloss_commit(lfs_t *lfs)
+{
+    if (lfs->powerloss.lost)
+        return LFS_ERR_IO;
+    flash_commit(lfs);
+    return lfs->powerloss.lost ? LFS_ERR_IO : 0;
+}
+
+static int powerloss_remove(lfs_t *lfs, const char *path)
+{
+    struct stat buffer;
+    if (stat(path, &buffer) != 0)
+        return LFS_ERR_NOENT;
+    int rc = powerloss_commit(lfs);
+    if (rc != 0)
+        return rc;
+    if (S_ISDIR(buffer.st_mode)) {
+        if (rmdir(path) != 0)
+            return errno == ENOTEMPTY || errno == EEXIST ? LFS_ERR_NOTEMPTY : LFS_ERR_IO;
+        return powerloss_log(lfs, LFS_POWERLOSS_REMOVED_DIR, path, NULL);
+    }
+    capacity_release(lfs, path);
+    return powerloss_save(lfs, path);
+}
+
+static int powerloss_rename(lfs_t *lfs, const char *oldpath, const char *newpath)
+{
+    struct stat from, to;
+    if (stat(oldpath, &from) != 0)
+        return LFS_ERR_NOENT;
+    int replace = strcmp(oldpath, newpath) != 0 && stat(newpath, &to) == 0;
+    if (replace && S_ISDIR(from.st_mode) != S_ISDIR(to.st_mode))
+        return S_ISDIR(to.st_mode) ? LFS_ERR_ISDIR : LFS_ERR_NOTDIR;
+    int rc = powerloss_commit(lfs);
+    if (rc != 0)
+        return rc;
+    if (replace) {
+        if (S_ISDIR(to.st_mode)) {
+            if (rmdir(newpath) != 0)
+                return LFS_ERR_NOTEMPTY;
+            rc = powerloss_log(lfs, LFS_POWERLOSS_REMOVED_DIR, newpath, NULL);
+        } else {
+            capacity_release(lfs, newpath);
+            rc = powerloss_save(lfs, newpath);
+        }
+        if (rc != 0)
+            return rc;
+    }
+    if (rename(oldpath, newpath) != 0)
+        return LFS_ERR_IO;
+    return powerloss_log(lfs, LFS_POWERLOSS_MOVED, oldpath, newpath);
+}
+
+static int powerloss_mkdir(lfs_t *lfs, const char *path)
+{
+    int rc = powerloss_commit(lfs);
+    if (rc != 0)
+        return rc;
+    if (mkdir_host(path) != 0)
+        return errno == EEXIST ? LFS_ERR_EXIST : LFS_ERR_IO;
+    return powerloss_log(lfs, LFS_POWERLOSS_CREATED, path, NULL);
+}
+
+// Opens the file for writing on a shadow, the file itself is created empty
+static int powerloss_open(lfs_t *lfs, lfs_file_t *file, const char *path, const char *type, int created)
+{
+    if (created) {
+        int rc = powerloss_commit(lfs);
+        if (rc != 0)
+            return rc;
+        FILE *pFile = fopen(path, OM_WRITE_ONLY);
+        if (pFile == NULL)
+            return LFS_ERR_IO;
+        fclose(pFile);
+        rc = powerloss_log(lfs, LFS_POWERLOSS_CREATED, path, NULL);
+        if (rc != 0)
+            return rc;
+    }
+    int rc = powerloss_name(lfs, file->shadow);
+    if (rc != 0) {
+        file->shadow[0] = '\0';
+        return rc;
+    }
+    if (type[0] != 'w' && copy_host(path, file->shadow) != 0)
+        // written in place, the shadow starts as a copy
+        return LFS_ERR_IO;
+    file->pFile = fopen(file->shadow, type);
+    if (file->pFile == NULL) {
+        remove(file->shadow);
+        return LFS_ERR_IO;
+    }
+    if (type[0] == 'w')
+        // the truncation is committed on sync or close
+        file->flags |= LFS_F_DIRTY;
+    return 0;
+}
+
+// The shadow becomes the file, after the commit
+static int powerloss_replace(lfs_t *lfs, lfs_file_t *file)
+{
+    int rc;
+    struct stat buffer;
+    if (stat(file->path, &buffer) == 0 && (rc = powerloss_save(lfs, file->path)) != 0)
+        return rc;
+    if (rename(file->shadow, file->path) != 0)
+        return LFS_ERR_IO;
+    file->shadow[0] = '\0';
+    return powerloss_log(lfs, LFS_POWERLOSS_CREATED, file->path, NULL);
+}
+
+// Continues writing to a new shadow after lfs_file_sync committed the last one
+static int powerloss_reopen(lfs_t *lfs, lfs_file_t *file)
+{
+    lfs_soff_t pos = ftell64(file->pFile);
+    fclose(file->pFile);
+    file->pFile = NULL;
+    int rc = powerloss_name(lfs, file->shadow);
+    if (rc != 0) {
+        file->shadow[0] = '\0';
+        return rc;
+    }
+    if (copy_host(file->path, file->shadow) != 0)
+        return LFS_ERR_IO;
+    const char *type = OM_READ_WRITE;
+    if (file->flags & LFS_O_APPEND)
+        type = (file->flags & LFS_O_RDWR) == LFS_O_RDWR ? OM_APPEND_READ : OM_APPEND_ONLY;
+    file->pFile = fopen(file->shadow, type);
+    if (file->pFile == NULL || fseek64(file->pFile, pos, SEEK_SET) != 0)
+        return LFS_ERR_IO;
+    return 0;
+}
+
+static int powerloss_begin(lfs_t *lfs, uint64_t cut)
+{
+    struct lfs_powerloss *p = &lfs->powerloss;
+    if (p->active)
+        return LFS_ERR_INVAL;
+    // the times of the snapshot are the ones of the host files
+    stamps_clear(lfs, true);
+    // next to the test dir, rename() needs the same host file system
+    size_t len = strlen(lfs->test_dir);
+    if (len > 0 && lfs->test_dir[len - 1] == '/')
+        len--;
+    if (len + sizeof(".powerloss/") > sizeof(p->dir))
+        return LFS_ERR_NAMETOOLONG;
+    snprintf(p->dir, sizeof(p->dir), "%.*s.powerloss", (int)len, lfs->test_dir);
+    if (mkdir_host(p->dir) != 0 && errno != EEXIST)
+        return LFS_ERR_IO;
+    strcat(p->dir, "/");
+    p->active = true;
+    p->lost = false;
+    p->ops = 0;
+    p->cut = cut;
+    p->count = 0;
+    p->saved = 0;
+    return 0;
+}
+
+int lfs_powerloss_begin(lfs_t *lfs, uint64_t cut)
+{
+    lock(lfs, LOCK_EXCLUSIVE);
+    int rc = powerloss_begin(lfs, cut);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    return rc;
+}
+
+void lfs_powerloss_resume(lfs_t *lfs)
+{
+    lock(lfs, LOCK_EXCLUSIVE);
+    lfs->powerloss.lost = false;
+    lfs->powerloss.cut = LFS_POWERLOSS_NEVER;
+    unlock(lfs, LOCK_EXCLUSIVE);
+}
+
+static int powerloss_end(lfs_t *lfs)
+{
+    struct lfs_powerloss *p = &lfs->powerloss;
+    if (!p->active)
+        return LFS_ERR_INVAL;
+    int rc = 0;
+    while (p->count > 0) {
+        struct lfs_powerloss_entry *entry = &p->log[--p->count];
+        struct stat buffer;
+        switch (entry->kind) {
+        case LFS_POWERLOSS_CREATED:
+            if (stat(entry->path, &buffer) == 0 && S_ISDIR(buffer.st_mode) ? rmdir(entry->path) != 0 : remove(entry->path) != 0)
+                rc = LFS_ERR_IO;
+            break;
+        case LFS_POWERLOSS_MOVED:
+            if (rename(entry->to, entry->path) != 0)
+                rc = LFS_ERR_IO;
+            break;
+        case LFS_POWERLOSS_REMOVED_DIR:
+            if (mkdir_host(entry->path) != 0)
+                rc = LFS_ERR_IO;
+            break;
+        }
+    }
+    free(p->log);
+    p->log = NULL;
+    p->capacity = 0;
+    stamps_clear(lfs, false);
+
+    // shadows of files left open
+    DIR *pDir = opendir(p->dir);
+    if (pDir != NULL) {
+        struct dirent *pEntry;
+        while ((pEntry = readdir(pDir)) != NULL) {
+            char path[LFS_MOCK_PATH_MAX];
+            if (strcmp(pEntry->d_name, ".") == 0 || strcmp(pEntry->d_name, "..") == 0)
+                continue;
+            int len = snprintf(path, sizeof(path), "%s%s", p->dir, pEntry->d_name);
+            if (len >= 0 && len < (int)sizeof(path))
+                remove(path);
+        }
+        closedir(pDir);
+    }
+    rmdir(p->dir);
+    p->active = false;
+    p->lost = false;
+    if (lfs->limited)
+        lfs->used = fs_size(lfs);
+    return rc;
+}
+
+int lfs_powerloss_end(lfs_t *lfs)
+{
+    lock(lfs, LOCK_EXCLUSIVE);
+    int rc = powerloss_end(lfs);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    return rc;
+}
+
+/*
+ * io_uring
+ *
+ * The ring of the batches, see lfs_files_read(), set up with the raw system
+ * calls. Each step of a batch queues its calls, then one io_uring_enter()
+ * submits them all and waits for all of them, so a ring never has more
+ * calls in flight than entries and its completions never overflow.
+ */
+#if defined(LFS_MOCK_URING)
+#define URING_ENTRIES 64
+
+struct lfs_uring {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;           // Both rings with IORING_FEAT_SINGLE_MMAP
+    void *cq_map;
+    size_t sq_map_size;
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned queued;        // Calls queued since the last uring_run
+};
+
+static void uring_destroy(struct lfs_uring *ring)
+{
+    if (ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_size);
+    if (ring->sq_map != MAP_FAILED)
+        munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+    free(ring);
+}
+
+// NULL with errno set when the host has no io_uring for us
+static struct lfs_uring *uring_create(void)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (fd < 0)
+        return NULL;
+    struct lfs_uring *ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        if (ring->cq_map_size > ring->sq_map_size)
+            ring->sq_map_size = ring->cq_map_size;
+        ring->cq_map_size = ring->sq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd, IORING_OFF_SQ_RING);
+    ring->cq_map = ring->sq_map;
+    if (!single && ring->sq_map != MAP_FAILED)
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        int error = errno;
+        uring_destroy(ring);
+        errno = error;
+        return NULL;
+    }
+    char *sq = ring->sq_map;
+    char *cq = ring->cq_map;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+// Queues a call, its result goes to results[user_data] of uring_run
+static struct io_uring_sqe *uring_sqe(struct lfs_uring *ring, uint8_t opcode, int fd, uint64_t user_data)
+{
+    // only this thread moves the tail
+    unsigned index = (*ring->sq_tail + ring->queued++) & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    return sqe;
+}
+
+// Submits the queued calls with one system call and waits for all of them
+// Returns a negative errno when the ring broke, it can't be used any more.
+static int uring_run(struct lfs_uring *ring, int64_t *results)
+{
+    unsigned count = ring->queued;
+    unsigned submitted = 0;
+    unsigned completed = 0;
+    ring->queued = 0;
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + count, __ATOMIC_RELEASE);
+    while (completed < count) {
+        int rc = (int)syscall(__NR_io_uring_enter, ring->fd, count - submitted, count - completed,
+                              IORING_ENTER_GETEVENTS, NULL, 0);
+        if (rc < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            return -errno;
+        }
+        submitted += rc;
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, completed++) {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            results[cqe->user_data] = cqe->res;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// The cached ring, or a new one when another batch has it
+static struct lfs_uring *uring_take(lfs_t *lfs)
+{
+    if (__atomic_load_n(&lfs->uring_off, __ATOMIC_RELAXED))
+        return NULL;
+    struct lfs_uring *ring = __atomic_exchange_n(&lfs->uring, NULL, __ATOMIC_ACQUIRE);
+    if (ring)
+        return ring;
+    ring = uring_create();
+    if (ring == NULL && (errno == ENOSYS || errno == EPERM || errno == EINVAL))
+        // not built in, forbidden by seccomp or sysctl, or too old: don't ask again
+        __atomic_store_n(&lfs->uring_off, true, __ATOMIC_RELAXED);
+    return ring;
+}
+
+static void uring_give(lfs_t *lfs, struct lfs_uring *ring)
+{
+    struct lfs_uring *idle = NULL;
+    if (!__atomic_compare_exchange_n(&lfs->uring, &idle, ring, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        // another batch cached its ring first
+        uring_destroy(ring);
+}
+
+static void uring_release(lfs_t *lfs)
+{
+    struct lfs_uring *ring = __atomic_exchange_n(&lfs->uring, NULL, __ATOMIC_ACQUIRE);
+    if (ring)
+        uring_destroy(ring);
+}
+#endif
+
+int lfs_format(lfs_t *lfs, const struct lfs_config *config)
+{
+    // the constructor of LittleFSImpl clears lfs, create the lock here
+    lock_init(lfs);
+    lfs->cfg = config;
+    return 0;
+}
+int lfs_mount(lfs_t *lfs, const struct lfs_config *config)
+{
+    lock_init(lfs);
+    lock(lfs, LOCK_EXCLUSIVE);
+    lfs->cfg = config;
+    if (lfs->limited)
+        lfs->used = fs_size(lfs);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    return 0;
+}
+int lfs_unmount(lfs_t *lfs)
+{
+    if (!lfs->lock_ready)
+        return 0;
+    // wait for the calls still running
+    lock(lfs, LOCK_EXCLUSIVE);
+    unlock(lfs, LOCK_EXCLUSIVE);
+#if !defined(_WIN32)
+    pthread_rwlock_destroy(&lfs->lock);
+#endif
+    lfs->lock_ready = false;
+    stamps_clear(lfs, true);
+#if defined(LFS_MOCK_URING)
+    uring_release(lfs);
+#endif
+    return 0;
+}
+
+static int mock_remove(lfs_t *lfs, const char *path)
+{
+    char patched[LFS_MOCK_PATH_MAX];
+    path = patch_path(lfs, path, patched);
+    if (path == NULL)
+        return LFS_ERR_NAMETOOLONG;
+    int rc;
+    if (lfs->powerloss.active) {
+        rc = powerloss_remove(lfs, path);
+    } else {
+        capacity_release(lfs, path);
+        rc = remove(path);
+        if (rc == -1) {
+            rc = errno;
+            if (rc == EACCES)
+                rc = rmdir(path);
+        }
+        if (rc == 0)
+            flash_commit(lfs);
+    }
+    if (rc == 0)
+        stamp_remove(lfs, path);
+    return rc;
+}
+
+int lfs_remove(lfs_t *lfs, const char *path)
+{
+    struct lfs_trace_event event = { LFS_OP_REMOVE, path };
+    event.start_ns = lfs_clock_ns();
+    lock(lfs, LOCK_EXCLUSIVE);
+    event.result = mock_remove(lfs, path);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    record(lfs, &event, 0, event.result != 0);
+    return (int)event.result;
+}
+
+static int mock_rename(lfs_t *lfs, const char *oldpath, const char *newpath)
+{
+    char opp[LFS_MOCK_PATH_MAX], npp[LFS_MOCK_PATH_MAX];
+    const char *from = patch_path(lfs, oldpath, opp);
+    newpath = patch_path(lfs, newpath, npp);
+    if (from == NULL || newpath == NULL)
+        return LFS_ERR_NAMETOOLONG;
+    int rc;
+    if (lfs->powerloss.active) {
+        rc = powerloss_rename(lfs, from, newpath);
+    } else {
+        uint64_t used = lfs->used;
+        if (strcmp(from, newpath) != 0)
+            // an existing target is replaced
+            capacity_release(lfs, newpath);
+        rc = rename(from, newpath);
+        if (rc != 0)
+            lfs->used = used;
+        if (rc == 0)
+            flash_commit(lfs);
+    }
+    struct stat buffer;
+    if (rc == 0 && lfs->stamps.count > 0)
+        stamp_rename(lfs, from, newpath, stat(newpath, &buffer) == 0 && S_ISDIR(buffer.st_mode));
+    return rc;
+}
+
+int lfs_rename(lfs_t *lfs, const char *oldpath, const char *newpath)
+{
+    struct lfs_trace_event event = { LFS_OP_RENAME, oldpath };
+    event.target = newpath;
+    event.start_ns = lfs_clock_ns();
+    lock(lfs, LOCK_EXCLUSIVE);
+    event.result = mock_rename(lfs, oldpath, newpath);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    record(lfs, &event, 0, event.result != 0);
+    return (int)event.result;
+}
+
+static int mock_stat(lfs_t *lfs, const char *path, struct lfs_info *info)
+{
+    char patched[LFS_MOCK_PATH_MAX];
+    path = patch_path(lfs, path, patched);
+    if (path == NULL)
+        return LFS_ERR_NAMETOOLONG;
+
+    struct stat buffer;
+
+    flash_lookup(lfs);
+    int rc = stat(path, &buffer);
+    if(rc == 0)
+    {
+        if (S_ISDIR(buffer.st_mode))
+            info->type = LFS_TYPE_DIR;
+        else
+            info->type = LFS_TYPE_REG;
+    }
+    return rc;
+}
+
+int lfs_stat(lfs_t *lfs, const char *path, struct lfs_info *info)
+{
+    struct lfs_trace_event event = { LFS_OP_STAT, path };
+    event.start_ns = lfs_clock_ns();
+    // lock free calls start the call themselves
+    begin_call();
+    event.result = mock_stat(lfs, path, info);
+    record(lfs, &event, 0, event.result != 0);
+    return (int)event.result;
+}
+
+/*
+ * Attributes
+ *
+ * Only the last write time 't' of LittleFS is kept, see the last write times
+ * above, the modification time of the host file until one is set. There is
+ * no settable creation time on the host.
+ */
+static lfs_ssize_t mock_getattr(lfs_t *lfs, const char *path, uint8_t type, void *buffer, lfs_size_t size)
+{
+    char patched[LFS_MOCK_PATH_MAX];
+    path = patch_path(lfs, path, patched);
+    memset(buffer, 0, size);
+    if (path == NULL)
+        return LFS_ERR_NAMETOOLONG;
+    struct stat st;
+    if (type != 't')
+        return LFS_ERR_NOATTR;
+    flash_lookup(lfs);
+    if (stat(path, &st) != 0)
+        return LFS_ERR_NOENT;
+    int64_t t;
+    if (!stamp_get(lfs, path, &t))
+        t = st.st_mtime;
+    memcpy(buffer, &t, size < sizeof(t) ? size : sizeof(t));
+    return sizeof(t);
+}
+
+lfs_ssize_t lfs_getattr(lfs_t *lfs, const char *path, uint8_t type, void *buffer, lfs_size_t size)
+{
+    lock(lfs, LOCK_SHARED);
+    lfs_ssize_t rc = mock_getattr(lfs, path, type, buffer, size);
+    unlock(lfs, LOCK_SHARED);
+    return rc;
+}
+
+static int mock_setattr(lfs_t *lfs, const char *path, uint8_t type, const void *buffer, lfs_size_t size)
+{
+    char patched[LFS_MOCK_PATH_MAX];
+    path = patch_path(lfs, path, patched);
+    if (path == NULL)
+        return LFS_ERR_NAMETOOLONG;
+    int rc = 0;
+    if (lfs->powerloss.active)
+        rc = powerloss_commit(lfs);
+    else
+        flash_commit(lfs);
+    if (rc != 0 || type != 't')
+        return rc;
+
+    int64_t t;
+    if (size >= sizeof(int64_t)) {
+        memcpy(&t, buffer, sizeof(t));
+    } else if (size == sizeof(uint32_t)) {
+        uint32_t t32;
+        memcpy(&t32, buffer, sizeof(t32));
+        t = t32;
+    } else {
+        return LFS_ERR_INVAL;
+    }
+    if (lfs->lock_ready)
+        // not looked up, lfs_getattr of a missing path fails before the time
+        return stamp_set(lfs, path, t);
+    // unmounted, e.g. a file closed after lfs_unmount, nothing keeps the time
+    struct utimbuf times;
+    times.modtime = (time_t)t;
+    times.actime = times.modtime;
+    return utime(path, &times) == 0 ? 0 : LFS_ERR_NOENT;
+}
+
+int lfs_setattr(lfs_t *lfs, const char *path, uint8_t type, const void *buffer, lfs_size_t size)
+{
+    lock(lfs, LOCK_EXCLUSIVE);
+    int rc = mock_setattr(lfs, path, type, buffer, size);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    return rc;
+}
+
+int lfs_removeattr(lfs_t *lfs, const char *path, uint8_t type)
+{
+    return 0;
+}
+
+static int mock_file_open(lfs_t *lfs, lfs_file_t *file, const char *path, int flags)
+{
+    char patched[LFS_MOCK_PATH_MAX];
+    path = patch_path(lfs, path, patched);
+    if (path == NULL) {
+        file->path[0] = '\0';
+        return LFS_ERR_NAMETOOLONG;
+    }
+    strcpy(file->path, path);
+    /*
+    LFS_O_RDONLY = 1,         // Open a file as read only
+    LFS_O_WRONLY = 2,         // Open a file as write only
+    LFS_O_RDWR   = 3,         // Open a file as read and write
+    LFS_O_CREAT  = 0x0100,    // Create a file if it does not exist
+    LFS_O_EXCL   = 0x0200,    // Fail if a file already exists
+    LFS_O_TRUNC  = 0x0400,    // Truncate the existing file to zero size
+    LFS_O_APPEND = 0x0800,    // Move to end of file on every write
+     */
+    const char *type = OM_READ_ONLY;
+    if ((flags & LFS_O_RDWR) == LFS_O_RDWR)
+    {
+        if (flags & LFS_O_APPEND)
+            type = OM_APPEND_READ;
+        else
+        if (flags & LFS_O_CREAT)
+            type = OM_WRITE_READ;
+        else
+            type = OM_READ_WRITE;
+    }
+    else if ((flags & LFS_O_RDONLY) == LFS_O_RDONLY)
+    {
+        type = OM_READ_ONLY;
+    }
+    else if ((flags & LFS_O_WRONLY) == LFS_O_WRONLY)
+    {
+        if (flags & LFS_O_APPEND)
+            type = OM_APPEND_ONLY;
+        else
+            type = OM_WRITE_ONLY;
+    }
+    if (lfs->powerloss.lost)
+        return LFS_ERR_IO;
+    flash_lookup(lfs);
+    struct stat buffer;
+    int exists = stat(path, &buffer) == 0;
+    int created = (flags & LFS_O_CREAT) && !exists;
+    if (created && lfs->limited && blocks_free(lfs) == 0)
+        // no room for the metadata of another file
+        return LFS_ERR_NOSPC;
+
+    file->flags = flags;
+    file->block = 0;
+    file->shadow[0] = '\0';
+    if (lfs->powerloss.active && (flags & LFS_O_WRONLY)) {
+        if (exists && S_ISDIR(buffer.st_mode))
+            return LFS_ERR_ISDIR;
+        if (!exists && !(flags & LFS_O_CREAT))
+            return LFS_ERR_NOENT;
+        if (exists && (flags & LFS_O_EXCL))
+            return LFS_ERR_EXIST;
+        int rc = powerloss_open(lfs, file, path, type, created);
+        if (rc != 0)
+            return rc;
+    } else {
+        file->pFile = fopen(path, type);
+        if (file->pFile == NULL)
+            return -1;
+    }
+    if (lfs->limited) {
+        file->size = exists && S_ISREG(buffer.st_mode) ? buffer.st_size : 0;
+        if (type[0] == 'w')
+            // opened with truncation
+            capacity_resize(lfs, file, 0);
+    }
+    if (!lfs->powerloss.active && (created || (flags & LFS_O_TRUNC)))
+        flash_commit(lfs);
+    return 0;
+}
+
+int lfs_file_open(lfs_t *lfs, lfs_file_t *file, const char *path, int flags)
+{
+    struct lfs_trace_event event = { LFS_OP_OPEN, path };
+    event.flags = flags;
+    event.start_ns = lfs_clock_ns();
+    // opening for writing may create or truncate
+    enum lock_mode mode = flags & (LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) ? LOCK_EXCLUSIVE : LOCK_SHARED;
+    lock(lfs, mode);
+    event.result = mock_file_open(lfs, file, path, flags);
+    unlock(lfs, mode);
+    record(lfs, &event, 0, event.result != 0);
+    return (int)event.result;
+}
+
+int lfs_file_opencfg(lfs_t *lfs, lfs_file_t *file, const char *path, int flags, const struct lfs_file_config *config)
+{
+    return lfs_file_open(lfs, file, path, flags);
+}
+
+static int sync_host(lfs_t *lfs, lfs_file_t *file)
+{
+    if (!(file->flags & LFS_O_WRONLY))
+        // nothing written, nothing to sync
+        return 0;
+
+    switch (lfs->durability)
+    {
+    case LFS_DURABILITY_NONE:
+        return 0;
+    case LFS_DURABILITY_FDATASYNC:
+    case LFS_DURABILITY_FSYNC:
+        if (fflush(file->pFile) != 0)
+            return LFS_ERR_IO;
+#if defined(_WIN32)
+        return _commit(_fileno(file->pFile)) == 0 ? 0 : LFS_ERR_IO;
+#elif defined(__APPLE__)
+        return fsync(fileno(file->pFile)) == 0 ? 0 : LFS_ERR_IO;
+#else
+        if (lfs->durability == LFS_DURABILITY_FDATASYNC)
+            return fdatasync(fileno(file->pFile)) == 0 ? 0 : LFS_ERR_IO;
+        return fsync(fileno(file->pFile)) == 0 ? 0 : LFS_ERR_IO;
+#endif
+    case LFS_DURABILITY_FLUSH:
+    default:
+        return fflush(file->pFile) == 0 ? 0 : LFS_ERR_IO;
+    }
+}
+
+static int mock_file_close(lfs_t *lfs, lfs_file_t *file)
+{
+    FILE *pFile = file->pFile;
+    if (file->shadow[0]) {
+        int rc = 0;
+        if (file->flags & LFS_F_DIRTY)
+            rc = powerloss_commit(lfs);
+        file->pFile = NULL;
+        if (fclose(pFile) != 0 && rc == 0)
+            rc = LFS_ERR_IO;
+        if (rc == 0 && (file->flags & LFS_F_DIRTY))
+            return powerloss_replace(lfs, file);
+        // uncommitted data is lost
+        remove(file->shadow);
+        file->shadow[0] = '\0';
+        return rc;
+    }
+    if (file->flags & LFS_F_DIRTY)
+        flash_commit(lfs);
+    // fclose() flushes the stdio buffers anyway, only the barriers are left
+    int rc = 0;
+    if (lfs->durability == LFS_DURABILITY_FDATASYNC || lfs->durability == LFS_DURABILITY_FSYNC)
+        rc = sync_host(lfs, file);
+    file->pFile = NULL;
+    if (fclose(pFile) != 0)
+        return LFS_ERR_IO;
+    return rc;
+}
+
+int lfs_file_close(lfs_t *lfs, lfs_file_t *file)
+{
+    struct lfs_trace_event event = { LFS_OP_CLOSE, file->path };
+    event.start_ns = lfs_clock_ns();
+    enum lock_mode mode = file_lock_mode(file);
+    lock(lfs, mode);
+    event.result = mock_file_close(lfs, file);
+    unlock(lfs, mode);
+    record(lfs, &event, 0, event.result != 0);
+    return (int)event.result;
+}
+
+static int mock_file_sync(lfs_t *lfs, lfs_file_t *file)
+{
+    if (file->shadow[0]) {
+        if (!(file->flags & LFS_F_DIRTY))
+            return 0;
+        int rc = powerloss_commit(lfs);
+        if (rc != 0)
+            return rc;
+        if (fflush(file->pFile) != 0)
+            return LFS_ERR_IO;
+        file->flags &= ~LFS_F_DIRTY;
+        rc = powerloss_replace(lfs, file);
+        if (rc != 0)
+            return rc;
+        return powerloss_reopen(lfs, file);
+    }
+    if (file->flags & LFS_F_DIRTY) {
+        flash_commit(lfs);
+        file->flags &= ~LFS_F_DIRTY;
+    }
+    return sync_host(lfs, file);
+}
+
+int lfs_file_sync(lfs_t *lfs, lfs_file_t *file)
+{
+    struct lfs_trace_event event = { LFS_OP_SYNC, file->path };
+    event.start_ns = lfs_clock_ns();
+    enum lock_mode mode = file_lock_mode(file);
+    lock(lfs, mode);
+    event.result = mock_file_sync(lfs, file);
+    unlock(lfs, mode);
+    record(lfs, &event, 0, event.result != 0);
+    return (int)event.result;
+}
+
+static lfs_ssize_t mock_file_read(lfs_t *lfs, lfs_file_t *file, void *buffer, lfs_size_t size)
+{
+    lfs_size_t count = fread(buffer, 1, size, file->pFile);
+    flash_read(lfs, count);
+    return count;
+}
+
+lfs_ssize_t lfs_file_read(lfs_t *lfs, lfs_file_t *file, void *buffer, lfs_size_t size)
+{
+    struct lfs_trace_event event = { LFS_OP_READ, file->path };
+    event.offset = lfs->trace ? ftell64(file->pFile) : 0;
+    event.length = size;
+    event.start_ns = lfs_clock_ns();
+    lock(lfs, LOCK_SHARED);
+    event.result = mock_file_read(lfs, file, buffer, size);
+    unlock(lfs, LOCK_SHARED);
+    record(lfs, &event, event.result > 0 ? event.result : 0, event.result < 0);
+    return (lfs_ssize_t)event.result;
+}
+
+static lfs_ssize_t mock_file_write(lfs_t *lfs, lfs_file_t *file, const void *buffer, lfs_size_t size)
+{
+    if (lfs->powerloss.lost)
+        return LFS_ERR_IO;
+    if (lfs->limited && size > 0) {
+        lfs_off_t pos = (file->flags & LFS_O_APPEND) ? file->size : (lfs_off_t)ftell64(file->pFile);
+        lfs_off_t end = capacity_fit(lfs, file, pos + size);
+        if (end <= pos)
+            return LFS_ERR_NOSPC;
+        // short write, like the device running out of blocks
+        size = end - pos;
+    }
+    lfs_size_t count = fwrite(buffer, 1, size, file->pFile);
+    if (count > 0) {
+        // the position after the write also covers append mode
+        lfs_off_t end = ftell64(file->pFile);
+        flash_write(lfs, file, end - count, count);
+        file->flags |= LFS_F_DIRTY;
+        if (lfs->limited && end > file->size)
+            capacity_resize(lfs, file, end);
+    }
+    return count;
+}
+
+lfs_ssize_t lfs_file_write(lfs_t *lfs, lfs_file_t *file, const void *buffer, lfs_size_t size)
+{
+    struct lfs_trace_event event = { LFS_OP_WRITE, file->path };
+    event.offset = lfs->trace ? ftell64(file->pFile) : 0;
+    event.length = size;
+    event.start_ns = lfs_clock_ns();
+    lock(lfs, LOCK_EXCLUSIVE);
+    event.result = mock_file_write(lfs, file, buffer, size);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    record(lfs, &event, event.result > 0 ? event.result : 0, event.result < 0);
+    return (lfs_ssize_t)event.result;
+}
+
+static lfs_soff_t mock_file_seek(lfs_t *lfs, lfs_file_t *file, lfs_soff_t off, int whence)
+{
+    if (fseek64(file->pFile, off, whence) != 0)
+        return LFS_ERR_INVAL;
+    return ftell64(file->pFile);
+}
+
+lfs_soff_t lfs_file_seek(lfs_t *lfs, lfs_file_t *file, lfs_soff_t off, int whence)
+{
+    struct lfs_trace_event event = { LFS_OP_SEEK, file->path };
+    event.offset = off;
+    event.flags = whence;
+    event.start_ns = lfs_clock_ns();
+    lock(lfs, LOCK_SHARED);
+    event.result = mock_file_seek(lfs, file, off, whence);
+    unlock(lfs, LOCK_SHARED);
+    record(lfs, &event, 0, event.result < 0);
+    return (lfs_soff_t)event.result;
+}
+
+static int mock_file_truncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size)
+{
+    if (lfs->powerloss.lost)
+        return LFS_ERR_IO;
+    // drop buffered data first, otherwise it lands behind the new end of file
+    if (fflush(file->pFile) != 0)
+        return LFS_ERR_IO;
+    if (capacity_fit(lfs, file, size) < size)
+        return LFS_ERR_NOSPC;
+    lfs_soff_t old_size = lfs_file_size(lfs, file);
+#if defined(_WIN32)
+    int rc = _chsize_s(_fileno(file->pFile), size) == 0 ? 0 : LFS_ERR_IO;
 #else
-    #define OM_APPEND_ONLY "a"
-    #define OM_APPEND_READ "a+"
-    #define OM_READ_ONLY   "r"
-    #define OM_READ_WRITE  "r+"
-    #define OM_WRITE_ONLY  "w"
-    #define OM_WRITE_READ  "w+"
+    int rc = ftruncate(fileno(file->pFile), size);
 #endif
+    if (rc == 0) {
+        // growing writes zeros
+        if (old_size >= 0 && size > (lfs_off_t)old_size)
+            flash_write(lfs, file, old_size, size - old_size);
+        file->flags |= LFS_F_DIRTY;
+        capacity_resize(lfs, file, size);
+    }
+    return rc;
+}
 
-char path_buffer [512];
-const char* patch_path(lfs_t *lfs, const char* path)
+int lfs_file_truncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size)
 {
-    if ( strncmp(lfs->test_dir, path, strlen(lfs->test_dir)) == 0)
-        // already patched
-        return path;
-
-    strcpy(path_buffer, lfs->test_dir);
-    strcat(path_buffer, path);
-    return path_buffer;
+    struct lfs_trace_event event = { LFS_OP_TRUNCATE, file->path };
+    event.length = size;
+    event.start_ns = lfs_clock_ns();
+    lock(lfs, LOCK_EXCLUSIVE);
+    event.result = mock_file_truncate(lfs, file, size);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    record(lfs, &event, 0, event.result != 0);
+    return (int)event.result;
 }
 
-int lfs_format(lfs_t *lfs, const struct lfs_config *config)
+static int mock_file_reserve(lfs_t *lfs, lfs_file_t *file, lfs_off_t size)
 {
+    if (fflush(file->pFile) != 0)
+        return LFS_ERR_IO;
+#if defined(__linux__)
+    // keep the visible size, only allocate the extents behind it
+    if (fallocate(fileno(file->pFile), FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+        // not every host file system can preallocate, the reservation is a hint only
+        if (errno == EOPNOTSUPP || errno == ENOSYS)
+            return 0;
+        return errno == EBADF ? LFS_ERR_BADF : LFS_ERR_IO;
+    }
+    return 0;
+#else
+    // no preallocation without changing the file size available, ignore the hint
     return 0;
+#endif
 }
-int lfs_mount(lfs_t *lfs, const struct lfs_config *config)
+
+int lfs_file_reserve(lfs_t *lfs, lfs_file_t *file, lfs_off_t size)
 {
-    return 0;
+    lock(lfs, LOCK_EXCLUSIVE);
+    int rc = mock_file_reserve(lfs, file, size);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    return rc;
 }
-int lfs_unmount(lfs_t *lfs)
+
+lfs_soff_t lfs_file_tell(lfs_t *lfs, lfs_file_t *file)
 {
-    return 0;
+    return ftell64(file->pFile);
 }
 
-int lfs_remove(lfs_t *lfs, const char *path)
+int lfs_file_rewind(lfs_t *lfs, lfs_file_t *file)
 {
-    path = patch_path(lfs, path);
-    int rc = remove(path);
-    if (rc == -1) {
-        rc = errno;
-        if (rc == EACCES)
-            return rmdir(path);
-        return rc;
-    }
+    rewind(file->pFile);
     return 0;
 }
-int lfs_rename(lfs_t *lfs, const char *oldpath, const char *newpath)
+
+lfs_soff_t lfs_file_size(lfs_t *lfs, lfs_file_t *file)
 {
-    char opp[512];
-    strcpy(opp, patch_path(lfs, oldpath));
-    newpath = patch_path(lfs, newpath);
-    return rename(opp, newpath);
+    lfs_soff_t prev = ftell64(file->pFile);
+    fseek64(file->pFile, 0L, SEEK_END);
+    lfs_soff_t sz = ftell64(file->pFile);
+    fseek64(file->pFile, prev, SEEK_SET); //go back to where we were
+    return sz;
 }
-int lfs_stat(lfs_t *lfs, const char *path, struct lfs_info *info)
+
+/*
+ * Batches
+ *
+ * lfs_files_read() and lfs_files_write() move whole files in three steps:
+ * open all files, read or write them all, close them all. With io_uring a
+ * step is one system call for up to BATCH_FILES files, which the kernel
+ * runs overlapped. The ring is set up by the first batch and cached until
+ * lfs_unmount, a batch running at the same time sets up its own. Calls the
+ * ring refuses, e.g. on kernels before 5.6, and hosts without it take the
+ * plain calls of lfs_file_open() and friends, one file after the other.
+ * Either way each file is counted as an open, a read or write and a close,
+ * a step of the ring charges each of its calls an equal share.
+ */
+#define BATCH_PENDING 1     // Result of a file not done yet
+#define BATCH_FILES 32      // Files per step, up to two calls each
+
+static int host_error(int error)
+{
+    switch (error)
+    {
+    case ENOENT:
+        return LFS_ERR_NOENT;
+    case ENOTDIR:
+        return LFS_ERR_NOTDIR;
+    case EISDIR:
+        return LFS_ERR_ISDIR;
+    case ENOSPC:
+        return LFS_ERR_NOSPC;
+    case ENOMEM:
+        return LFS_ERR_NOMEM;
+    case EFBIG:
+        return LFS_ERR_FBIG;
+    case ENAMETOOLONG:
+        return LFS_ERR_NAMETOOLONG;
+    default:
+        return LFS_ERR_IO;
+    }
+}
+
+static void *batch_malloc(void *context, struct lfs_batch_file *file, lfs_size_t size)
 {
-    path = patch_path(lfs, path);
+    (void)context;
+    (void)file;
+    // no NULL for empty files
+    return malloc(size ? size : 1);
+}
 
+// The plain calls of a file of lfs_files_read
+static int file_read_whole(lfs_t *lfs, struct lfs_batch_file *f, lfs_batch_alloc_t alloc, void *context)
+{
+    char patched[LFS_MOCK_PATH_MAX];
+    const char *path = patch_path(lfs, f->path, patched);
+    if (path == NULL)
+        return LFS_ERR_NAMETOOLONG;
+    lfs_file_t file;
     struct stat buffer;
-    
-    int rc = stat(path, &buffer);
-    if(rc == 0)
-    {
-        if (S_ISDIR(buffer.st_mode))
-            info->type = LFS_TYPE_DIR;
-        else
-            info->type = LFS_TYPE_REG;
+    struct lfs_trace_event event = { LFS_OP_OPEN, path };
+    event.flags = LFS_O_RDONLY;
+    event.start_ns = lfs_clock_ns();
+    if (stat(path, &buffer) != 0)
+        event.result = host_error(errno);
+    else if (S_ISDIR(buffer.st_mode))
+        event.result = LFS_ERR_ISDIR;
+    else if (buffer.st_size > INT32_MAX)
+        // more than a read returns
+        event.result = LFS_ERR_FBIG;
+    else if (mock_file_open(lfs, &file, path, LFS_O_RDONLY) != 0)
+        event.result = host_error(errno);
+    else
+        event.result = 0;
+    record(lfs, &event, 0, event.result != 0);
+    if (event.result != 0)
+        return (int)event.result;
+
+    int rc = 0;
+    lfs_size_t size = (lfs_size_t)buffer.st_size;
+    f->buffer = alloc(context, f, size);
+    if (f->buffer == NULL) {
+        rc = LFS_ERR_NOMEM;
+    } else {
+        struct lfs_trace_event read = { LFS_OP_READ, path };
+        read.length = size;
+        read.start_ns = lfs_clock_ns();
+        read.result = mock_file_read(lfs, &file, f->buffer, size);
+        record(lfs, &read, read.result > 0 ? read.result : 0, read.result < 0);
+        // shorter when the file shrank meanwhile
+        f->size = read.result > 0 ? (lfs_size_t)read.result : 0;
     }
+    struct lfs_trace_event close = { LFS_OP_CLOSE, path };
+    close.start_ns = lfs_clock_ns();
+    close.result = mock_file_close(lfs, &file);
+    record(lfs, &close, 0, close.result != 0);
     return rc;
 }
-lfs_ssize_t lfs_getattr(lfs_t *lfs, const char *path, uint8_t type, void *buffer, lfs_size_t size)
+
+// The plain calls of a file of lfs_files_write
+static int file_write_whole(lfs_t *lfs, struct lfs_batch_file *f)
 {
-    return 0;
+    char patched[LFS_MOCK_PATH_MAX];
+    const char *path = patch_path(lfs, f->path, patched);
+    if (path == NULL)
+        return LFS_ERR_NAMETOOLONG;
+    lfs_file_t file;
+    struct lfs_trace_event event = { LFS_OP_OPEN, path };
+    event.flags = LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC;
+    event.start_ns = lfs_clock_ns();
+    event.result = mock_file_open(lfs, &file, path, (int)event.flags);
+    if (event.result == -1)
+        // from fopen()
+        event.result = host_error(errno);
+    record(lfs, &event, 0, event.result != 0);
+    if (event.result != 0)
+        return (int)event.result;
+
+    int rc = 0;
+    if (f->size) {
+        struct lfs_trace_event write = { LFS_OP_WRITE, path };
+        write.length = f->size;
+        write.start_ns = lfs_clock_ns();
+        write.result = mock_file_write(lfs, &file, f->buffer, f->size);
+        record(lfs, &write, write.result > 0 ? write.result : 0, write.result < 0);
+        if (write.result < 0)
+            rc = (int)write.result;
+        else if ((lfs_size_t)write.result < f->size)
+            rc = lfs->limited ? LFS_ERR_NOSPC : LFS_ERR_IO;
+    }
+    struct lfs_trace_event close = { LFS_OP_CLOSE, path };
+    close.start_ns = lfs_clock_ns();
+    close.result = mock_file_close(lfs, &file);
+    record(lfs, &close, 0, close.result != 0);
+    return rc != 0 ? rc : (int)close.result;
 }
 
-int lfs_setattr(lfs_t *lfs, const char *path, uint8_t type, const void *buffer, lfs_size_t size)
+#if defined(LFS_MOCK_URING)
+// A file of a step on the ring
+struct batch_slot {
+    struct lfs_batch_file *file;
+    char path[LFS_MOCK_PATH_MAX];
+    struct statx stx;
+    int fd;                 // Open until the close step, -1 if not
+    int64_t moved;          // Bytes read or written, or -errno
+    int64_t synced;         // Result of the fsync, 0 without
+    bool queued;            // Pending, its path fits
+};
+
+// Counts the call of a step, which took ns for all count calls of the step
+static void record_step(lfs_t *lfs, struct lfs_trace_event *event, uint64_t bytes, uint64_t ns, size_t count)
 {
-    return 0;
+    record_ns(lfs, event, bytes, event->result < 0, count ? ns / count : ns);
 }
 
-int lfs_removeattr(lfs_t *lfs, const char *path, uint8_t type)
+// Ops the kernel does not know, those files take the plain calls
+static int uring_refused(int64_t result)
 {
-    return 0;
+    return result == -EINVAL || result == -EOPNOTSUPP;
 }
 
-int lfs_file_open(lfs_t *lfs, lfs_file_t *file, const char *path, int flags)
+// Closes the files of the slots, the ring broke
+static void uring_abandon(struct batch_slot *slots, size_t count)
 {
-    path = patch_path(lfs, path);
-    /*
-    LFS_O_RDONLY = 1,         // Open a file as read only
-    LFS_O_WRONLY = 2,         // Open a file as write only
-    LFS_O_RDWR   = 3,         // Open a file as read and write
-    LFS_O_CREAT  = 0x0100,    // Create a file if it does not exist
-    LFS_O_EXCL   = 0x0200,    // Fail if a file already exists
-    LFS_O_TRUNC  = 0x0400,    // Truncate the existing file to zero size
-    LFS_O_APPEND = 0x0800,    // Move to end of file on every write
-     */
-    const char *type;
-    if ((flags & LFS_O_RDWR) == LFS_O_RDWR)
-    {
-        if (flags & LFS_O_APPEND)
-            type = OM_APPEND_READ;
-        else
-        if (flags & LFS_O_CREAT)
-            type = OM_WRITE_READ;
+    for (size_t i = 0; i < count; i++) {
+        if (slots[i].fd >= 0)
+            close(slots[i].fd);
+        slots[i].fd = -1;
+    }
+}
+
+// The close step, the result of each close goes to results[i]
+static int uring_close_step(lfs_t *lfs, struct lfs_uring *ring, struct batch_slot *slots, size_t count,
+                            int64_t *results, uint64_t *ns)
+{
+    uint64_t start_ns = lfs_clock_ns();
+    for (size_t i = 0; i < count; i++) {
+        results[i] = 0;
+        if (slots[i].fd >= 0)
+            uring_sqe(ring, IORING_OP_CLOSE, slots[i].fd, i);
+    }
+    int rc = uring_run(ring, results);
+    for (size_t i = 0; i < count && rc == 0; i++) {
+        if (slots[i].fd >= 0 && uring_refused(results[i]))
+            results[i] = close(slots[i].fd) == 0 ? 0 : -errno;
+    }
+    *ns = lfs_clock_ns() - start_ns;
+    for (size_t i = 0; i < count && rc != 0; i++)
+        // some may be closed, their numbers reused already: leak the others
+        slots[i].fd = -1;
+    return rc;
+}
+
+// Reads the files with three system calls, leaves those the ring refused pending
+static int uring_files_read(lfs_t *lfs, struct lfs_uring *ring, struct batch_slot *slots,
+                            struct lfs_batch_file *files, size_t count, lfs_batch_alloc_t alloc, void *context)
+{
+    int64_t results[URING_ENTRIES];
+
+    // open and size every file
+    uint64_t start_ns = lfs_clock_ns();
+    for (size_t i = 0; i < count; i++) {
+        struct batch_slot *s = &slots[i];
+        s->file = &files[i];
+        s->fd = -1;
+        s->moved = 0;
+        s->queued = files[i].result == BATCH_PENDING;
+        if (!s->queued)
+            continue;
+        const char *path = patch_path(lfs, files[i].path, s->path);
+        if (path != s->path)
+            snprintf(s->path, sizeof(s->path), "%s", path);
+        struct io_uring_sqe *sqe = uring_sqe(ring, IORING_OP_OPENAT, AT_FDCWD, 2 * i);
+        sqe->addr = (uintptr_t)s->path;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe = uring_sqe(ring, IORING_OP_STATX, AT_FDCWD, 2 * i + 1);
+        sqe->addr = (uintptr_t)s->path;
+        sqe->len = STATX_TYPE | STATX_SIZE;
+        sqe->off = (uintptr_t)&s->stx;
+    }
+    int rc = uring_run(ring, results);
+    if (rc != 0)
+        return rc;
+    uint64_t open_ns = lfs_clock_ns() - start_ns;
+    size_t opens = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct batch_slot *s = &slots[i];
+        int64_t fd = results[2 * i];
+        int64_t sized = results[2 * i + 1];
+        if (!s->queued || uring_refused(fd))
+            continue;
+        if (fd >= 0 && sized < 0) {
+            // sized by path, the file changed meanwhile or statx was refused
+            struct stat buffer;
+            if (fstat((int)fd, &buffer) == 0) {
+                s->stx.stx_mode = buffer.st_mode;
+                s->stx.stx_size = buffer.st_size;
+                sized = 0;
+            }
+        }
+        struct lfs_trace_event event = { LFS_OP_OPEN, s->path };
+        event.flags = LFS_O_RDONLY;
+        event.start_ns = start_ns;
+        if (fd < 0)
+            event.result = host_error((int)-fd);
+        else if (sized < 0)
+            event.result = host_error((int)-sized);
+        else if (S_ISDIR(s->stx.stx_mode))
+            event.result = LFS_ERR_ISDIR;
+        else if (s->stx.stx_size > INT32_MAX)
+            event.result = LFS_ERR_FBIG;
         else
-            type = OM_READ_WRITE;
+            event.result = 0;
+        if (event.result != 0 && fd >= 0)
+            close((int)fd);
+        else if (fd >= 0)
+            s->fd = (int)fd;
+        s->file->result = (int)event.result;
+        flash_lookup(lfs);
+        record_step(lfs, &event, 0, open_ns, count);
+        opens++;
     }
-    else if ((flags & LFS_O_RDONLY) == LFS_O_RDONLY)
-    {
-        type = OM_READ_ONLY;
+
+    // read them
+    start_ns = lfs_clock_ns();
+    size_t reads = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct batch_slot *s = &slots[i];
+        if (s->fd < 0)
+            continue;
+        lfs_size_t size = (lfs_size_t)s->stx.stx_size;
+        s->file->buffer = alloc(context, s->file, size);
+        if (s->file->buffer == NULL) {
+            s->file->result = LFS_ERR_NOMEM;
+            continue;
+        }
+        s->file->size = size;
+        if (size) {
+            struct io_uring_sqe *sqe = uring_sqe(ring, IORING_OP_READ, s->fd, i);
+            sqe->addr = (uintptr_t)s->file->buffer;
+            sqe->len = size;
+            sqe->off = 0;
+            reads++;
+        }
     }
-    else if ((flags & LFS_O_WRONLY) == LFS_O_WRONLY)
-    {
-        if (flags & LFS_O_APPEND)
-            type = OM_APPEND_ONLY;
+    for (size_t i = 0; i < count; i++)
+        results[i] = 0;
+    rc = uring_run(ring, results);
+    if (rc != 0) {
+        uring_abandon(slots, count);
+        return rc;
+    }
+    uint64_t read_ns = lfs_clock_ns() - start_ns;
+    for (size_t i = 0; i < count; i++) {
+        struct batch_slot *s = &slots[i];
+        if (s->fd < 0 || s->file->buffer == NULL)
+            continue;
+        int64_t moved = results[i];
+        // the rest of a short read, or all of it when the file shrank
+        while (moved >= 0 && moved < s->file->size) {
+            ssize_t count = pread(s->fd, (char *)s->file->buffer + moved, s->file->size - moved, moved);
+            if (count <= 0) {
+                if (count < 0)
+                    moved = -errno;
+                break;
+            }
+            moved += count;
+        }
+        struct lfs_trace_event event = { LFS_OP_READ, s->path };
+        event.length = s->file->size;
+        event.start_ns = start_ns;
+        event.result = moved >= 0 ? moved : host_error((int)-moved);
+        if (moved >= 0)
+            s->file->size = (lfs_size_t)moved;
         else
-            type = OM_WRITE_ONLY;
+            s->file->result = (int)event.result;
+        flash_read(lfs, moved > 0 ? (lfs_size_t)moved : 0);
+        record_step(lfs, &event, moved > 0 ? moved : 0, read_ns, reads);
+    }
+
+    // close them
+    uint64_t close_ns;
+    rc = uring_close_step(lfs, ring, slots, count, results, &close_ns);
+    if (rc != 0)
+        return rc;
+    for (size_t i = 0; i < count; i++) {
+        struct batch_slot *s = &slots[i];
+        if (s->fd < 0)
+            continue;
+        struct lfs_trace_event event = { LFS_OP_CLOSE, s->path };
+        event.start_ns = start_ns + read_ns;
+        event.result = results[i] < 0 ? LFS_ERR_IO : 0;
+        record_step(lfs, &event, 0, close_ns, opens);
+    }
+    return 0;
+}
+
+// Writes the files with three system calls, leaves those the ring refused pending
+static int uring_files_write(lfs_t *lfs, struct lfs_uring *ring, struct batch_slot *slots,
+                             struct lfs_batch_file *files, size_t count)
+{
+    int64_t results[URING_ENTRIES];
+    int sync = lfs->durability == LFS_DURABILITY_FDATASYNC || lfs->durability == LFS_DURABILITY_FSYNC;
+
+    // create or truncate every file
+    uint64_t start_ns = lfs_clock_ns();
+    for (size_t i = 0; i < count; i++) {
+        struct batch_slot *s = &slots[i];
+        s->file = &files[i];
+        s->fd = -1;
+        s->moved = 0;
+        s->synced = 0;
+        s->queued = files[i].result == BATCH_PENDING;
+        if (!s->queued)
+            continue;
+        const char *path = patch_path(lfs, files[i].path, s->path);
+        if (path != s->path)
+            snprintf(s->path, sizeof(s->path), "%s", path);
+        struct io_uring_sqe *sqe = uring_sqe(ring, IORING_OP_OPENAT, AT_FDCWD, i);
+        sqe->addr = (uintptr_t)s->path;
+        sqe->len = 0666;
+        sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    }
+    int rc = uring_run(ring, results);
+    if (rc != 0)
+        return rc;
+    uint64_t open_ns = lfs_clock_ns() - start_ns;
+    size_t opens = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct batch_slot *s = &slots[i];
+        if (!s->queued || uring_refused(results[i]))
+            continue;
+        struct lfs_trace_event event = { LFS_OP_OPEN, s->path };
+        event.flags = LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC;
+        event.start_ns = start_ns;
+        event.result = results[i] < 0 ? host_error((int)-results[i]) : 0;
+        s->file->result = (int)event.result;
+        flash_lookup(lfs);
+        if (results[i] >= 0) {
+            s->fd = (int)results[i];
+            // created or truncated
+            flash_commit(lfs);
+        }
+        record_step(lfs, &event, 0, open_ns, count);
+        opens++;
+    }
+
+    // write them, each followed by its fsync when durability asks for it
+    start_ns = lfs_clock_ns();
+    size_t writes = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct batch_slot *s = &slots[i];
+        results[2 * i] = 0;
+        results[2 * i + 1] = 0;
+        if (s->fd < 0)
+            continue;
+        if (s->file->size) {
+            struct io_uring_sqe *sqe = uring_sqe(ring, IORING_OP_WRITE, s->fd, 2 * i);
+            sqe->addr = (uintptr_t)s->file->buffer;
+            sqe->len = s->file->size;
+            sqe->off = 0;
+            if (sync)
+                // a short write cancels the fsync
+                sqe->flags |= IOSQE_IO_LINK;
+            writes++;
+        }
+        if (sync) {
+            struct io_uring_sqe *sqe = uring_sqe(ring, IORING_OP_FSYNC, s->fd, 2 * i + 1);
+            if (lfs->durability == LFS_DURABILITY_FDATASYNC)
+                sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        }
+    }
+    rc = uring_run(ring, results);
+    if (rc != 0) {
+        uring_abandon(slots, count);
+        return rc;
+    }
+    uint64_t write_ns = lfs_clock_ns() - start_ns;
+    for (size_t i = 0; i < count; i++) {
+        struct batch_slot *s = &slots[i];
+        if (s->fd < 0)
+            continue;
+        int64_t moved = results[2 * i];
+        s->synced = results[2 * i + 1];
+        int short_write = moved >= 0 && moved < s->file->size;
+        while (moved >= 0 && moved < s->file->size) {
+            ssize_t count = pwrite(s->fd, (const char *)s->file->buffer + moved, s->file->size - moved, moved);
+            if (count <= 0) {
+                moved = count < 0 ? -errno : -EIO;
+                break;
+            }
+            moved += count;
+        }
+        if (sync && moved >= 0 && (short_write || uring_refused(s->synced) || s->synced == -ECANCELED)) {
+            if (lfs->durability == LFS_DURABILITY_FDATASYNC)
+                s->synced = fdatasync(s->fd) == 0 ? 0 : -errno;
+            else
+                s->synced = fsync(s->fd) == 0 ? 0 : -errno;
+        }
+        if (moved < 0)
+            s->file->result = host_error((int)-moved);
+        if (!s->file->size)
+            continue;
+        struct lfs_trace_event event = { LFS_OP_WRITE, s->path };
+        event.length = s->file->size;
+        event.start_ns = start_ns;
+        event.result = moved >= 0 ? moved : s->file->result;
+        if (moved > 0) {
+            lfs_file_t file;
+            file.block = 0;
+            file.wear_block = 0;
+            flash_write(lfs, &file, 0, (lfs_off_t)moved);
+        }
+        record_step(lfs, &event, moved > 0 ? moved : 0, write_ns, writes);
     }
-    file->pFile = fopen(path, type);
-    return file->pFile != NULL ? 0 : -1;
+
+    // close them
+    uint64_t close_ns;
+    rc = uring_close_step(lfs, ring, slots, count, results, &close_ns);
+    if (rc != 0)
+        return rc;
+    for (size_t i = 0; i < count; i++) {
+        struct batch_slot *s = &slots[i];
+        if (s->fd < 0)
+            continue;
+        struct lfs_trace_event event = { LFS_OP_CLOSE, s->path };
+        event.start_ns = start_ns + write_ns;
+        // like lfs_file_close, the sync is part of it
+        event.result = results[i] < 0 || s->synced < 0 ? LFS_ERR_IO : 0;
+        if (s->file->size)
+            flash_commit(lfs);
+        if (s->file->result == 0)
+            s->file->result = (int)event.result;
+        record_step(lfs, &event, 0, close_ns, opens);
+    }
+    return 0;
 }
+#endif
 
-int lfs_file_opencfg(lfs_t *lfs, lfs_file_t *file, const char *path, int flags, const struct lfs_file_config *config)
+static void batch_begin(lfs_t *lfs, struct lfs_batch_file *files, size_t count, int read)
 {
-    path = patch_path(lfs, path);
-    return lfs_file_open(lfs, file, path, flags);
+    char patched[LFS_MOCK_PATH_MAX];
+    for (size_t i = 0; i < count; i++) {
+        if (read) {
+            files[i].buffer = NULL;
+            files[i].size = 0;
+        }
+        files[i].result = patch_path(lfs, files[i].path, patched) ? BATCH_PENDING : LFS_ERR_NAMETOOLONG;
+    }
 }
 
-int lfs_file_close(lfs_t *lfs, lfs_file_t *file)
+// The files the ring did not do, one after the other
+static int batch_end(lfs_t *lfs, struct lfs_batch_file *files, size_t count, lfs_batch_alloc_t alloc, void *context)
 {
-    FILE *pFile = file->pFile;
-    file->pFile = NULL;
-    return fclose(pFile);
+    int rc = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct lfs_batch_file *f = &files[i];
+        if (f->result == BATCH_PENDING && alloc)
+            f->result = file_read_whole(lfs, f, alloc, context);
+        else if (f->result == BATCH_PENDING)
+            f->result = file_write_whole(lfs, f);
+        if (rc == 0)
+            rc = f->result;
+    }
+    return rc;
 }
 
-int lfs_file_sync(lfs_t *lfs, lfs_file_t *file)
+int lfs_files_read(lfs_t *lfs, struct lfs_batch_file *files, size_t count, lfs_batch_alloc_t alloc, void *context)
 {
-    return fflush(file->pFile);
+    if (count && files == NULL)
+        return LFS_ERR_INVAL;
+    if (alloc == NULL)
+        alloc = batch_malloc;
+    batch_begin(lfs, files, count, 1);
+    lock(lfs, LOCK_SHARED);
+#if defined(LFS_MOCK_URING)
+    struct lfs_uring *ring = count ? uring_take(lfs) : NULL;
+    struct batch_slot *slots = ring ? malloc(BATCH_FILES * sizeof(struct batch_slot)) : NULL;
+    for (size_t i = 0; slots && i < count; i += BATCH_FILES) {
+        size_t step = count - i < BATCH_FILES ? count - i : BATCH_FILES;
+        if (uring_files_read(lfs, ring, slots, files + i, step, alloc, context) != 0) {
+            // the rest takes the plain calls, from the start of the step
+            for (size_t j = i; j < i + step; j++) {
+                if (files[j].result == LFS_ERR_NAMETOOLONG)
+                    continue;
+                if (alloc == batch_malloc)
+                    free(files[j].buffer);
+                files[j].buffer = NULL;
+                files[j].size = 0;
+                files[j].result = BATCH_PENDING;
+            }
+            uring_destroy(ring);
+            ring = NULL;
+            break;
+        }
+    }
+    free(slots);
+    if (ring)
+        uring_give(lfs, ring);
+#endif
+    int rc = batch_end(lfs, files, count, alloc, context);
+    unlock(lfs, LOCK_SHARED);
+    return rc;
 }
 
-lfs_ssize_t lfs_file_read(lfs_t *lfs, lfs_file_t *file, void *buffer, lfs_size_t size)
+int lfs_files_write(lfs_t *lfs, struct lfs_batch_file *files, size_t count)
 {
-    return fread(buffer, 1, size, file->pFile);
+    if (count && files == NULL)
+        return LFS_ERR_INVAL;
+    batch_begin(lfs, files, count, 0);
+    lock(lfs, LOCK_EXCLUSIVE);
+#if defined(LFS_MOCK_URING)
+    // the plain calls check the capacity and record the changes for the snapshot
+    int plain = lfs->limited || lfs->powerloss.active;
+    struct lfs_uring *ring = count && !plain ? uring_take(lfs) : NULL;
+    struct batch_slot *slots = ring ? malloc(BATCH_FILES * sizeof(struct batch_slot)) : NULL;
+    for (size_t i = 0; slots && i < count; i += BATCH_FILES) {
+        size_t step = count - i < BATCH_FILES ? count - i : BATCH_FILES;
+        if (uring_files_write(lfs, ring, slots, files + i, step) != 0) {
+            // writing the whole files again is fine
+            for (size_t j = i; j < i + step; j++)
+                if (files[j].result != LFS_ERR_NAMETOOLONG)
+                    files[j].result = BATCH_PENDING;
+            uring_destroy(ring);
+            ring = NULL;
+            break;
+        }
+    }
+    free(slots);
+    if (ring)
+        uring_give(lfs, ring);
+#endif
+    int rc = batch_end(lfs, files, count, NULL, NULL);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    return rc;
 }
 
-lfs_ssize_t lfs_file_write(lfs_t *lfs, lfs_file_t *file, const void *buffer, lfs_size_t size)
+bool lfs_batch_uring(lfs_t *lfs, bool enable)
 {
-    return fwrite(buffer, 1, size, file->pFile);
+#if defined(LFS_MOCK_URING)
+    __atomic_store_n(&lfs->uring_off, !enable, __ATOMIC_RELAXED);
+    if (!enable) {
+        uring_release(lfs);
+        return false;
+    }
+    struct lfs_uring *ring = uring_take(lfs);
+    if (ring)
+        uring_give(lfs, ring);
+    return ring != NULL;
+#else
+    (void)lfs;
+    (void)enable;
+    return false;
+#endif
 }
 
-lfs_soff_t lfs_file_seek(lfs_t *lfs, lfs_file_t *file, lfs_soff_t off, int whence)
+/// Directory operations ///
+
+static int mock_mkdir(lfs_t *lfs, const char *path)
 {
-    return fseek(file->pFile, off, whence);
+    char patched[LFS_MOCK_PATH_MAX];
+    path = patch_path(lfs, path, patched);
+    if (path == NULL)
+        return LFS_ERR_NAMETOOLONG;
+    if (lfs->limited && blocks_free(lfs) == 0)
+        return LFS_ERR_NOSPC;
+    if (lfs->powerloss.active)
+        return powerloss_mkdir(lfs, path);
+    int rc = mkdir_host(path);
+    if (rc == 0)
+        flash_commit(lfs);
+    return rc;
 }
 
-int lfs_file_truncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size)
+int lfs_mkdir(lfs_t *lfs, const char *path)
 {
-    return _chsize(_fileno(file->pFile), size);
+    struct lfs_trace_event event = { LFS_OP_MKDIR, path };
+    event.start_ns = lfs_clock_ns();
+    lock(lfs, LOCK_EXCLUSIVE);
+    event.result = mock_mkdir(lfs, path);
+    unlock(lfs, LOCK_EXCLUSIVE);
+    record(lfs, &event, 0, event.result != 0);
+    return (int)event.result;
 }
 
-lfs_soff_t lfs_file_tell(lfs_t *lfs, lfs_file_t *file)
+/*
+ * Directories
+ *
+ * lfs_dir_open() takes a snapshot of the names, sorted like littlefs keeps
+ * them, into one buffer, and keeps the host folder open: lfs_dir_read()
+ * looks each entry up relative to it. A read then costs the same whatever
+ * the size and the depth of the folder. lfs_dir_open_file() skips the
+ * snapshot, its only entry is looked up by its path.
+ */
+static int compare_names(const void *a, const void *b)
 {
-    return ftell(file->pFile);
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
 }
 
-int lfs_file_rewind(lfs_t *lfs, lfs_file_t *file)
+static int mock_dir_open(lfs_t *lfs, lfs_dir_t *dir, const char *path)
 {
-    rewind(file->pFile);
+    char patched[LFS_MOCK_PATH_MAX];
+    path = patch_path(lfs, path, patched);
+    dir->names = NULL;
+    dir->buffer = NULL;
+    dir->count = 0;
+    dir->pos = 0;
+    dir->host = NULL;
+    dir->file = false;
+    if (path == NULL) {
+        dir->path[0] = '\0';
+        return LFS_ERR_NAMETOOLONG;
+    }
+    strcpy(dir->path, path);
+
+    dir->host = opendir(path);
+    if (dir->host == NULL)
+        return errno == ENOTDIR ? LFS_ERR_NOTDIR : LFS_ERR_NOENT;
+    lfs_size_t capacity = 0;
+    size_t used = 0, size = 0;
+    struct dirent* pEntry;
+    while ((pEntry = readdir(dir->host)) != NULL)
+    {
+        const char *name = pEntry->d_name;
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+            continue;
+        if (dir->count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 64;
+            char **names = (char **)realloc(dir->names, capacity * sizeof(char *));
+            if (names == NULL) {
+                lfs_dir_close(lfs, dir);
+                return LFS_ERR_NOMEM;
+            }
+            dir->names = names;
+        }
+        size_t length = strlen(name) + 1;
+        if (used + length > size)
+        {
+            size = size ? 2 * size : 1024;
+            if (size < used + length)
+                size = used + length;
+            char *buffer = (char *)realloc(dir->buffer, size);
+            if (buffer == NULL) {
+                lfs_dir_close(lfs, dir);
+                return LFS_ERR_NOMEM;
+            }
+            dir->buffer = buffer;
+        }
+        memcpy(dir->buffer + used, name, length);
+        // the offset for now, the buffer may still move
+        dir->names[dir->count++] = (char *)(uintptr_t)used;
+        used += length;
+    }
+    for (lfs_size_t i = 0; i < dir->count; i++)
+        dir->names[i] = dir->buffer + (uintptr_t)dir->names[i];
+    // an empty folder has no names to sort
+    if (dir->count > 1)
+        qsort(dir->names, dir->count, sizeof(char *), compare_names);
+#if defined(_WIN32)
+    closedir(dir->host);
+    dir->host = NULL;
+#endif
     return 0;
 }
 
-lfs_soff_t lfs_file_size(lfs_t *lfs, lfs_file_t *file)
+int lfs_dir_open(lfs_t *lfs, lfs_dir_t *dir, const char *path)
 {
-    int prev = ftell(file->pFile);
-    fseek(file->pFile, 0L, SEEK_END);
-    int sz = ftell(file->pFile);
-    fseek(file->pFile, prev, SEEK_SET); //go back to where we were
-    return sz;
+    struct lfs_trace_event event = { LFS_OP_DIR_OPEN, path };
+    event.start_ns = lfs_clock_ns();
+    lock(lfs, LOCK_SHARED);
+    event.result = mock_dir_open(lfs, dir, path);
+    unlock(lfs, LOCK_SHARED);
+    record(lfs, &event, 0, event.result != 0);
+    return (int)event.result;
 }
 
-/// Directory operations ///
-
-int lfs_mkdir(lfs_t *lfs, const char *path)
+static int mock_dir_open_file(lfs_t *lfs, lfs_dir_t *dir, const char *path)
 {
-    path = patch_path(lfs, path);
-    return mkdir(path);
+    char patched[LFS_MOCK_PATH_MAX];
+    path = patch_path(lfs, path, patched);
+    dir->names = NULL;
+    dir->buffer = NULL;
+    dir->count = 0;
+    dir->pos = 0;
+    dir->host = NULL;
+    dir->file = true;
+    if (path == NULL) {
+        dir->path[0] = '\0';
+        return LFS_ERR_NAMETOOLONG;
+    }
+    strcpy(dir->path, path);
+
+    struct stat buffer;
+    if (stat(path, &buffer) != 0)
+        return errno == ENOTDIR ? LFS_ERR_NOTDIR : LFS_ERR_NOENT;
+    if (!S_ISREG(buffer.st_mode))
+        return S_ISDIR(buffer.st_mode) ? LFS_ERR_ISDIR : LFS_ERR_NOENT;
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    size_t length = strlen(name) + 1;
+    dir->names = (char **)malloc(sizeof(char *));
+    dir->buffer = (char *)malloc(length);
+    if (dir->names == NULL || dir->buffer == NULL) {
+        free(dir->names);
+        free(dir->buffer);
+        dir->names = NULL;
+        dir->buffer = NULL;
+        return LFS_ERR_NOMEM;
+    }
+    memcpy(dir->buffer, name, length);
+    dir->names[0] = dir->buffer;
+    dir->count = 1;
+    return 0;
 }
 
-int lfs_dir_open(lfs_t *lfs, lfs_dir_t *dir, const char *path)
+int lfs_dir_open_file(lfs_t *lfs, lfs_dir_t *dir, const char *path)
 {
-    path = patch_path(lfs, path);
-    strcpy(dir->path, path);
-    dir->pDir = opendir(path);
-    return dir->pDir != NULL ? 0 : -1;
+    struct lfs_trace_event event = { LFS_OP_DIR_OPEN, path };
+    event.flags = 1;
+    event.start_ns = lfs_clock_ns();
+    lock(lfs, LOCK_SHARED);
+    event.result = mock_dir_open_file(lfs, dir, path);
+    unlock(lfs, LOCK_SHARED);
+    record(lfs, &event, 0, event.result != 0);
+    return (int)event.result;
 }
 
 int lfs_dir_close(lfs_t *lfs, lfs_dir_t *dir)
 {
-    DIR *pDir = dir->pDir;
-    dir->pDir = NULL;
-    return closedir(pDir);
+    free(dir->names);
+    free(dir->buffer);
+    if (dir->host != NULL)
+        closedir(dir->host);
+    dir->names = NULL;
+    dir->buffer = NULL;
+    dir->host = NULL;
+    dir->count = 0;
+    return 0;
 }
 
-int lfs_dir_read(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info)
+static int stat_entry(lfs_dir_t *dir, const char *name, struct stat *buffer)
+{
+    if (dir->file)
+        return stat(dir->path, buffer);
+#if defined(_WIN32)
+    char path[LFS_MOCK_PATH_MAX + LFS_NAME_MAX + 1];
+    int len = snprintf(path, sizeof(path), "%s/%s", dir->path, name);
+    if (len < 0 || len >= (int)sizeof(path))
+        return LFS_ERR_NAMETOOLONG;
+    return stat(path, buffer);
+#else
+    return fstatat(dirfd(dir->host), name, buffer, 0);
+#endif
+}
+
+static int mock_dir_read(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info)
 {
-    struct dirent* pEntry = readdir(dir->pDir);
-    if (pEntry != NULL)
+    // like littlefs, report . and .. first
+    if (dir->pos < 2)
     {
-        strcpy(info->name, pEntry->d_name);
-        if (strcmp(pEntry->d_name, ".") == 0 || strcmp(pEntry->d_name, "..") == 0)
-        {
-            info->type = LFS_TYPE_DIR;
-            info->size = 0;
-            return true;
-        }
+        strcpy(info->name, dir->pos == 0 ? "." : "..");
+        info->type = LFS_TYPE_DIR;
+        info->size = 0;
+        dir->pos++;
+        return true;
+    }
+    while (dir->pos - 2 < dir->count)
+    {
+        const char *name = dir->names[dir->pos - 2];
+        dir->pos++;
+        flash_lookup(lfs);
+
         struct stat buffer;
-        char path[300];
-        strcpy(path, dir->path);
-        strcat(path, "/");
-        strcat(path, pEntry->d_name);
-        if (stat(path, &buffer) == 0)
+        int rc = stat_entry(dir, name, &buffer);
+        if (rc == LFS_ERR_NAMETOOLONG)
+            return rc;
+        if (rc == 0)
         {
+            strcpy(info->name, name);
             if (S_ISDIR(buffer.st_mode))
             {
                 info->type = LFS_TYPE_DIR;
@@ -260,27 +2553,43 @@ int lfs_dir_read(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info)
                 return true;
             }
         }
+        // removed since the directory was opened, or neither file nor folder
     }
     return false;
 }
 
+int lfs_dir_read(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info)
+{
+    struct lfs_trace_event event = { LFS_OP_DIR_READ, dir->path };
+    event.start_ns = lfs_clock_ns();
+    lock(lfs, LOCK_SHARED);
+    event.result = mock_dir_read(lfs, dir, info);
+    unlock(lfs, LOCK_SHARED);
+    record(lfs, &event, 0, event.result < 0);
+    return (int)event.result;
+}
+
 int lfs_dir_seek(lfs_t *lfs, lfs_dir_t *dir, lfs_off_t off)
 {
+    if (off > dir->count + 2)
+        return LFS_ERR_INVAL;
+    dir->pos = off;
     return 0;
 }
 
 lfs_soff_t lfs_dir_tell(lfs_t *lfs, lfs_dir_t *dir)
 {
-    return 0;
+    return dir->pos;
 }
 
 int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir)
 {
-    rewinddir(dir->pDir);
+    dir->pos = 0;
     return 0;
 }
 
 /// Filesystem-level filesystem operations ///
+#if defined(_WIN32)
 int internal_is_dir(const char * path)
 {
     struct stat path_stat;
@@ -288,11 +2597,13 @@ int internal_is_dir(const char * path)
     return !(S_ISREG(path_stat.st_mode));
 }
 
-int internal_size(const char * name)
+lfs_soff_t internal_size(lfs_t *lfs, const char * name)
 {
-    int dir_size = 0;
+    lfs_soff_t dir_size = 0;
     struct dirent * pDirent;
     DIR * pDir = opendir(name);
+    if (pDir == NULL)
+        return 0;
     while ((pDirent = readdir(pDir)) != NULL)
     {
         if ( strcmp(pDirent->d_name, ".") != 0 && strcmp(pDirent->d_name, "..") != 0 )
@@ -303,23 +2614,71 @@ int internal_size(const char * name)
             if (internal_is_dir(buf))
             {
                 strcat(buf, "/");
-                dir_size += internal_size(buf);
+                dir_size += internal_size(lfs, buf);
             }
             else
             {
                 struct stat st;
                 stat(buf, &st);
-                int sz = st.st_size;
-                dir_size += sz;
+                dir_size += blocks_of(lfs, st.st_size);
             }
         }
     }
+    closedir(pDir);
+    return dir_size;
+}
+#else
+// The blocks below the folder fd, one lookup per entry relative to its folder
+static lfs_soff_t size_at(lfs_t *lfs, int fd)
+{
+    DIR *pDir = fdopendir(fd);
+    if (pDir == NULL)
+    {
+        close(fd);
+        return 0;
+    }
+    lfs_soff_t dir_size = 0;
+    struct dirent *pDirent;
+    while ((pDirent = readdir(pDir)) != NULL)
+    {
+        const char *name = pDirent->d_name;
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+            continue;
+        struct stat st;
+        if (pDirent->d_type != DT_DIR && fstatat(dirfd(pDir), name, &st, 0) == 0 && S_ISREG(st.st_mode))
+        {
+            dir_size += blocks_of(lfs, st.st_size);
+            continue;
+        }
+        int child = openat(dirfd(pDir), name, O_RDONLY | O_DIRECTORY);
+        if (child >= 0)
+            dir_size += size_at(lfs, child);
+    }
+    closedir(pDir);
     return dir_size;
 }
 
-lfs_ssize_t lfs_fs_size(lfs_t *lfs)
+lfs_soff_t internal_size(lfs_t *lfs, const char * name)
+{
+    int fd = open(name, O_RDONLY | O_DIRECTORY);
+    return fd < 0 ? 0 : size_at(lfs, fd);
+}
+#endif
+
+static lfs_soff_t fs_size(lfs_t *lfs)
+{
+    return internal_size(lfs, lfs->test_dir);
+}
+
+lfs_soff_t lfs_fs_size(lfs_t *lfs)
 {
-    return internal_size(lfs->test_dir);
+    lock(lfs, LOCK_SHARED);
+    lfs_soff_t used = fs_size(lfs);
+    // pick up files changed outside of littlefs, other readers may store it too
+    if (lfs->limited)
+        __atomic_store_n(&lfs->used, (uint64_t)used, __ATOMIC_RELAXED);
+    unlock(lfs, LOCK_SHARED);
+    return used;
 }
 
 int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void *, lfs_block_t), void *data)
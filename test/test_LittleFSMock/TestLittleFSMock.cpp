@@ -1,13 +1,26 @@
+#include <errno.h>
 #include <sys/stat.h>
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
 
+#include <atomic>
+#include <thread>
+#include <vector>
 #include <unity.h>
 
 #include "LittleFS.h"
+#include "FSCoro.h"
 
 #define TEST_DIR ".unittest/"
 #define BASE_NAME "unit_test"
 #define FOLDER_NAME "unit_test/folder"
 #define FILE_NAME "unit_test/file.txt"
+#if defined(_WIN32)
+#define RAW_MKDIR(path) mkdir(path)
+#else
+#define RAW_MKDIR(path) mkdir(path, 0777)
+#endif
 #define MAKE_FILE_NAME(var_name, file_name) \
     char var_name[strlen(BASE_NAME)+1+strlen(file_name)+1];\
     strcpy(var_name,BASE_NAME);\
@@ -28,7 +41,7 @@ void rawCreateFolder(const char* name = FOLDER_NAME)
 {
     String s = TEST_DIR;
     s += (name[0] == '/' ? name+1 : name);
-    mkdir(s.c_str());
+    RAW_MKDIR(s.c_str());
 }
 
 bool rawDetectFile(const char* name = FILE_NAME)
@@ -36,8 +49,7 @@ bool rawDetectFile(const char* name = FILE_NAME)
     String s = TEST_DIR;
     s += (name[0] == '/' ? name+1 : name);
     struct stat stats;
-    stat(s.c_str(), &stats);
-    return S_ISREG(stats.st_mode) ? true : false;
+    return stat(s.c_str(), &stats) == 0 && S_ISREG(stats.st_mode);
 }
 
 bool rawDetectFolder(const char* name = FOLDER_NAME)
@@ -45,8 +57,7 @@ bool rawDetectFolder(const char* name = FOLDER_NAME)
     String s = TEST_DIR;
     s += (name[0] == '/' ? name+1 : name);
     struct stat stats;
-    stat(s.c_str(), &stats);
-    return S_ISDIR(stats.st_mode) ? true : false;
+    return stat(s.c_str(), &stats) == 0 && S_ISDIR(stats.st_mode);
 }
 
 bool rawRemoveFile(const char* name = FILE_NAME)
@@ -103,6 +114,943 @@ void testFsInfo(void)
     rawRemoveFolder("folder");
 }
 
+void testFsInfo64(void)
+{
+    FSInfo64 info;
+    LittleFS.info64(info);
+    uint64_t totalBytes = info.totalBytes;
+    info.totalBytes = 8ULL * 1024 * 1024 * 1024;
+    LittleFS.mockSetInfo64(info);
+
+    FSInfo64 result;
+    TEST_ASSERT_TRUE(LittleFS.info64(result));
+    TEST_ASSERT_EQUAL_UINT64(8ULL * 1024 * 1024 * 1024, result.totalBytes);
+
+    info.totalBytes = totalBytes;
+    LittleFS.mockSetInfo64(info);
+}
+
+void testFsTiming(void)
+{
+    FSInfo info;
+    LittleFS.info(info);
+    FSInfo device = info;
+    device.totalBytes = 1024 * 1024;
+    device.blockSize = 4096;
+    device.pageSize = 256;
+    LittleFS.mockSetInfo(device);
+    LittleFS.mockSetTimingModel(FSTimingModel{ 1000, 10000, 1000000 });
+
+    char content[200];
+    memset(content, 'x', sizeof(content));
+    LittleFS.mockResetTiming();
+    File file = LittleFS.open(FILE_NAME, "w");
+    file.write((uint8_t*) content, sizeof(content));
+    file.close();
+
+    FSTiming timing;
+    TEST_ASSERT_TRUE(LittleFS.mockTiming(timing));
+    TEST_ASSERT_EQUAL_UINT64(1, timing.erases);
+    TEST_ASSERT_GREATER_OR_EQUAL(4, timing.progs);
+    TEST_ASSERT_EQUAL_UINT64(timing.reads * 1000 + timing.progs * 10000 + timing.erases * 1000000, timing.clockNs);
+
+    file = LittleFS.open(FILE_NAME, "r");
+    LittleFS.mockResetTiming();
+    file.read((uint8_t*) content, sizeof(content));
+    LittleFS.mockTiming(timing);
+    TEST_ASSERT_EQUAL_UINT64(4, timing.reads);
+    TEST_ASSERT_EQUAL_UINT64(0, timing.progs);
+    TEST_ASSERT_EQUAL_UINT64(4000, timing.clockNs);
+    TEST_ASSERT_EQUAL_UINT64(4000, timing.lastOpNs);
+    file.close();
+
+    // the last call is charged as a whole, creating looks up the name and commits
+    LittleFS.remove(FILE_NAME);
+    file = LittleFS.open(FILE_NAME, "w");
+    LittleFS.mockTiming(timing);
+    TEST_ASSERT_EQUAL_UINT64(1000 + 10000, timing.lastOpNs);
+    file.close();
+
+    // lock free calls are charged on their own too
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_TRUE(LittleFS.exists(FILE_NAME));
+        LittleFS.mockTiming(timing);
+        TEST_ASSERT_EQUAL_UINT64(1000, timing.lastOpNs);
+    }
+
+    LittleFS.mockSetTimingModel(FSTimingModel{ 0, 0, 0 });
+    LittleFS.mockSetInfo(info);
+}
+
+void testFsWear(void)
+{
+    FSInfo info;
+    LittleFS.info(info);
+    FSInfo device = info;
+    device.totalBytes = 16 * 4096;
+    device.blockSize = 4096;
+    device.pageSize = 256;
+    LittleFS.mockSetInfo(device);
+
+    FSWearReport report;
+    TEST_ASSERT_FALSE(LittleFS.mockWearReport(report));
+    TEST_ASSERT_TRUE(LittleFS.mockTrackWear());
+    LittleFS.mockResetTiming();
+
+    char content[100];
+    memset(content, 'x', sizeof(content));
+    for (int i = 0; i < 100; i++)
+    {
+        File file = LittleFS.open(FILE_NAME, "w");
+        file.write((uint8_t*) content, sizeof(content));
+        file.close();
+    }
+
+    TEST_ASSERT_TRUE(LittleFS.mockWearReport(report, 1000));
+    FSTiming timing;
+    LittleFS.mockTiming(timing);
+    TEST_ASSERT_EQUAL_UINT32(16, report.blocks);
+    TEST_ASSERT_EQUAL_UINT64(timing.erases, report.erases);
+    TEST_ASSERT_EQUAL_UINT64(timing.progs, report.progs);
+    // the 100 data blocks rotate through the 14 blocks besides the metadata pair
+    TEST_ASSERT_LESS_OR_EQUAL(100 / 14 + 1, report.maxErases);
+    TEST_ASSERT_GREATER_OR_EQUAL(1, report.minErases);
+    TEST_ASSERT_TRUE(report.lifetime == 1000.0 / report.maxErases);
+    TEST_ASSERT_TRUE(report.lifetime <= report.lifetimeLeveled);
+
+    LittleFS.mockTrackWear(false);
+    TEST_ASSERT_FALSE(LittleFS.mockWearReport(report));
+    LittleFS.mockSetInfo(info);
+}
+
+void testFsNoSpace(void)
+{
+    FSInfo info;
+    LittleFS.info(info);
+    FSInfo device = info;
+    device.totalBytes = 4 * 256;
+    device.blockSize = 256;
+    LittleFS.mockSetInfo(device);
+    TEST_ASSERT_TRUE(LittleFS.mockLimitCapacity());
+
+    char content[300];
+    memset(content, 'x', sizeof(content));
+    File file = LittleFS.open(FILE_NAME, "w");
+    TEST_ASSERT_EQUAL_size_t(300, file.write((uint8_t*) content, sizeof(content)));
+    TEST_ASSERT_EQUAL_size_t(300, file.write((uint8_t*) content, sizeof(content)));
+    TEST_ASSERT_EQUAL_size_t(300, file.write((uint8_t*) content, sizeof(content)));
+    // only the rest of the 4th block is left
+    TEST_ASSERT_EQUAL_size_t(1024 - 900, file.write((uint8_t*) content, sizeof(content)));
+    TEST_ASSERT_EQUAL_size_t(0, file.write((uint8_t*) content, sizeof(content)));
+    TEST_ASSERT_FALSE(file.truncate(2048));
+    file.close();
+
+    FSInfo result;
+    LittleFS.info(result);
+    TEST_ASSERT_EQUAL_size_t(1024, result.usedBytes);
+    TEST_ASSERT_FALSE(LittleFS.open("other.txt", "w"));
+    TEST_ASSERT_FALSE(LittleFS.mkdir("folder"));
+
+    // truncating frees the blocks again
+    file = LittleFS.open(FILE_NAME, "w");
+    TEST_ASSERT_EQUAL_size_t(300, file.write((uint8_t*) content, sizeof(content)));
+    file.close();
+    file = LittleFS.open("other.txt", "w");
+    TEST_ASSERT_TRUE(file);
+    TEST_ASSERT_EQUAL_size_t(300, file.write((uint8_t*) content, sizeof(content)));
+    file.close();
+    TEST_ASSERT_TRUE(LittleFS.remove("other.txt"));
+    LittleFS.info(result);
+    TEST_ASSERT_EQUAL_size_t(512, result.usedBytes);
+
+    // lifting the limit, the size only fakes info()
+    TEST_ASSERT_TRUE(LittleFS.mockLimitCapacity(false));
+    file = LittleFS.open(FILE_NAME, "a");
+    for (int i = 0; i < 4; i++)
+        TEST_ASSERT_EQUAL_size_t(300, file.write((uint8_t*) content, sizeof(content)));
+    file.close();
+
+    LittleFS.remove(FILE_NAME);
+    LittleFS.mockSetInfo(info);
+}
+
+void testFsPowerLoss(void)
+{
+    rawCreateFile("old config", "config.txt");
+    auto check = []() {
+        char buf[25] = { 0 };
+        File file = LittleFS.open("config.txt", "r");
+        if (!file)
+            return false;
+        file.read((uint8_t*) buf, sizeof(buf) - 1);
+        return strcmp(buf, "old config") == 0 || strcmp(buf, "new config") == 0;
+    };
+    FSPowerLossReport report;
+
+    // the data is committed by close, either config survives
+    TEST_ASSERT_TRUE(LittleFS.mockPowerLoss([]() {
+        File file = LittleFS.open("config.txt", "w");
+        file.write((const uint8_t*) "new config", 10);
+        file.close();
+    }, check, report));
+    TEST_ASSERT_GREATER_OR_EQUAL(11, report.ops);
+    TEST_ASSERT_EQUAL_UINT64(report.ops + 1, report.cuts);
+    TEST_ASSERT_EQUAL_UINT64(0, report.failures);
+
+    // flushing in between commits half of the config
+    TEST_ASSERT_TRUE(LittleFS.mockPowerLoss([]() {
+        File file = LittleFS.open("config.txt", "w");
+        file.write((const uint8_t*) "new ", 4);
+        file.flush();
+        file.write((const uint8_t*) "config", 6);
+        file.close();
+    }, check, report));
+    TEST_ASSERT_GREATER_THAN(0, report.failures);
+    TEST_ASSERT_TRUE(report.firstFailure < report.ops);
+
+    // rolled back to the snapshot
+    char buf[25];
+    TEST_ASSERT_EQUAL_size_t(10, rawReadFile(buf, 25, "config.txt"));
+    TEST_ASSERT_EQUAL_CHAR_ARRAY("old config", buf, 10);
+    rawRemoveFile("config.txt");
+}
+
+void testFsStats(void)
+{
+    rawRemoveFile();
+    LittleFS.resetStats();
+    char content[] = "0123456789";
+    File file = LittleFS.open(FILE_NAME, "w");
+    file.write((uint8_t*) content, 10);
+    file.close();
+    file = LittleFS.open(FILE_NAME, "r");
+    char buf[25];
+    file.read((uint8_t*) buf, sizeof(buf));
+    file.close();
+    TEST_ASSERT_FALSE(LittleFS.exists("missing.txt"));
+
+    FSStats stats;
+    TEST_ASSERT_TRUE(LittleFS.stats(stats));
+    // creating with a time callback probes for the file first
+    TEST_ASSERT_EQUAL_UINT64(3, stats[FSOpOpen].count);
+    TEST_ASSERT_EQUAL_UINT64(1, stats[FSOpOpen].errors);
+    TEST_ASSERT_EQUAL_UINT64(2, stats[FSOpClose].count);
+    TEST_ASSERT_EQUAL_UINT64(10, stats[FSOpWrite].bytes);
+    TEST_ASSERT_EQUAL_UINT64(10, stats[FSOpRead].bytes);
+    TEST_ASSERT_EQUAL_UINT64(1, stats[FSOpStat].errors);
+
+    const FSOpStats& open = stats[FSOpOpen];
+    uint64_t recorded = 0;
+    for (size_t i = 0; i < FSOpStats::BUCKETS; i++)
+        recorded += open.histogram[i];
+    TEST_ASSERT_EQUAL_UINT64(open.count, recorded);
+    TEST_ASSERT_TRUE(open.percentileNs(50) <= open.percentileNs(99));
+    TEST_ASSERT_TRUE(open.percentileNs(99) <= open.maxNs);
+    TEST_ASSERT_TRUE(open.maxNs <= open.totalNs);
+    TEST_ASSERT_EQUAL_STRING("dir_read", FSStats::opName(FSOpDirRead));
+
+    TEST_ASSERT_EQUAL_UINT64(8, FSOpStats::bucketNs(8));
+    TEST_ASSERT_EQUAL_UINT64(1024 + 3 * 128, FSOpStats::bucketNs(8 * 8 + 3));
+
+    LittleFS.resetStats();
+    LittleFS.stats(stats);
+    TEST_ASSERT_EQUAL_UINT64(0, stats[FSOpOpen].count);
+}
+
+void testFsTrace(void)
+{
+    TEST_ASSERT_TRUE(LittleFS.mockStartTrace("trace.bin"));
+    TEST_ASSERT_FALSE(LittleFS.mockStartTrace("trace.bin"));
+    File file = LittleFS.open(FILE_NAME, "w");
+    file.write((uint8_t*) "0123456789", 10);
+    file.write((uint8_t*) "abc", 3);
+    file.close();
+    TEST_ASSERT_TRUE(LittleFS.rename(FILE_NAME, "unit_test/renamed.txt"));
+    TEST_ASSERT_TRUE(LittleFS.mockStopTrace());
+
+    littlefs_impl::TraceReader reader;
+    littlefs_impl::TraceEvent event;
+    TEST_ASSERT_TRUE(reader.open("trace.bin"));
+    uint32_t path = 0;
+    int writes = 0;
+    uint64_t time = 0;
+    while (reader.next(event)) {
+        TEST_ASSERT_TRUE(event.timeNs >= time);
+        time = event.timeNs;
+        if (event.op == LFS_OP_WRITE) {
+            TEST_ASSERT_EQUAL_UINT64(writes ? 10 : 0, event.offset);
+            TEST_ASSERT_EQUAL_UINT64(writes ? 3 : 10, event.length);
+            TEST_ASSERT_EQUAL_INT64(event.length, event.result);
+            // interned once
+            TEST_ASSERT_TRUE(writes == 0 || event.path == path);
+            path = event.path;
+            writes++;
+        } else if (event.op == LFS_OP_RENAME) {
+            TEST_ASSERT_EQUAL_UINT32(path, event.path);
+            TEST_ASSERT_EQUAL_STRING("unit_test/renamed.txt", reader.path(event.target));
+        }
+    }
+    TEST_ASSERT_EQUAL_INT(2, writes);
+    TEST_ASSERT_EQUAL_STRING(FILE_NAME, reader.path(path));
+    reader.close();
+
+    // a path id out of order is corrupt, whatever it would allocate
+    uint8_t header[12];
+    FILE* fp = fopen("trace.bin", "rb");
+    TEST_ASSERT_EQUAL_size_t(sizeof(header), fread(header, 1, sizeof(header), fp));
+    fclose(fp);
+    const uint8_t record[] = { 'S', 0xF0, 0xFF, 0xFF, 0xFF, 1, 0, 'x' };
+    fp = fopen("corrupt.bin", "wb");
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(record, 1, sizeof(record), fp);
+    fclose(fp);
+    TEST_ASSERT_TRUE(reader.open("corrupt.bin"));
+    TEST_ASSERT_FALSE(reader.next(event));
+    reader.close();
+    remove("corrupt.bin");
+    remove("trace.bin");
+    LittleFS.remove("unit_test/renamed.txt");
+}
+
+void testFsReplay(void)
+{
+    TEST_ASSERT_TRUE(LittleFS.mkdir(FOLDER_NAME));
+    TEST_ASSERT_TRUE(LittleFS.mockStartTrace("trace.bin"));
+    File file = LittleFS.open(FILE_NAME, "w");
+    file.write((uint8_t*) "0123456789", 10);
+    file.write((uint8_t*) "abc", 3);
+    file.close();
+    file = LittleFS.open(FILE_NAME, "r");
+    file.seek(4);
+    char buffer[8];
+    TEST_ASSERT_EQUAL_size_t(8, file.read((uint8_t*) buffer, 8));
+    file.close();
+    Dir dir = LittleFS.openDir(BASE_NAME);
+    while (dir.next()) {
+    }
+    TEST_ASSERT_TRUE(LittleFS.rename(FILE_NAME, "unit_test/folder/renamed.txt"));
+    TEST_ASSERT_TRUE(LittleFS.mockStopTrace());
+
+    // from the state the trace started with
+    TEST_ASSERT_TRUE(rawRemoveFile("unit_test/folder/renamed.txt"));
+    FSReplayReport report;
+    FSReplayOptions options;
+    TEST_ASSERT_TRUE(LittleFS.mockReplay("trace.bin", options, report));
+    TEST_ASSERT_EQUAL_UINT64(0, report.mismatches);
+    TEST_ASSERT_EQUAL_UINT64(2, report.stats[FSOpWrite].count);
+    TEST_ASSERT_EQUAL_UINT64(1, report.stats[FSOpRename].count);
+    TEST_ASSERT_EQUAL_UINT64(21, report.bytes);
+    TEST_ASSERT_TRUE(report.events > 10);
+    TEST_ASSERT_TRUE(report.opsPerSecond() > 0);
+    file = LittleFS.open("unit_test/folder/renamed.txt", "r");
+    TEST_ASSERT_EQUAL_size_t(13, file.size());
+    file.close();
+
+    TEST_ASSERT_TRUE(rawRemoveFile("unit_test/folder/renamed.txt"));
+    options.paced = true;
+    options.speed = 2;
+    TEST_ASSERT_TRUE(LittleFS.mockReplay("trace.bin", options, report));
+    TEST_ASSERT_EQUAL_UINT64(0, report.mismatches);
+    TEST_ASSERT_FALSE(LittleFS.mockReplay("missing.bin", options, report));
+    remove("trace.bin");
+    rawRemoveFile("unit_test/folder/renamed.txt");
+}
+
+void testFsChromeTrace(void)
+{
+    if (ChromeTrace::active()) {
+        TEST_IGNORE_MESSAGE("the run writes a JSON trace already, --chrome-trace");
+    }
+    TEST_ASSERT_TRUE(ChromeTrace::start("trace.json"));
+    TEST_ASSERT_FALSE(ChromeTrace::start("trace.json"));
+    File file = LittleFS.open(FILE_NAME, "w");
+    file.write((uint8_t*) "0123456789", 10);
+    file.close();
+    TEST_ASSERT_TRUE(ChromeTrace::stop());
+    TEST_ASSERT_FALSE(ChromeTrace::active());
+
+    FILE* fp = fopen("trace.json", "r");
+    TEST_ASSERT_TRUE(fp != nullptr);
+    String json;
+    char buffer[256];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer) - 1, fp)) > 0) {
+        buffer[count] = 0;
+        json += buffer;
+    }
+    fclose(fp);
+    remove("trace.json");
+    TEST_ASSERT_EQUAL_INT(0, json.indexOf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+    TEST_ASSERT_TRUE(json.endsWith("]}\n"));
+    // the write at each layer
+    TEST_ASSERT_TRUE(json.indexOf("{\"name\":\"write\",\"cat\":\"File\"") > 0);
+    TEST_ASSERT_TRUE(json.indexOf("{\"name\":\"write\",\"cat\":\"FileImpl\"") > 0);
+    TEST_ASSERT_TRUE(json.indexOf("{\"name\":\"write\",\"cat\":\"lfs\"") > 0);
+    TEST_ASSERT_TRUE(json.indexOf("\"args\":{\"path\":\"" FILE_NAME "\",\"size\":10,\"result\":10}") > 0);
+    TEST_ASSERT_TRUE(json.indexOf("{\"name\":\"close\",\"cat\":\"lfs\"") > 0);
+}
+
+const FSAllocStats* findAlloc(const FSAllocStats* stats, size_t count, const char* call)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(stats[i].call, call) == 0) {
+            return &stats[i];
+        }
+    }
+    return nullptr;
+}
+
+void testFsAlloc(void)
+{
+    if (!FSAlloc::supported()) {
+        TEST_ASSERT_FALSE(FSAlloc::start());
+        TEST_IGNORE_MESSAGE("needs FS_TRACK_ALLOC and glibc");
+    }
+    // the run may track already, --track-alloc
+    bool active = FSAlloc::active();
+    if (!active) {
+        TEST_ASSERT_TRUE(FSAlloc::start());
+    }
+    FSAlloc::reset();
+    File file = LittleFS.open(FILE_NAME, "w");
+    file.write((uint8_t*) "0123456789", 10);
+    int64_t peak = FSAlloc::peakBytes();
+    TEST_ASSERT_TRUE(peak > 0);
+    file.close();
+    Dir dir = LittleFS.openDir(BASE_NAME);
+    while (dir.next()) {
+        String name = dir.fileName();
+    }
+    TEST_ASSERT_TRUE(FSAlloc::peakBytes() >= peak);
+
+    FSAllocStats stats[FSAlloc::CALLS];
+    size_t count = FSAlloc::report(stats, FSAlloc::CALLS);
+    if (!active) {
+        FSAlloc::stop();
+    }
+    // the file, its name and the lfs file
+    const FSAllocStats* open = findAlloc(stats, count, "FS::open");
+    TEST_ASSERT_TRUE(open != nullptr);
+    TEST_ASSERT_TRUE(open->allocations >= 2 * open->calls);
+    TEST_ASSERT_TRUE(open->maxBytes >= sizeof(lfs_file_t));
+    TEST_ASSERT_TRUE(findAlloc(stats, count, "FS::openDir") != nullptr);
+    for (size_t i = 1; i < count; i++) {
+        TEST_ASSERT_TRUE(stats[i - 1].bytes >= stats[i].bytes);
+    }
+}
+
+struct CountingHooks {
+    static int begins[LFS_OP_COUNT];
+    static int ends[LFS_OP_COUNT];
+    static lfs_op open;
+
+    static void begin(lfs_op op, const char* path) {
+        TEST_ASSERT_TRUE(path != nullptr);
+        TEST_ASSERT_EQUAL_INT(LFS_OP_COUNT, open);
+        begins[op]++;
+        open = op;
+    }
+    static void end(lfs_op op, int64_t result) {
+        TEST_ASSERT_EQUAL_INT(open, op);
+        ends[op]++;
+        open = LFS_OP_COUNT;
+    }
+};
+int CountingHooks::begins[LFS_OP_COUNT];
+int CountingHooks::ends[LFS_OP_COUNT];
+lfs_op CountingHooks::open = LFS_OP_COUNT;
+
+void testFsHooks(void)
+{
+    FS fs(FSImplPtr(new littlefs_impl::LittleFSImplT<CountingHooks>(1, 1, 1, 1, 5)));
+    TEST_ASSERT_TRUE(fs.begin());
+    File file = fs.open(FILE_NAME, "w");
+    file.write((uint8_t*) "0123456789", 10);
+    TEST_ASSERT_TRUE(file.reserve(100));
+    file.close();
+    file = fs.open(FILE_NAME, "r");
+    char buffer[4];
+    file.read((uint8_t*) buffer, 4);
+    TEST_ASSERT_EQUAL_UINT(4, file.position());
+    TEST_ASSERT_EQUAL_UINT(10, file.size());
+    TEST_ASSERT_TRUE(file.getLastWrite() > 0);
+    file.close();
+    TEST_ASSERT_TRUE(fs.exists(FILE_NAME));
+    Dir dir = fs.openDir("/");
+    TEST_ASSERT_TRUE(dir.rewind());
+    dir = Dir();
+    FSInfo info;
+    TEST_ASSERT_TRUE(fs.info(info));
+    TEST_ASSERT_TRUE(fs.format());
+    fs.end();
+
+    // creating probes with a read-only open first
+    TEST_ASSERT_EQUAL_INT(3, CountingHooks::begins[LFS_OP_OPEN]);
+    TEST_ASSERT_EQUAL_INT(2, CountingHooks::begins[LFS_OP_CLOSE]);
+    TEST_ASSERT_EQUAL_INT(1, CountingHooks::begins[LFS_OP_WRITE]);
+    TEST_ASSERT_EQUAL_INT(1, CountingHooks::begins[LFS_OP_READ]);
+    TEST_ASSERT_EQUAL_INT(1, CountingHooks::begins[LFS_OP_STAT]);
+    TEST_ASSERT_EQUAL_INT(1, CountingHooks::begins[LFS_OP_TELL]);
+    TEST_ASSERT_EQUAL_INT(1, CountingHooks::begins[LFS_OP_SIZE]);
+    TEST_ASSERT_EQUAL_INT(1, CountingHooks::begins[LFS_OP_RESERVE]);
+    TEST_ASSERT_EQUAL_INT(1, CountingHooks::begins[LFS_OP_DIR_REWIND]);
+    TEST_ASSERT_EQUAL_INT(1, CountingHooks::begins[LFS_OP_DIR_CLOSE]);
+    TEST_ASSERT_EQUAL_INT(1, CountingHooks::begins[LFS_OP_FS_SIZE]);
+    TEST_ASSERT_EQUAL_INT(1, CountingHooks::begins[LFS_OP_FORMAT]);
+    // the times of the created file on close, and of the root after formatting
+    TEST_ASSERT_EQUAL_INT(4, CountingHooks::begins[LFS_OP_SETATTR]);
+    TEST_ASSERT_EQUAL_INT(1, CountingHooks::begins[LFS_OP_GETATTR]);
+    // begin, once more to set the times after formatting, and again after it
+    TEST_ASSERT_EQUAL_INT(3, CountingHooks::begins[LFS_OP_MOUNT]);
+    TEST_ASSERT_EQUAL_INT(3, CountingHooks::begins[LFS_OP_UNMOUNT]);
+    for (int op = 0; op < LFS_OP_COUNT; op++) {
+        TEST_ASSERT_EQUAL_INT(CountingHooks::begins[op], CountingHooks::ends[op]);
+    }
+}
+
+time_t hostTime(void)
+{
+    return time(NULL);
+}
+
+void testFsVirtualTime(void)
+{
+    VirtualClock::reset();
+    LittleFS.setTimeCallback(VirtualClock::now);
+    TEST_ASSERT_TRUE(VirtualClock::set(1700000000));
+
+    File file = LittleFS.open(FILE_NAME, "w");
+    file.write('x');
+    file.close();
+    VirtualClock::advance(60);
+    file = LittleFS.open(FILE_NAME, "r");
+    TEST_ASSERT_EQUAL_INT64(1700000000, file.getLastWrite());
+    file.close();
+
+    file = LittleFS.open(FILE_NAME, "a");
+    file.write('y');
+    file.close();
+    file = LittleFS.open(FILE_NAME, "r");
+    TEST_ASSERT_EQUAL_INT64(1700000060, file.getLastWrite());
+    file.close();
+
+    // the time moves with the file, and is on the host file after unmounting
+    TEST_ASSERT_TRUE(LittleFS.rename(FILE_NAME, BASE_NAME "/renamed.txt"));
+    file = LittleFS.open(BASE_NAME "/renamed.txt", "r");
+    TEST_ASSERT_EQUAL_INT64(1700000060, file.getLastWrite());
+    file.close();
+    TEST_ASSERT_TRUE(LittleFS.rename(BASE_NAME "/renamed.txt", FILE_NAME));
+    LittleFS.end();
+    struct stat st;
+    TEST_ASSERT_EQUAL_INT(0, stat(TEST_DIR FILE_NAME, &st));
+    TEST_ASSERT_EQUAL_INT64(1700000060, (int64_t)st.st_mtime);
+    TEST_ASSERT_TRUE(LittleFS.begin());
+
+    // monotonic
+    TEST_ASSERT_FALSE(VirtualClock::set(1700000000));
+    VirtualClock::setStep(1);
+    TEST_ASSERT_EQUAL_INT64(1700000060, VirtualClock::now());
+    TEST_ASSERT_EQUAL_INT64(1700000061, VirtualClock::now());
+
+    VirtualClock::reset();
+    TEST_ASSERT_EQUAL_INT64(VirtualClock::START, VirtualClock::now());
+    LittleFS.setTimeCallback(hostTime);
+
+    // stamped on close, even without a write
+    time_t before = time(NULL);
+    file = LittleFS.open(FILE_NAME, "a");
+    file.close();
+    file = LittleFS.open(FILE_NAME, "r");
+    TEST_ASSERT_TRUE(file.getLastWrite() >= before && file.getLastWrite() <= time(NULL));
+    file.close();
+}
+
+void testFsThreads(void)
+{
+    const int THREADS = 8;
+    const int ROUNDS = 50;
+    LittleFS.resetStats();
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([t, &failures] {
+            // Unity asserts only work on the test thread, count instead
+            String name = String(BASE_NAME) + "/thread" + String(t);
+            for (int i = 0; i < ROUNDS; i++) {
+                String content = name + "#" + String(i);
+                File file = LittleFS.open(name + ".tmp", "w");
+                if (!file || file.write(content.c_str(), content.length()) != content.length())
+                    failures++;
+                file.close();
+                if (!LittleFS.rename(name + ".tmp", name + ".txt") || !LittleFS.exists(name + ".txt"))
+                    failures++;
+                file = LittleFS.open(name + ".txt", "r");
+                if (!file || file.readString() != content)
+                    failures++;
+                file.close();
+            }
+        });
+    }
+    // listing and exists() at the same time
+    for (int i = 0; i < ROUNDS; i++) {
+        Dir dir = LittleFS.openDir(BASE_NAME);
+        while (dir.next())
+            ;
+        LittleFS.exists(BASE_NAME "/thread0.txt");
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    TEST_ASSERT_EQUAL_INT(0, failures.load());
+
+    FSStats stats;
+    LittleFS.stats(stats);
+    TEST_ASSERT_EQUAL_UINT64(THREADS * ROUNDS, stats[FSOpRename].count);
+    TEST_ASSERT_EQUAL_UINT64(2 * THREADS * ROUNDS, stats[FSOpClose].count);
+    for (int t = 0; t < THREADS; t++) {
+        String name = String(BASE_NAME) + "/thread" + String(t) + ".txt";
+        File file = LittleFS.open(name, "r");
+        TEST_ASSERT_TRUE(file.readString() == String(BASE_NAME) + "/thread" + String(t) + "#" + String(ROUNDS - 1));
+        file.close();
+        TEST_ASSERT_TRUE(LittleFS.remove(name));
+    }
+}
+
+void testFsInstances(void)
+{
+    const int SHARDS = 4;
+    String roots[SHARDS];
+    std::vector<std::thread> threads;
+    std::atomic<int> failures(0);
+    for (int t = 0; t < SHARDS; t++) {
+        threads.emplace_back([t, &roots, &failures] {
+            // a file system of its own per thread, the same paths in each
+            roots[t] = LittleFSConfig::uniqueRoot(TEST_DIR "shard");
+            FS fs(FSImplPtr(new littlefs_impl::LittleFSImpl(1, 1, 1, 1, 5)));
+            if (!roots[t].length() || !fs.setConfig(LittleFSConfig().setRoot(roots[t])) || !fs.begin()) {
+                failures++;
+                return;
+            }
+            String content = "shard" + String(t);
+            for (int i = 0; i <= t; i++) {
+                File file = fs.open("/shard.txt", "a");
+                if (!file || file.write(content.c_str(), content.length()) != content.length())
+                    failures++;
+                file.close();
+            }
+            FSStats stats;
+            fs.stats(stats);
+            if (stats[FSOpWrite].count != (uint64_t)t + 1)
+                failures++;
+            fs.end();
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    TEST_ASSERT_EQUAL_INT(0, failures.load());
+
+    for (int t = 0; t < SHARDS; t++) {
+        for (int other = 0; other < t; other++)
+            TEST_ASSERT_FALSE(roots[t] == roots[other]);
+        String path = roots[t] + "shard.txt";
+        struct stat st;
+        TEST_ASSERT_EQUAL_INT(0, stat(path.c_str(), &st));
+        TEST_ASSERT_EQUAL_INT64(6 * (t + 1), st.st_size);
+        remove(path.c_str());
+        TEST_ASSERT_EQUAL_INT(0, rmdir(roots[t].c_str()));
+    }
+    // the global instance kept its root
+    TEST_ASSERT_FALSE(LittleFS.exists("/shard.txt"));
+}
+
+void testFsLongPaths(void)
+{
+    // a root near the limit of test_dir, and a path near the limit of a name
+    String root = LittleFSConfig::uniqueRoot((String(".unittest-") + String(std::string(180, 'r').c_str())).c_str());
+    TEST_ASSERT_TRUE(root.length() > 190);
+    FS fs(FSImplPtr(new littlefs_impl::LittleFSImpl(1, 1, 1, 1, 5)));
+    TEST_ASSERT_TRUE(fs.setConfig(LittleFSConfig().setRoot(root)));
+    TEST_ASSERT_TRUE(fs.begin());
+    String path = String("/") + std::string(100, 'd').c_str() + "/" + std::string(150, 'f').c_str();
+    File file = fs.open(path, "w");
+    TEST_ASSERT_TRUE(file);
+    file.write("long", 4);
+    file.close();
+    file = fs.open(path, "r");
+    char buf[8] = {};
+    TEST_ASSERT_EQUAL_UINT(4, file.read((uint8_t*) buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_STRING("long", buf);
+    file.close();
+    // the undo log and the shadows hold the long host path
+    FSPowerLossReport report;
+    TEST_ASSERT_TRUE(fs.mockPowerLoss([&fs, &path]() {
+        File file = fs.open(path, "w");
+        file.write("LONG", 4);
+        file.close();
+    }, [&fs, &path]() {
+        return fs.exists(path);
+    }, report));
+    TEST_ASSERT_EQUAL_UINT64(0, report.failures);
+    // traced with the whole path, longer than a name
+    String traced = String("/") + std::string(100, 'd').c_str() + "/" + std::string(160, 't').c_str();
+    TEST_ASSERT_TRUE(traced.length() > LFS_NAME_MAX);
+    TEST_ASSERT_TRUE(fs.mockStartTrace("trace.bin"));
+    file = fs.open(traced, "w");
+    file.close();
+    TEST_ASSERT_TRUE(fs.mockStopTrace());
+    littlefs_impl::TraceReader reader;
+    littlefs_impl::TraceEvent event;
+    TEST_ASSERT_TRUE(reader.open("trace.bin"));
+    int opens = 0;
+    while (reader.next(event)) {
+        if (event.op == LFS_OP_OPEN) {
+            TEST_ASSERT_EQUAL_STRING(traced.c_str(), reader.path(event.path));
+            opens++;
+        }
+    }
+    TEST_ASSERT_TRUE(opens > 0);
+    reader.close();
+    remove("trace.bin");
+    TEST_ASSERT_TRUE(fs.remove(traced));
+    // longer than a host path can be
+    String tooLong = path + "/" + std::string(200, 'x').c_str();
+    TEST_ASSERT_FALSE(fs.open(tooLong, "w"));
+    TEST_ASSERT_FALSE(fs.exists(tooLong));
+    fs.end();
+    TEST_ASSERT_TRUE(LittleFSConfig::removeRoot(root));
+}
+
+void testFsRamRoot(void)
+{
+    String root = LittleFSConfig::uniqueRamRoot();
+    TEST_ASSERT_TRUE(root.length() > 0);
+    struct stat st;
+    if (stat("/dev/shm", &st) == 0)
+        TEST_ASSERT_TRUE(root.startsWith("/dev/shm/littlefs-"));
+    String folder = root + "folder/";
+    TEST_ASSERT_EQUAL_INT(0, RAW_MKDIR(folder.c_str()));
+    FILE* fp = fopen((folder + "file.txt").c_str(), "w");
+    fclose(fp);
+#if !defined(_WIN32)
+    // links out of the root are removed, not followed
+    char cwd[256];
+    TEST_ASSERT_NOT_NULL(getcwd(cwd, sizeof(cwd)));
+    String victim = String(cwd) + "/" + LittleFSConfig::uniqueRoot(".victim");
+    fp = fopen((victim + "precious.txt").c_str(), "w");
+    fclose(fp);
+    TEST_ASSERT_EQUAL_INT(0, symlink(victim.c_str(), (folder + "link").c_str()));
+    TEST_ASSERT_EQUAL_INT(0, symlink((victim + "precious.txt").c_str(), (root + "file-link").c_str()));
+#endif
+    TEST_ASSERT_TRUE(LittleFSConfig::removeRoot(root));
+    TEST_ASSERT_TRUE(stat(root.c_str(), &st) != 0);
+#if !defined(_WIN32)
+    TEST_ASSERT_EQUAL_INT(0, stat((victim + "precious.txt").c_str(), &st));
+    TEST_ASSERT_TRUE(LittleFSConfig::removeRoot(victim));
+#endif
+
+    FS fs(FSImplPtr(new littlefs_impl::LittleFSImpl(1, 1, 1, 1, 5)));
+    TEST_ASSERT_TRUE(fs.setConfig(LittleFSConfig().setRamRoot()));
+    TEST_ASSERT_TRUE(fs.begin());
+    File file = fs.open("/ram/file.txt", "w");
+    TEST_ASSERT_TRUE(file);
+    file.write("ram", 3);
+    file.close();
+    TEST_ASSERT_TRUE(fs.exists("/ram/file.txt"));
+    TEST_ASSERT_FALSE(LittleFS.exists("/ram/file.txt"));
+    // removed by end(), the next begin() starts empty
+    fs.end();
+    TEST_ASSERT_TRUE(fs.begin());
+    TEST_ASSERT_FALSE(fs.exists("/ram/file.txt"));
+    fs.end();
+
+    // --test-dir takes precedence
+    const char* argv[] = { "test", "--ram-root", "--test-dir", TEST_DIR };
+    TEST_ASSERT_TRUE(fs.begin(4, (char**) argv));
+    file = fs.open(FILE_NAME, "w");
+    file.close();
+    TEST_ASSERT_TRUE(LittleFS.exists(FILE_NAME));
+    fs.end();
+
+    // an empty or too long --test-dir fails
+    const char* empty[] = { "test", "--test-dir", "" };
+    TEST_ASSERT_FALSE(fs.begin(3, (char**) empty));
+    std::string dir(300, 'x');
+    const char* tooLong[] = { "test", "--test-dir", dir.c_str() };
+    TEST_ASSERT_FALSE(fs.begin(3, (char**) tooLong));
+}
+
+void testFsAsync(void)
+{
+    const int FILES = 16;
+    FS fs(FSImplPtr(new littlefs_impl::LittleFSImpl(1, 1, 1, 1, 5)));
+    TEST_ASSERT_TRUE(fs.setAsyncThreads(4));
+    TEST_ASSERT_TRUE(fs.begin());
+
+    std::vector<std::future<File>> opened;
+    for (int i = 0; i < FILES; i++)
+        opened.push_back(fs.openAsync(String(BASE_NAME) + "/async" + String(i) + ".txt", "w"));
+    // started by the first call
+    TEST_ASSERT_FALSE(fs.setAsyncThreads(2));
+    std::vector<File> files;
+    for (std::future<File>& f : opened) {
+        files.push_back(f.get());
+        TEST_ASSERT_TRUE(files.back());
+    }
+    char content[FILES][16];
+    std::vector<std::future<size_t>> written;
+    for (int i = 0; i < FILES; i++) {
+        snprintf(content[i], sizeof(content[i]), "async %d", i);
+        written.push_back(files[i].writeAsync((const uint8_t*) content[i], strlen(content[i])));
+    }
+    for (int i = 0; i < FILES; i++) {
+        TEST_ASSERT_EQUAL_UINT(strlen(content[i]), written[i].get());
+        files[i].close();
+    }
+
+    // all reads in flight at once
+    uint8_t buf[FILES][16] = {};
+    std::vector<std::future<size_t>> read;
+    for (int i = 0; i < FILES; i++) {
+        files[i] = fs.open(String(BASE_NAME) + "/async" + String(i) + ".txt", "r");
+        read.push_back(files[i].readAsync(buf[i], sizeof(buf[i])));
+    }
+    for (int i = 0; i < FILES; i++) {
+        TEST_ASSERT_EQUAL_UINT(strlen(content[i]), read[i].get());
+        TEST_ASSERT_EQUAL_MEMORY(content[i], buf[i], strlen(content[i]));
+        files[i].close();
+        TEST_ASSERT_TRUE(fs.remove(String(BASE_NAME) + "/async" + String(i) + ".txt"));
+    }
+
+    // a file of no FS runs right away
+    File none;
+    TEST_ASSERT_EQUAL_UINT(0, none.readAsync(buf[0], 1).get());
+
+    // end() runs the calls still queued first
+    String path = String(BASE_NAME) + "/async.txt";
+    File last = fs.open(path, "w");
+    std::vector<std::future<size_t>> pending;
+    for (int i = 0; i < 64; i++)
+        pending.push_back(last.writeAsync((const uint8_t*) "x", 1));
+    fs.end();
+    for (std::future<size_t>& f : pending)
+        TEST_ASSERT_TRUE(f.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    last.close();
+    TEST_ASSERT_TRUE(fs.begin());
+    last = fs.open(path, "r");
+    TEST_ASSERT_EQUAL_UINT(64, last.size());
+    last.close();
+    TEST_ASSERT_TRUE(fs.remove(path));
+    fs.end();
+
+    // once stopped, the tasks holding the pool let go of it on its threads,
+    // and new tasks run on the caller
+    std::atomic<int> ran(0);
+    std::shared_ptr<FSIoPool> pool = std::make_shared<FSIoPool>(2);
+    for (int i = 0; i < 64; i++)
+        pool->submit([pool, &ran] { ran++; });
+    pool->stop();
+    TEST_ASSERT_EQUAL_INT(64, ran.load());
+    pool->submit([&ran] { ran++; });
+    TEST_ASSERT_EQUAL_INT(65, ran.load());
+}
+
+#if defined(__cpp_impl_coroutine)
+static FSTask coroWrite(FSLoop& loop, String path, String content, int& failures)
+{
+    File file = co_await loop.open(path, "w");
+    if (!file || co_await loop.write(file, (const uint8_t*) content.c_str(), content.length()) != content.length())
+        failures++;
+    co_await loop.close(file);
+}
+
+static FSTask coroSession(FSLoop& loop, int i, int& failures)
+{
+    String path = String(BASE_NAME) + "/coro" + String(i) + ".txt";
+    String content = "session " + String(i);
+    co_await coroWrite(loop, path, content, failures);
+    File file = co_await loop.open(path, "r");
+    uint8_t buf[32] = {};
+    size_t n = co_await loop.read(file, buf, sizeof(buf));
+    if (n != content.length() || memcmp(buf, content.c_str(), n) != 0)
+        failures++;
+    if (!co_await loop.close(file))
+        failures++;
+}
+
+static FSTask coroList(FSLoop& loop, int& files)
+{
+    FSAsyncDir dir = co_await loop.openDir(BASE_NAME);
+    while (co_await dir.next())
+        if (dir.isFile() && dir.fileName().startsWith("coro"))
+            files++;
+}
+
+void testFsCoroutines(void)
+{
+    const int SESSIONS = 200;
+    FS fs(FSImplPtr(new littlefs_impl::LittleFSImpl(1, 1, 1, 1, 5)));
+    TEST_ASSERT_TRUE(fs.begin());
+    FSLoop loop(fs);
+    // sessions only run on this thread, plain ints are fine
+    int failures = 0;
+    for (int i = 0; i < SESSIONS; i++)
+        loop.spawn(coroSession(loop, i, failures));
+    TEST_ASSERT_EQUAL_UINT(SESSIONS, loop.run());
+    TEST_ASSERT_EQUAL_INT(0, failures);
+
+    int files = 0;
+    loop.spawn(coroList(loop, files));
+    TEST_ASSERT_EQUAL_UINT(1, loop.run());
+    TEST_ASSERT_EQUAL_INT(SESSIONS, files);
+    for (int i = 0; i < SESSIONS; i++)
+        TEST_ASSERT_TRUE(fs.remove(String(BASE_NAME) + "/coro" + String(i) + ".txt"));
+    fs.end();
+}
+#endif
+
+void testFsBatch(void)
+{
+    const size_t FILES = 40;    // more than one step of the ring
+    FS fs(FSImplPtr(new littlefs_impl::LittleFSImpl(1, 1, 1, 1, 5)));
+    TEST_ASSERT_TRUE(fs.begin());
+    std::vector<FSBatchFile> files(FILES);
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < FILES; i++) {
+        files[i].path = String(BASE_NAME) + "/batch/file" + String((int) i) + ".txt";
+        // the first one empty
+        String content = i ? "batch " + String((int) i) : "";
+        files[i].data.assign(content.c_str(), content.c_str() + content.length());
+        bytes += content.length();
+    }
+    TEST_ASSERT_TRUE(fs.writeFiles(files));
+
+    std::vector<FSBatchFile> read(FILES + 1);
+    for (size_t i = 0; i < FILES; i++)
+        read[i].path = files[i].path;
+    read[FILES].path = String(BASE_NAME) + "/batch/missing.txt";
+    for (bool uring : { true, false }) {
+        // without io_uring on the host both runs take the plain calls
+        fs.mockBatchUring(uring);
+        fs.resetStats();
+        TEST_ASSERT_FALSE(fs.readFiles(read));
+        for (size_t i = 0; i < FILES; i++) {
+            TEST_ASSERT_TRUE(read[i].ok);
+            TEST_ASSERT_TRUE(read[i].data == files[i].data);
+        }
+        TEST_ASSERT_FALSE(read[FILES].ok);
+
+        FSStats stats;
+        TEST_ASSERT_TRUE(fs.stats(stats));
+        TEST_ASSERT_EQUAL_UINT64(FILES + 1, stats[FSOpOpen].count);
+        TEST_ASSERT_EQUAL_UINT64(1, stats[FSOpOpen].errors);
+        TEST_ASSERT_EQUAL_UINT64(FILES, stats[FSOpRead].count);
+        TEST_ASSERT_EQUAL_UINT64(bytes, stats[FSOpRead].bytes);
+        TEST_ASSERT_EQUAL_UINT64(FILES, stats[FSOpClose].count);
+    }
+    for (size_t i = 0; i < FILES; i++)
+        TEST_ASSERT_TRUE(fs.remove(files[i].path));
+    fs.end();
+}
+
 void testFsExists(void)
 {
     TEST_ASSERT_FALSE(LittleFS.exists(FILE_NAME));
@@ -258,6 +1206,81 @@ void testFileTruncate(void)
     TEST_ASSERT_EQUAL_CHAR_ARRAY("0123456789", buf, 10);
 }
 
+void testFileLarge(void)
+{
+    // sparse on the host, the file does not occupy the 5 GB
+    const uint64_t largeSize = 5ULL * 1024 * 1024 * 1024;
+    FSInfo64 info;
+    LittleFS.info64(info);
+    FSInfo64 device = info;
+    device.totalBytes = 8ULL * 1024 * 1024 * 1024;
+    device.blockSize = 4096;
+    LittleFS.mockSetInfo64(device);
+    rawCreateFile("0123456789");
+
+    File file = LittleFS.open(FILE_NAME, "a+");
+    TEST_ASSERT_TRUE(file.truncate64(largeSize));
+    TEST_ASSERT_EQUAL_UINT64(largeSize, file.size64());
+
+    TEST_ASSERT_TRUE(file.seek64(largeSize - 1));
+    TEST_ASSERT_EQUAL_UINT64(largeSize - 1, file.position64());
+    TEST_ASSERT_EQUAL_INT(0, file.read());
+
+    TEST_ASSERT_TRUE(file.seek64(largeSize - 6, SeekMode::SeekSet));
+    TEST_ASSERT_TRUE(file.seek64(-(int64_t)(largeSize - 13), SeekMode::SeekCur));
+    TEST_ASSERT_EQUAL_CHAR('7', (char)file.read());
+    TEST_ASSERT_FALSE(file.seek64(largeSize + 1));
+
+    TEST_ASSERT_TRUE(file.truncate64(10));
+    TEST_ASSERT_EQUAL_UINT64(10, file.size64());
+    file.close();
+    LittleFS.mockSetInfo64(info);
+}
+
+void testFileReserve(void)
+{
+    char content[] = "0123456789";
+
+    File file = LittleFS.open(FILE_NAME, "w");
+    TEST_ASSERT_TRUE(file.reserve(4096));
+    TEST_ASSERT_EQUAL_size_t(0, file.size());
+    file.write((uint8_t*) content, strlen(content));
+    file.close();
+
+    char buf[25];
+    TEST_ASSERT_EQUAL_size_t(10, rawReadFile(buf, 25));
+
+    file = LittleFS.open(FILE_NAME, "r");
+    TEST_ASSERT_FALSE(file.reserve(4096));
+    file.close();
+}
+
+void testFileDurability(void)
+{
+    char buf[25];
+    char content[] = "0123456789";
+    lfs_durability levels[] = { LFS_DURABILITY_NONE, LFS_DURABILITY_FLUSH, LFS_DURABILITY_FDATASYNC, LFS_DURABILITY_FSYNC };
+
+    for (lfs_durability level : levels)
+    {
+        LittleFS.end();
+        TEST_ASSERT_TRUE(LittleFS.setConfig(LittleFSConfig().setDurability(level)));
+        TEST_ASSERT_TRUE(LittleFS.begin());
+
+        File file = LittleFS.open(FILE_NAME, "w");
+        file.write((uint8_t*) content, strlen(content));
+        file.flush();
+        // without durability the data stays in the user buffers until close
+        TEST_ASSERT_EQUAL_size_t(level == LFS_DURABILITY_NONE ? 0 : 10, rawReadFile(buf, 25));
+        file.close();
+        TEST_ASSERT_EQUAL_size_t(10, rawReadFile(buf, 25));
+    }
+
+    LittleFS.end();
+    LittleFS.setConfig(LittleFSConfig());
+    LittleFS.begin();
+}
+
 void testFileName(void)
 {
     rawCreateFile();
@@ -369,6 +1392,16 @@ void testDirOpenFile(void)
         }
     }
     TEST_ASSERT_TRUE(found);
+
+    // openDir of a file only lists that file, not the names it starts
+    rawCreateFile("4567", BASE_NAME "/file.txt.bak");
+    dir = LittleFS.openDir(FILE_NAME);
+    TEST_ASSERT_TRUE(dir.next());
+    TEST_ASSERT_EQUAL_STRING("file.txt", dir.fileName().c_str());
+    TEST_ASSERT_EQUAL_INT(3, dir.fileSize());
+    TEST_ASSERT_TRUE(dir.isFile());
+    TEST_ASSERT_FALSE(dir.next());
+    rawRemoveFile(BASE_NAME "/file.txt.bak");
 }
 
 void testAllInRoot(void)
@@ -394,12 +1427,17 @@ void testAllInRoot(void)
 
 void setUp(void)
 {
-    mkdir(TEST_DIR);
+    FSAlloc::reset();
+    RAW_MKDIR(TEST_DIR);
     rawCreateFolder(BASE_NAME);
 }
 
 void tearDown(void)
 {
+    if (FSAlloc::active()) {
+        printf("%s: heap peak %lld bytes\n", Unity.CurrentTestName, (long long) FSAlloc::peakBytes());
+    }
+    LittleFS.mockLimitCapacity(false);
     rawRemoveFile(FILE_NAME);
     rawRemoveFolder(FOLDER_NAME);
     if (!rawRemoveFolder(BASE_NAME) && errno != ENOENT)
@@ -414,6 +1452,27 @@ int main(int argc, char **argv)
 
     RUN_TEST(testFsIsMounted);
     RUN_TEST(testFsInfo);
+    RUN_TEST(testFsInfo64);
+    RUN_TEST(testFsTiming);
+    RUN_TEST(testFsWear);
+    RUN_TEST(testFsNoSpace);
+    RUN_TEST(testFsPowerLoss);
+    RUN_TEST(testFsVirtualTime);
+    RUN_TEST(testFsStats);
+    RUN_TEST(testFsTrace);
+    RUN_TEST(testFsReplay);
+    RUN_TEST(testFsChromeTrace);
+    RUN_TEST(testFsAlloc);
+    RUN_TEST(testFsHooks);
+    RUN_TEST(testFsThreads);
+    RUN_TEST(testFsInstances);
+    RUN_TEST(testFsLongPaths);
+    RUN_TEST(testFsRamRoot);
+    RUN_TEST(testFsAsync);
+#if defined(__cpp_impl_coroutine)
+    RUN_TEST(testFsCoroutines);
+#endif
+    RUN_TEST(testFsBatch);
     RUN_TEST(testFsExists);
     RUN_TEST(testFsRename);
     RUN_TEST(testFsCreateFolder);
@@ -425,6 +1484,11 @@ int main(int argc, char **argv)
     RUN_TEST(testFileSeek);
     RUN_TEST(testFilePosition);
     RUN_TEST(testFileTruncate);
+#if !defined(_WIN32) // _chsize_s() zero-fills instead of creating a sparse file
+    RUN_TEST(testFileLarge);
+#endif
+    RUN_TEST(testFileReserve);
+    RUN_TEST(testFileDurability);
     RUN_TEST(testFileName);
     RUN_TEST(testFileFullName);
     RUN_TEST(testFileIsFile);
@@ -435,5 +1499,15 @@ int main(int argc, char **argv)
     RUN_TEST(testAllInRoot);
 
     LittleFS.end();
+    if (FSAlloc::active()) {
+        FSAllocStats stats[FSAlloc::CALLS];
+        size_t count = FSAlloc::report(stats, FSAlloc::CALLS);
+        printf("%-24s %8s %8s %10s %6s %8s\n", "call", "calls", "allocs", "bytes", "max", "max B");
+        for (size_t i = 0; i < count; i++) {
+            printf("%-24s %8llu %8llu %10llu %6llu %8llu\n", stats[i].call, (unsigned long long) stats[i].calls,
+                   (unsigned long long) stats[i].allocations, (unsigned long long) stats[i].bytes,
+                   (unsigned long long) stats[i].maxAllocations, (unsigned long long) stats[i].maxBytes);
+        }
+    }
     UNITY_END();
 }
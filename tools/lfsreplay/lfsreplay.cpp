@@ -0,0 +1,99 @@
+/*
+ lfsreplay - runs the calls of a trace recorded with "--trace <file>" again
+ and reports the throughput and the latency per operation
+
+ Usage: lfsreplay <trace> [--paced] [--speed <factor>] [--flash esp8266]
+                          [--test-dir <dir>] [--durability <level>]
+
+ The test dir should hold the files the trace starts with. --paced keeps
+ the recorded time between the calls, --speed scales it. --flash adds the
+ estimated device time of the virtual flash.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "LittleFS.h"
+
+static int usage() {
+    fprintf(stderr, "usage: lfsreplay <trace> [--paced] [--speed <factor>] [--flash esp8266]\n"
+                    "                         [--test-dir <dir>] [--durability <level>]\n");
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argv[1][0] == '-') {
+        return usage();
+    }
+    FSReplayOptions options;
+    bool flash = false;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--paced") == 0) {
+            options.paced = true;
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            options.paced = true;
+            options.speed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--flash") == 0 && i + 1 < argc) {
+            if (strcmp(argv[++i], "esp8266") != 0) {
+                return usage();
+            }
+            flash = true;
+        }
+    }
+    // --test-dir and --durability
+    if (!LittleFS.begin(argc, argv)) {
+        fprintf(stderr, "lfsreplay: cannot mount the test dir\n");
+        return 1;
+    }
+    if (flash) {
+        LittleFS.mockSetTimingModel(FSTimingModel::esp8266());
+        LittleFS.mockResetTiming();
+    }
+
+    FSReplayReport report;
+    if (!LittleFS.mockReplay(argv[1], options, report)) {
+        fprintf(stderr, "lfsreplay: cannot replay `%s`\n", argv[1]);
+        return 1;
+    }
+
+    printf("%-10s %10s %8s %10s %10s %10s %10s\n", "op", "count", "errors", "mean us", "p50 us", "p99 us", "max us");
+    for (int op = 0; op < FSOpCount; op++) {
+        const FSOpStats& s = report.stats[(FSOp)op];
+        if (!s.count) {
+            continue;
+        }
+        printf("%-10s %10llu %8llu %10.1f %10.1f %10.1f %10.1f\n", FSStats::opName((FSOp)op),
+               (unsigned long long)s.count, (unsigned long long)s.errors, s.meanNs() / 1e3,
+               s.percentileNs(50) / 1e3, s.percentileNs(99) / 1e3, s.maxNs / 1e3);
+    }
+    printf("\n%llu calls in %.3f s, %.0f ops/s, %.2f MB/s\n", (unsigned long long)report.events,
+           report.elapsedNs / 1e9, report.opsPerSecond(), report.bytesPerSecond() / 1e6);
+    if (options.paced) {
+        printf("paced x%g, at most %.1f us behind\n", options.speed, report.maxLagNs / 1e3);
+    }
+    if (flash) {
+        FSTiming timing;
+        LittleFS.mockTiming(timing);
+        printf("device time %.3f s\n", timing.clockNs / 1e9);
+    }
+    if (report.mismatches) {
+        printf("%llu calls went differently than recorded\n", (unsigned long long)report.mismatches);
+    }
+    LittleFS.end();
+    return report.mismatches ? 3 : 0;
+}